@@ -0,0 +1,235 @@
+// Egress throughput over loopback, in packets per second per core.
+//
+// A server connection sends one iteration of data to a client connection in
+// the same thread, through a pair of UDP sockets on 127.0.0.1. Data packets
+// are written to the socket one `sendto()` per packet, or as one `sendmsg()`
+// with `UDP_SEGMENT` per buffer of segments built by `send_segments()`,
+// falling back to one `sendto()` per segment if the kernel rejects GSO.
+// Packets are handed to the client in process and its ACKs back to the
+// server, so that the congestion window opens as it would on the wire.
+//
+// Only the time spent building and sending packets is counted, on one core,
+// so the result is the egress cost per packet of the sender.
+//
+// Run with `cargo bench --bench egress`. Every measurement is the median of
+// `RUNS` iterations.
+
+use std::net::SocketAddr;
+use std::net::UdpSocket;
+use std::os::unix::io::AsRawFd;
+use std::time::Duration;
+use std::time::Instant;
+
+const RUNS: usize = 5;
+
+/// The bytes of one iteration.
+const ITERATION_LEN: usize = 32 << 20;
+
+/// The number of windows after which an iteration is given up on.
+const MAX_ROUNDS: usize = 10_000;
+
+const MAX_DATAGRAM_SIZE: usize = 1350;
+
+const MAX_GSO_SEGMENTS: usize = 64;
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+enum Mode {
+    /// One `sendto()` per packet.
+    Sendto,
+
+    /// One `sendmsg()` with `UDP_SEGMENT` per buffer of segments.
+    Gso,
+}
+
+struct Link {
+    tx: UdpSocket,
+    rx: UdpSocket,
+    gso: bool,
+}
+
+impl Link {
+    fn new() -> Link {
+        let rx = UdpSocket::bind("127.0.0.1:0").unwrap();
+        let tx = UdpSocket::bind("127.0.0.1:0").unwrap();
+
+        tx.connect(rx.local_addr().unwrap()).unwrap();
+        rx.set_nonblocking(true).unwrap();
+
+        Link { tx, rx, gso: true }
+    }
+
+    /// Sends `buf` as datagrams of `segment_size` bytes, with a single
+    /// `sendmsg()` if GSO works. Returns the number of datagrams sent.
+    fn send_segments(&mut self, buf: &[u8], segment_size: usize) -> usize {
+        if self.gso && send_gso(&self.tx, buf, segment_size) {
+            return (buf.len() + segment_size - 1) / segment_size;
+        }
+
+        self.gso = false;
+
+        for segment in buf.chunks(segment_size) {
+            let _ = self.tx.send(segment);
+        }
+
+        (buf.len() + segment_size - 1) / segment_size
+    }
+
+    /// Drops what the receiving socket got, so that its buffer never
+    /// fills.
+    fn drain(&self) {
+        let mut buf = [0; 65536];
+
+        while self.rx.recv(&mut buf).is_ok() {}
+    }
+}
+
+/// Sends `buf` with `UDP_SEGMENT`, returning false if the kernel rejects
+/// it.
+fn send_gso(sock: &UdpSocket, buf: &[u8], segment_size: usize) -> bool {
+    let mut iov = libc::iovec {
+        iov_base: buf.as_ptr() as *mut libc::c_void,
+        iov_len: buf.len(),
+    };
+
+    // Aligned room for one u16 control message.
+    let mut ctrl = [0u64; 4];
+
+    unsafe {
+        let mut msg: libc::msghdr = std::mem::zeroed();
+        msg.msg_iov = &mut iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = ctrl.as_mut_ptr() as *mut libc::c_void;
+        msg.msg_controllen = libc::CMSG_SPACE(2) as _;
+
+        let cm = libc::CMSG_FIRSTHDR(&msg);
+        (*cm).cmsg_level = libc::SOL_UDP;
+        (*cm).cmsg_type = libc::UDP_SEGMENT;
+        (*cm).cmsg_len = libc::CMSG_LEN(2) as _;
+        std::ptr::copy_nonoverlapping(
+            (segment_size as u16).to_ne_bytes().as_ptr(),
+            libc::CMSG_DATA(cm),
+            2,
+        );
+
+        libc::sendmsg(sock.as_raw_fd(), &msg, 0) == buf.len() as isize
+    }
+}
+
+/// Returns one iteration of native-endian f32 values.
+fn iteration() -> Vec<u8> {
+    (0..ITERATION_LEN / 4)
+        .flat_map(|i| ((i % 977) as f32).to_ne_bytes())
+        .collect()
+}
+
+/// Hands the packets of `buf`, datagrams of `segment_size` bytes, to the
+/// client, and its ACKs back to the server.
+fn deliver(
+    s: &mut dmludp::Connection, c: &mut dmludp::Connection, buf: &mut [u8],
+    segment_size: usize,
+) {
+    let mut ack = [0; MAX_DATAGRAM_SIZE];
+
+    for pkt in buf.chunks_mut(segment_size) {
+        let _ = c.recv_slice(pkt);
+
+        if c.send_ack() {
+            if let Ok((n, _)) = c.send_data(&mut ack) {
+                let _ = s.recv_slice(&mut ack[..n]);
+            }
+        }
+    }
+}
+
+/// Sends one iteration and returns the number of packets sent and the time
+/// spent sending them.
+fn run(mode: Mode, data: &[u8], link: &mut Link) -> (usize, Duration) {
+    let mut cfg = dmludp::Config::new().unwrap();
+    cfg.set_max_send_udp_payload_size(MAX_DATAGRAM_SIZE);
+
+    let a: SocketAddr = "127.0.0.1:1".parse().unwrap();
+    let b: SocketAddr = "127.0.0.1:2".parse().unwrap();
+    let mut s = dmludp::accept(a, b, &mut cfg).unwrap();
+    let mut c = dmludp::connect(b, a, &mut cfg).unwrap();
+
+    s.data_write(data.to_vec()).unwrap();
+
+    let mut out = vec![0; MAX_GSO_SEGMENTS * MAX_DATAGRAM_SIZE];
+
+    // Handshake.
+    let (n, _) = s.send_data(&mut out).unwrap();
+    c.recv_slice(&mut out[..n]).unwrap();
+    let (n, _) = c.send_data(&mut out).unwrap();
+    s.recv_slice(&mut out[..n]).unwrap();
+
+    let mut packets = 0;
+    let mut busy = Duration::ZERO;
+
+    for _ in 0..MAX_ROUNDS {
+        if !s.send_all().unwrap() {
+            break;
+        }
+
+        while !s.is_stopped() {
+            let start = Instant::now();
+
+            let (len, seg) = match mode {
+                Mode::Sendto => match s.send_data(&mut out) {
+                    Ok((n, _)) => {
+                        let _ = link.tx.send(&out[..n]);
+                        packets += 1;
+                        (n, n)
+                    },
+
+                    Err(_) => break,
+                },
+
+                Mode::Gso => match s.send_segments(&mut out, s.segment_size()) {
+                    Ok((n, seg, _)) => {
+                        packets += link.send_segments(&out[..n], seg);
+                        (n, seg)
+                    },
+
+                    Err(_) => break,
+                },
+            };
+
+            busy += start.elapsed();
+
+            deliver(&mut s, &mut c, &mut out[..len], seg);
+            link.drain();
+        }
+    }
+
+    (packets, busy)
+}
+
+fn main() {
+    let data = iteration();
+
+    for mode in [Mode::Sendto, Mode::Gso] {
+        let mut link = Link::new();
+        let mut rates = Vec::with_capacity(RUNS);
+        let mut packets = 0;
+
+        for _ in 0..RUNS {
+            let (n, busy) = run(mode, &data, &mut link);
+            packets = n;
+            rates.push(n as f64 / busy.as_secs_f64());
+        }
+
+        rates.sort_by(|a, b| a.partial_cmp(b).unwrap());
+
+        println!(
+            "{:?}: {} packets per iteration, {:.0} packets/s per core{}",
+            mode,
+            packets,
+            rates[RUNS / 2],
+            if mode == Mode::Gso && !link.gso {
+                " (GSO rejected, sendto fallback)"
+            } else {
+                ""
+            },
+        );
+    }
+}
@@ -0,0 +1,159 @@
+// Packet header and ACK payload codecs: the compact header against the
+// legacy fixed one, and block ranges against the legacy list of one index
+// per block.
+//
+// Run with `cargo bench --bench header`. Every measurement is the median of
+// `RUNS` runs of many calls.
+
+use std::hint::black_box;
+use std::time::Instant;
+
+use dmludp::bench::decode_block_ranges;
+use dmludp::bench::encode_block_ranges;
+use dmludp::bench::header;
+use dmludp::bench::header_from_bytes;
+use dmludp::bench::header_to_bytes;
+use dmludp::bench::header_to_bytes_compact;
+use dmludp::Type;
+
+const RUNS: usize = 5;
+
+const BLOCK_SIZE: usize = 1024;
+
+/// The blocks of a 32 MB iteration.
+const BLOCKS: u64 = (32 << 20) / BLOCK_SIZE as u64;
+
+/// Returns the median time per call of `f` in nanoseconds, called `calls`
+/// times with the call number.
+fn measure<F>(calls: usize, mut f: F) -> f64
+where
+    F: FnMut(usize),
+{
+    let mut times = Vec::with_capacity(RUNS);
+
+    for _ in 0..RUNS {
+        let start = Instant::now();
+        for i in 0..calls {
+            f(i);
+        }
+        times.push(start.elapsed());
+    }
+
+    times.sort();
+    times[RUNS / 2].as_nanos() as f64 / calls as f64
+}
+
+fn headers() {
+    let index_len = octets::varint_len(BLOCKS);
+    let mut buf = [0; 64];
+
+    let hdr = |i: usize| {
+        let index = i as u64 % BLOCKS;
+        header(
+            Type::Application,
+            i as u64,
+            (i % 3) as u8 + 1,
+            index * BLOCK_SIZE as u64,
+            BLOCK_SIZE as u64,
+        )
+    };
+
+    let legacy_len = header_to_bytes(&hdr(0), &mut buf).unwrap();
+    let compact_len =
+        header_to_bytes_compact(&hdr(0), &mut buf, index_len, BLOCK_SIZE).unwrap();
+
+    let legacy_enc = measure(1_000_000, |i| {
+        black_box(header_to_bytes(&hdr(i), black_box(&mut buf)).unwrap());
+    });
+
+    let compact_enc = measure(1_000_000, |i| {
+        black_box(
+            header_to_bytes_compact(
+                &hdr(i),
+                black_box(&mut buf),
+                index_len,
+                BLOCK_SIZE,
+            )
+            .unwrap(),
+        );
+    });
+
+    header_to_bytes(&hdr(12345), &mut buf).unwrap();
+    let legacy_dec = measure(1_000_000, |_| {
+        black_box(header_from_bytes(black_box(&mut buf), BLOCK_SIZE).unwrap());
+    });
+
+    header_to_bytes_compact(&hdr(12345), &mut buf, index_len, BLOCK_SIZE)
+        .unwrap();
+    let compact_dec = measure(1_000_000, |_| {
+        black_box(header_from_bytes(black_box(&mut buf), BLOCK_SIZE).unwrap());
+    });
+
+    println!(
+        "header  legacy {:>2} bytes: encode {:>5.1} ns decode {:>5.1} ns",
+        legacy_len, legacy_enc, legacy_dec,
+    );
+    println!(
+        "header compact {:>2} bytes: encode {:>5.1} ns decode {:>5.1} ns",
+        compact_len, compact_enc, compact_dec,
+    );
+}
+
+/// Returns the blocks of a window of `len` blocks from block 1000, with
+/// every `hole`-th block missing.
+fn window(len: u64, hole: u64) -> Vec<u64> {
+    (1000..1000 + len).filter(|b| b % hole != 0).collect()
+}
+
+fn ranges() {
+    let mut buf = vec![0; 64 * 1024];
+
+    for (len, hole) in [(1024, u64::MAX), (1024, 64), (1024, 2)] {
+        let blocks = window(len, hole);
+
+        let mut b = octets::OctetsMut::with_slice(&mut buf);
+        encode_block_ranges(&mut b, &blocks).unwrap();
+        let ranges_len = b.off();
+
+        let mut out = Vec::with_capacity(blocks.len());
+
+        let enc = measure(10_000, |_| {
+            let mut b = octets::OctetsMut::with_slice(black_box(&mut buf));
+            encode_block_ranges(&mut b, black_box(&blocks)).unwrap();
+        });
+
+        let dec = measure(10_000, |_| {
+            let mut b = octets::OctetsMut::with_slice(black_box(&mut buf));
+            out.clear();
+            decode_block_ranges(&mut b, BLOCKS, &mut out).unwrap();
+        });
+
+        assert_eq!(out, blocks);
+
+        // One u64 index per block.
+        let legacy_len = 8 * blocks.len();
+
+        let legacy_enc = measure(10_000, |_| {
+            let mut b = octets::OctetsMut::with_slice(black_box(&mut buf));
+            for block in black_box(&blocks).iter() {
+                b.put_u64(*block).unwrap();
+            }
+        });
+
+        println!(
+            "{:>4} blocks in a window of {}: ranges {:>5} bytes encode {:>7.0} ns decode {:>7.0} ns, list {:>5} bytes encode {:>7.0} ns",
+            blocks.len(),
+            len,
+            ranges_len,
+            enc,
+            dec,
+            legacy_len,
+            legacy_enc,
+        );
+    }
+}
+
+fn main() {
+    headers();
+    ranges();
+}
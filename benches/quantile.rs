@@ -0,0 +1,84 @@
+// Priority split points: linear-time selection against the full sort it
+// replaced, and the streaming sketch, on one norm per block.
+//
+// Run with `cargo bench --bench quantile`. Every measurement is the median
+// of `RUNS` runs, each on a fresh copy of the same input.
+
+use std::time::Duration;
+use std::time::Instant;
+
+use dmludp::bench::select_deciles;
+use dmludp::Sketch;
+
+const RUNS: usize = 5;
+
+/// Returns `len` pseudo-random norms.
+fn norms(len: usize) -> Vec<f32> {
+    let mut x: u64 = 0x2545_f491_4f6c_dd1d;
+
+    (0..len)
+        .map(|_| {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            (x >> 40) as f32 / 1024.0
+        })
+        .collect()
+}
+
+/// Returns the median time of `f` on a copy of `input`, and the split
+/// points it found.
+fn measure<F>(input: &[f32], f: F) -> (Duration, [f32; 2])
+where
+    F: Fn(&mut Vec<f32>) -> [f32; 2],
+{
+    let mut times = Vec::with_capacity(RUNS);
+    let mut split = [0.0; 2];
+
+    for _ in 0..RUNS {
+        let mut v = input.to_vec();
+
+        let start = Instant::now();
+        split = f(&mut v);
+        times.push(start.elapsed());
+    }
+
+    times.sort();
+    (times[RUNS / 2], split)
+}
+
+fn main() {
+    for blocks in [1_000_000, 10_000_000] {
+        let input = norms(blocks);
+
+        let (sort, sorted) = measure(&input, |v| {
+            v.sort_by(|a, b| a.partial_cmp(b).unwrap());
+            [v[v.len() * 3 / 10], v[v.len() * 7 / 10]]
+        });
+
+        let (select, selected) = measure(&input, |v| select_deciles(v, [3, 7]));
+
+        let (sketch, sketched) = measure(&input, |v| {
+            let mut sketch = Sketch::default();
+            for x in v.iter() {
+                sketch.insert(*x);
+            }
+
+            [sketch.quantile(0.3).unwrap(), sketch.quantile(0.7).unwrap()]
+        });
+
+        assert_eq!(sorted, selected);
+
+        println!(
+            "{:>9} blocks: sort {:>8.2?}  select {:>8.2?} ({:.1}x)  sketch {:>8.2?} ({:.1}x)  splits {:?} sketched {:?}",
+            blocks,
+            sort,
+            select,
+            sort.as_secs_f64() / select.as_secs_f64(),
+            sketch,
+            sort.as_secs_f64() / sketch.as_secs_f64(),
+            sorted,
+            sketched,
+        );
+    }
+}
@@ -0,0 +1,310 @@
+// Per-block state of an iteration.
+//
+// Every block of the data is identified by its index, its offset divided by
+// the block size, so the state of a block is kept in plain arrays indexed by
+// block instead of hash maps keyed by offset. The arrays grow up to the
+// largest block seen and are cleared, keeping their storage, when a new
+// iteration starts.
+
+use crate::RETRANSMIT_UNLIMITED;
+
+/// The maximum number of blocks of an iteration. Blocks past it, which can
+/// only come from a bogus packet, are ignored.
+pub const MAX_BLOCKS: u64 = 1 << 20;
+
+/// Structure-of-arrays state of the blocks of the current iteration.
+///
+/// The sender records the priority and the remaining transmissions of each
+/// block it sent, and the blocks it asked about that no ACK answered yet.
+/// The receiver records the priority of each block it received and the
+/// blocks the sender asked about since the last ACK.
+#[derive(Default)]
+pub struct BlockTable {
+    /// The priority each block was sent or received with.
+    priority: Vec<u8>,
+
+    /// The number of times each block can still be retransmitted before it
+    /// is given up on.
+    budget: Vec<u8>,
+
+    /// Bitmap of the blocks sent.
+    sent: Vec<u64>,
+
+    /// Bitmap of the blocks received.
+    received: Vec<u64>,
+
+    /// Bitmap of the blocks reported by ElictAck packets since the last
+    /// ACK.
+    reported: Vec<u64>,
+
+    /// The indices of the blocks reported, in arrival order. Blocks cleared
+    /// with `unreport()` stay in the list until `take_reported()` is called
+    /// or no reported block is left.
+    reported_list: Vec<u64>,
+
+    /// The number of blocks set in `reported`.
+    reported_count: usize,
+}
+
+impl BlockTable {
+    /// Clears the state of all blocks, for a new iteration.
+    pub fn reset(&mut self) {
+        self.priority.clear();
+        self.budget.clear();
+        self.sent.clear();
+        self.received.clear();
+        self.reported.clear();
+        self.reported_list.clear();
+        self.reported_count = 0;
+    }
+
+    /// Records that block `idx` was sent with `priority`.
+    ///
+    /// The first transmission sets the number of retransmissions left to
+    /// `budget`, every retransmission uses one, unless the budget is
+    /// `RETRANSMIT_UNLIMITED`.
+    pub fn on_sent(&mut self, idx: u64, priority: u8, budget: u8) {
+        if !self.grow(idx) {
+            return;
+        }
+
+        let i = idx as usize;
+
+        if get_bit(&self.sent, i) {
+            if self.budget[i] != RETRANSMIT_UNLIMITED {
+                self.budget[i] = self.budget[i].saturating_sub(1);
+            }
+            return;
+        }
+
+        set_bit(&mut self.sent, i);
+        self.priority[i] = priority;
+        self.budget[i] = budget;
+    }
+
+    /// Returns true if block `idx` was sent and has no transmission left.
+    pub fn is_exhausted(&self, idx: u64) -> bool {
+        let i = idx as usize;
+
+        get_bit(&self.sent, i) && self.budget[i] == 0
+    }
+
+    /// Records that block `idx` was received with `priority`.
+    pub fn on_received(&mut self, idx: u64, priority: u8) {
+        if !self.grow(idx) {
+            return;
+        }
+
+        set_bit(&mut self.received, idx as usize);
+        self.priority[idx as usize] = priority;
+    }
+
+    /// Returns true if block `idx` was received.
+    pub fn is_received(&self, idx: u64) -> bool {
+        get_bit(&self.received, idx as usize)
+    }
+
+    /// Returns the priority block `idx` was sent or received with.
+    pub fn priority(&self, idx: u64) -> Option<u8> {
+        let i = idx as usize;
+
+        if get_bit(&self.sent, i) || get_bit(&self.received, i) {
+            Some(self.priority[i])
+        } else {
+            None
+        }
+    }
+
+    /// Records that the sender asked about block `idx`.
+    pub fn report(&mut self, idx: u64) {
+        if !self.grow(idx) || get_bit(&self.reported, idx as usize) {
+            return;
+        }
+
+        set_bit(&mut self.reported, idx as usize);
+        self.reported_list.push(idx);
+        self.reported_count += 1;
+    }
+
+    /// Clears block `idx` from the reported blocks.
+    pub fn unreport(&mut self, idx: u64) {
+        if !get_bit(&self.reported, idx as usize) {
+            return;
+        }
+
+        clear_bit(&mut self.reported, idx as usize);
+        self.reported_count -= 1;
+
+        if self.reported_count == 0 {
+            self.reported_list.clear();
+        }
+    }
+
+    /// Returns the number of blocks reported.
+    pub fn reported_len(&self) -> usize {
+        self.reported_count
+    }
+
+    /// Moves the indices of the reported blocks into `out`, sorted, and
+    /// clears them.
+    pub fn take_reported(&mut self, out: &mut Vec<u64>) {
+        out.clear();
+
+        for idx in self.reported_list.drain(..) {
+            if get_bit(&self.reported, idx as usize) {
+                clear_bit(&mut self.reported, idx as usize);
+                out.push(idx);
+            }
+        }
+
+        self.reported_count = 0;
+        out.sort_unstable();
+    }
+
+    /// Makes room for block `idx`, returning false if it is out of bounds.
+    #[inline]
+    fn grow(&mut self, idx: u64) -> bool {
+        if idx >= MAX_BLOCKS {
+            return false;
+        }
+
+        let len = idx as usize + 1;
+
+        if self.priority.len() < len {
+            let words = (len + 63) / 64;
+
+            self.priority.resize(len, 0);
+            self.budget.resize(len, 0);
+            self.sent.resize(words, 0);
+            self.received.resize(words, 0);
+            self.reported.resize(words, 0);
+        }
+
+        true
+    }
+}
+
+#[inline]
+fn get_bit(bits: &[u64], i: usize) -> bool {
+    bits.get(i / 64).map_or(false, |w| w & (1 << (i % 64)) != 0)
+}
+
+#[inline]
+fn set_bit(bits: &mut [u64], i: usize) {
+    bits[i / 64] |= 1 << (i % 64);
+}
+
+#[inline]
+fn clear_bit(bits: &mut [u64], i: usize) {
+    bits[i / 64] &= !(1 << (i % 64));
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn sent_and_received() {
+        let mut t = BlockTable::default();
+
+        assert_eq!(t.priority(0), None);
+        assert!(!t.is_received(0));
+
+        t.on_sent(3, 2, 1);
+        assert_eq!(t.priority(3), Some(2));
+        assert_eq!(t.priority(2), None);
+        assert!(!t.is_received(3));
+
+        t.on_received(70, 3);
+        assert!(t.is_received(70));
+        assert!(!t.is_received(69));
+        assert!(!t.is_received(1000));
+        assert_eq!(t.priority(70), Some(3));
+
+        t.reset();
+        assert_eq!(t.priority(3), None);
+        assert!(!t.is_received(70));
+    }
+
+    #[test]
+    fn retransmit_budget() {
+        let mut t = BlockTable::default();
+
+        t.on_sent(5, 1, 2);
+        assert!(!t.is_exhausted(5));
+
+        // A retransmission keeps the priority of the first transmission.
+        t.on_sent(5, 3, 2);
+        assert_eq!(t.priority(5), Some(1));
+        assert!(!t.is_exhausted(5));
+
+        t.on_sent(5, 1, 2);
+        assert!(t.is_exhausted(5));
+
+        t.on_sent(5, 1, 2);
+        assert!(t.is_exhausted(5));
+
+        // Unsent blocks are never exhausted.
+        assert!(!t.is_exhausted(6));
+        assert!(!t.is_exhausted(MAX_BLOCKS + 1));
+
+        t.on_sent(6, 1, 0);
+        assert!(t.is_exhausted(6));
+
+        t.on_sent(7, 1, RETRANSMIT_UNLIMITED);
+        for _ in 0..1000 {
+            t.on_sent(7, 1, RETRANSMIT_UNLIMITED);
+        }
+        assert!(!t.is_exhausted(7));
+    }
+
+    #[test]
+    fn reported() {
+        let mut t = BlockTable::default();
+        let mut out = vec![42];
+
+        for idx in [9, 2, 130, 2, 64] {
+            t.report(idx);
+        }
+        assert_eq!(t.reported_len(), 4);
+
+        t.unreport(130);
+        t.unreport(130);
+        t.unreport(1);
+        assert_eq!(t.reported_len(), 3);
+
+        t.take_reported(&mut out);
+        assert_eq!(out, [2, 9, 64]);
+        assert_eq!(t.reported_len(), 0);
+
+        // A block can be reported again once taken, or cleared.
+        t.report(9);
+        t.unreport(9);
+        assert_eq!(t.reported_len(), 0);
+
+        t.report(9);
+        t.take_reported(&mut out);
+        assert_eq!(out, [9]);
+
+        t.take_reported(&mut out);
+        assert!(out.is_empty());
+    }
+
+    #[test]
+    fn out_of_bounds() {
+        let mut t = BlockTable::default();
+
+        t.on_sent(MAX_BLOCKS, 1, 1);
+        t.on_received(MAX_BLOCKS, 1);
+        t.report(MAX_BLOCKS);
+        t.unreport(MAX_BLOCKS);
+
+        assert_eq!(t.priority(MAX_BLOCKS), None);
+        assert!(!t.is_received(MAX_BLOCKS));
+        assert_eq!(t.reported_len(), 0);
+        assert!(t.priority.is_empty());
+
+        t.on_received(MAX_BLOCKS - 1, 2);
+        assert!(t.is_received(MAX_BLOCKS - 1));
+    }
+}
@@ -24,11 +24,14 @@
 // NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
 // SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#define _GNU_SOURCE
+
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <fcntl.h>
@@ -36,6 +39,8 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
 #include <netdb.h>
 
 #include <ev.h>
@@ -46,6 +51,18 @@
 
 #define MAX_DATAGRAM_SIZE 1350
 
+#define MAX_SEND_BATCH 64
+
+#define MAX_RECV_BATCH 16
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
 struct conn_io {
     ev_timer timer;
 
@@ -62,34 +79,46 @@ static void debug_log(const char *line, void *argp) {
 }
 
 static void flush_egress(struct ev_loop *loop, struct conn_io *conn_io) {
-    static uint8_t out[MAX_DATAGRAM_SIZE];
-
-    quiche_send_info send_info;
+    static uint8_t out[MAX_SEND_BATCH][MAX_DATAGRAM_SIZE];
+    static size_t out_lens[MAX_SEND_BATCH];
+    static quiche_send_info send_info[MAX_SEND_BATCH];
+    static struct iovec iov[MAX_SEND_BATCH];
+    static struct mmsghdr msgs[MAX_SEND_BATCH];
 
     while (1) {
-        ssize_t written = quiche_conn_send(conn_io->conn, out, sizeof(out),
-                                           &send_info);
+        ssize_t n = quiche_conn_send_batch(conn_io->conn, &out[0][0],
+                                           MAX_DATAGRAM_SIZE, out_lens,
+                                           send_info, MAX_SEND_BATCH);
 
-        if (written == QUICHE_ERR_DONE) {
+        if (n == QUICHE_ERR_DONE) {
             fprintf(stderr, "done writing\n");
             break;
         }
 
-        if (written < 0) {
-            fprintf(stderr, "failed to create packet: %zd\n", written);
+        if (n < 0) {
+            fprintf(stderr, "failed to create packets: %zd\n", n);
             return;
         }
 
-        ssize_t sent = sendto(conn_io->sock, out, written, 0,
-                              (struct sockaddr *) &send_info.to,
-                              send_info.to_len);
+        for (ssize_t i = 0; i < n; i++) {
+            iov[i].iov_base = out[i];
+            iov[i].iov_len = out_lens[i];
+
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_name = &send_info[i].to;
+            msgs[i].msg_hdr.msg_namelen = send_info[i].to_len;
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int sent = sendmmsg(conn_io->sock, msgs, n, 0);
 
-        if (sent != written) {
+        if (sent != n) {
             perror("failed to send");
             return;
         }
 
-        fprintf(stderr, "sent %zd bytes\n", sent);
+        fprintf(stderr, "sent %d packets\n", sent);
     }
 
     double t = quiche_conn_timeout_as_nanos(conn_io->conn) / 1e9f;
@@ -102,18 +131,31 @@ static void recv_cb(EV_P_ ev_io *w, int revents) {
 
     struct conn_io *conn_io = (struct conn_io *)w->data;
 
-    static uint8_t buf[65535];
+    // Each buffer can hold a whole GRO-coalesced batch of packets.
+    static uint8_t bufs[MAX_RECV_BATCH][65535];
+    static size_t lens[MAX_RECV_BATCH];
+    static size_t segment_sizes[MAX_RECV_BATCH];
+    static struct iovec iov[MAX_RECV_BATCH];
+    static struct mmsghdr msgs[MAX_RECV_BATCH];
+    static char ctrl[MAX_RECV_BATCH][CMSG_SPACE(sizeof(int))];
 
     while (1) {
-        struct sockaddr_storage peer_addr;
-        socklen_t peer_addr_len = sizeof(peer_addr);
-        memset(&peer_addr, 0, peer_addr_len);
+        for (int i = 0; i < MAX_RECV_BATCH; i++) {
+            iov[i].iov_base = bufs[i];
+            iov[i].iov_len = sizeof(bufs[i]);
+
+            // The connection only talks to the server, so the source address
+            // of the packets is not needed.
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_control = ctrl[i];
+            msgs[i].msg_hdr.msg_controllen = sizeof(ctrl[i]);
+        }
 
-        ssize_t read = recvfrom(conn_io->sock, buf, sizeof(buf), 0,
-                                (struct sockaddr *) &peer_addr,
-                                &peer_addr_len);
+        int n = recvmmsg(conn_io->sock, msgs, MAX_RECV_BATCH, 0, NULL);
 
-        if (read < 0) {
+        if (n < 0) {
             if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) {
                 fprintf(stderr, "recv would block\n");
                 break;
@@ -123,18 +165,30 @@ static void recv_cb(EV_P_ ev_io *w, int revents) {
             return;
         }
 
-        quiche_recv_info recv_info = {
-            (struct sockaddr *) &peer_addr,
-            peer_addr_len,
+        for (int i = 0; i < n; i++) {
+            lens[i] = msgs[i].msg_len;
 
-            (struct sockaddr *) &conn_io->local_addr,
-            conn_io->local_addr_len,
-        };
+            // Without a UDP_GRO control message the buffer holds a single
+            // packet.
+            segment_sizes[i] = 0;
+
+            struct cmsghdr *cm;
+            for (cm = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cm != NULL;
+                 cm = CMSG_NXTHDR(&msgs[i].msg_hdr, cm)) {
+                if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+                    int gso_size;
+                    memcpy(&gso_size, CMSG_DATA(cm), sizeof(gso_size));
+                    segment_sizes[i] = gso_size;
+                }
+            }
+        }
 
-        ssize_t done = quiche_conn_recv(conn_io->conn, buf, read, &recv_info);
+        ssize_t done = quiche_conn_recv_batch(conn_io->conn, &bufs[0][0],
+                                              sizeof(bufs[0]), lens,
+                                              segment_sizes, n);
 
         if (done < 0) {
-            fprintf(stderr, "failed to process packet\n");
+            fprintf(stderr, "failed to process packets\n");
             continue;
         }
 
@@ -178,15 +232,17 @@ static void recv_cb(EV_P_ ev_io *w, int revents) {
         while (quiche_stream_iter_next(readable, &s)) {
             fprintf(stderr, "stream %" PRIu64 " is readable\n", s);
 
+            // The packets have been processed, so the receive buffers are
+            // free to reuse.
             bool fin = false;
             ssize_t recv_len = quiche_conn_stream_recv(conn_io->conn, s,
-                                                       buf, sizeof(buf),
+                                                       bufs[0], sizeof(bufs[0]),
                                                        &fin);
             if (recv_len < 0) {
                 break;
             }
 
-            printf("%.*s", (int) recv_len, buf);
+            printf("%.*s", (int) recv_len, bufs[0]);
 
             if (fin) {
                 if (quiche_conn_close(conn_io->conn, true, 0, NULL, 0) < 0) {
@@ -261,6 +317,13 @@ int main(int argc, char *argv[]) {
         return -1;
     }
 
+    // Let the kernel coalesce incoming packets, quiche_conn_recv_batch()
+    // splits them again.
+    int gro = 1;
+    if (setsockopt(sock, SOL_UDP, UDP_GRO, &gro, sizeof(gro)) != 0) {
+        perror("failed to enable UDP GRO");
+    }
+
     quiche_config *config = quiche_config_new(0xbabababa);
     if (config == NULL) {
         fprintf(stderr, "failed to create config\n");
@@ -106,15 +106,17 @@ quiche_config *quiche_config_new();
 
 
 
-// Sets the `max_idle_timeout` transport parameter, in milliseconds, default is
-// no timeout.
-// void quiche_config_set_max_idle_timeout(quiche_config *config, uint64_t v);
+// Sets the idle timeout, in milliseconds, default is 5000. Zero means no
+// timeout.
+void quiche_config_set_max_idle_timeout(quiche_config *config, uint64_t v);
 
-// // Sets the `max_udp_payload_size transport` parameter.
-// void quiche_config_set_max_recv_udp_payload_size(quiche_config *config, size_t v);
+// Sets the maximum incoming UDP payload size the client advertises, default
+// and minimum is 1350.
+void quiche_config_set_max_recv_udp_payload_size(quiche_config *config, size_t v);
 
-// // Sets the maximum outgoing UDP payload size.
-// void quiche_config_set_max_send_udp_payload_size(quiche_config *config, size_t v);
+// Sets the maximum outgoing UDP payload size the server probes the path for,
+// default and minimum is 1350.
+void quiche_config_set_max_send_udp_payload_size(quiche_config *config, size_t v);
 
 // // Sets the `initial_max_data` transport parameter.
 // void quiche_config_set_initial_max_data(quiche_config *config, uint64_t v);
@@ -131,6 +133,7 @@ quiche_config *quiche_config_new();
 
 enum quiche_cc_algorithm {
     QUICHE_CC_NEWCUBIC = 1,
+    QUICHE_CC_BBR = 2,
 };
 
 
@@ -138,13 +141,45 @@ enum quiche_cc_algorithm {
 // Sets the congestion control algorithm used.
 void quiche_config_set_cc_algorithm(quiche_config *config, enum quiche_cc_algorithm algo);
 
-// Writes data to a stream.
-ssize_t quiche_conn_write(quiche_conn *conn, 
-                                const uint8_t *buf, size_t buf_len, ssize_t sent);
+enum quiche_quantile_algorithm {
+    QUICHE_QUANTILE_SELECT = 0,
+    QUICHE_QUANTILE_SKETCH = 1,
+};
+
+// Sets the algorithm used to compute the priority split points by name.
+int quiche_config_set_quantile_algorithm_name(quiche_config *config, const char *algo);
+
+// Sets the algorithm used to compute the priority split points.
+void quiche_config_set_quantile_algorithm(quiche_config *config, enum quiche_quantile_algorithm algo);
+
+enum quiche_scheduling_policy {
+    QUICHE_SCHEDULING_OFFSET = 0,
+    QUICHE_SCHEDULING_PRIORITY = 1,
+    QUICHE_SCHEDULING_RETRANSMIT = 2,
+};
+
+// Sets the order the blocks of a congestion window are sent in by name.
+int quiche_config_set_scheduling_policy_name(quiche_config *config, const char *policy);
+
+// Sets the order the blocks of a congestion window are sent in.
+void quiche_config_set_scheduling_policy(quiche_config *config, enum quiche_scheduling_policy policy);
 
 // Sets the maximum connection window.
 void quiche_config_set_max_connection_window(quiche_config *config, uint64_t v);
 
+// Configures whether to pace data packets over the round-trip time.
+void quiche_config_enable_pacing(quiche_config *config, bool v);
+
+// Configures whether to offer compact ACK and ElictAck payloads.
+void quiche_config_enable_compact_ack(quiche_config *config, bool v);
+
+// Configures whether to offer compact packet headers.
+void quiche_config_enable_compact_header(quiche_config *config, bool v);
+
+// Configures whether to offer forward error correction of priority 2 and 3
+// blocks.
+void quiche_config_enable_fec(quiche_config *config, bool v);
+
 
 // Frees the config object.
 void quiche_config_free(quiche_config *config);
@@ -169,6 +204,36 @@ quiche_conn *quiche_connect(const struct sockaddr *local, size_t local_len,
 
 void quiche_dada_send(quiche_conn *conn,const char * data);
 
+// Hands one iteration of binary data (native-endian floats) to the
+// connection, which keeps a copy. |sent| is ignored, it is kept for
+// compatibility with earlier callers.
+ssize_t quiche_conn_write(quiche_conn *conn, const uint8_t *buf, size_t buf_len,
+                          ssize_t sent);
+
+// Same as quiche_conn_write(), but the buffer is not copied: it must stay
+// valid and unmodified until the connection is reset or new data is
+// written.
+ssize_t quiche_conn_write_borrowed(quiche_conn *conn, const uint8_t *buf,
+                                   size_t buf_len);
+
+// Same as quiche_conn_write_borrowed(), with the length given in floats.
+ssize_t quiche_conn_write_f32(quiche_conn *conn, const float *buf, size_t len);
+
+// Starts an iteration whose data is handed to the connection in pieces, so
+// that complete blocks can be sent while later data is still produced.
+void quiche_conn_data_begin(quiche_conn *conn);
+
+// Appends binary data (native-endian floats) to the current iteration. The
+// data is copied.
+ssize_t quiche_conn_data_append(quiche_conn *conn, const uint8_t *buf, size_t buf_len);
+
+// Same as quiche_conn_data_append(), with the length given in floats.
+ssize_t quiche_conn_data_append_f32(quiche_conn *conn, const float *buf, size_t len);
+
+// Marks the current iteration as complete and computes the final priority
+// split points.
+int quiche_conn_data_finish(quiche_conn *conn);
+
 ssize_t quiche_conn_send_all(quiche_conn *conn);
 
 typedef struct {
@@ -185,6 +250,76 @@ typedef struct {
 ssize_t quiche_conn_recv(quiche_conn *conn, uint8_t *buf, size_t buf_len,
                          const quiche_recv_info *info);
 
+// Processes a buffer of back to back packets of |segment_size| bytes, as
+// returned by a socket with UDP_GRO enabled. A |segment_size| of 0 means
+// |buf| holds a single packet. A connection has a single peer, so the
+// packets are not matched against their source address.
+ssize_t quiche_conn_recv_segments(quiche_conn *conn, uint8_t *buf, size_t buf_len,
+                                  size_t segment_size);
+
+// Processes |n| buffers in one call, e.g. as filled by recvmmsg(). Buffer i
+// starts at |buf| + i * |buf_len| and holds |lens|[i] bytes of packets of
+// |segment_sizes|[i] bytes each.
+ssize_t quiche_conn_recv_batch(quiche_conn *conn, uint8_t *buf, size_t buf_len,
+                               const size_t *lens, const size_t *segment_sizes,
+                               size_t n);
+
+// Registers |buf| as the destination of received data: the payload of each
+// data packet is copied once, straight to |buf| + offset, instead of being
+// buffered by the connection. Blocks that never arrive are left untouched.
+// |buf| must stay valid, and must not be accessed while packets are
+// received, until quiche_conn_recv_release() is called.
+void quiche_conn_recv_into(quiche_conn *conn, uint8_t *buf, size_t buf_len);
+
+// Same as quiche_conn_recv_into() for |len| float values.
+void quiche_conn_recv_into_f32(quiche_conn *conn, float *buf, size_t len);
+
+// Unregisters the buffer set by quiche_conn_recv_into().
+void quiche_conn_recv_release(quiche_conn *conn);
+
+// Copies up to |out_len| words of the received-block bitmap to |out|: bit
+// i % 64 of word i / 64 is set once block i has arrived. The bitmap is reset
+// by quiche_conn_recv_into() and quiche_conn_reset_received_blocks().
+// Returns the number of words in the bitmap.
+size_t quiche_conn_received_blocks(const quiche_conn *conn, uint64_t *out,
+                                   size_t out_len);
+
+// Forgets the blocks received so far, for a new iteration whose data is
+// read from the connection rather than placed with quiche_conn_recv_into().
+void quiche_conn_reset_received_blocks(quiche_conn *conn);
+
+// Returns the priority of block |idx|, or 0 if it has not been received.
+int quiche_conn_block_priority(const quiche_conn *conn, size_t idx);
+
+// Declares the current iteration complete |deadline_nanos| from now
+// (UINT64_MAX for no deadline), or once |high_priority_fraction| of the high
+// priority blocks of the buffer registered with quiche_conn_recv_into() have
+// arrived (0 to disable).
+void quiche_conn_set_iteration_policy(quiche_conn *conn, uint64_t deadline_nanos,
+                                      double high_priority_fraction);
+
+// Returns true once every block has arrived or the iteration policy is met.
+bool quiche_conn_is_iteration_complete(const quiche_conn *conn);
+
+// Returns the amount of time until the iteration deadline in nanoseconds,
+// or UINT64_MAX if there is none.
+uint64_t quiche_conn_iteration_timeout_as_nanos(const quiche_conn *conn);
+
+// Retransmit budget of blocks that are never given up on.
+#define QUICHE_RETRANSMIT_UNLIMITED 255
+
+// Sets, per priority level (low to high), how many times the sender
+// retransmits a block before giving up on it, and the fraction (0 to 1) of
+// the bytes of the iteration that can be lost. Both arrays hold
+// QUICHE_PRIORITY_LEVELS values.
+void quiche_conn_set_reliability_policy(quiche_conn *conn,
+                                        const uint8_t *retransmit_budget,
+                                        const double *acceptable_loss);
+
+// Returns true once every priority level of the current iteration was
+// delivered but for its acceptable loss.
+bool quiche_conn_is_send_complete(const quiche_conn *conn);
+
 typedef struct {
     // The local address the packet should be sent from.
     struct sockaddr_storage from;
@@ -194,12 +329,38 @@ typedef struct {
     struct sockaddr_storage to;
     socklen_t to_len;
 
+    // The time to send the packet out, on the CLOCK_MONOTONIC clock.
+    struct timespec at;
 } quiche_send_info;
 
 // Writes a single QUIC packet to be sent to the peer.
 ssize_t quiche_conn_send(quiche_conn *conn, uint8_t *out, size_t out_len,
                          quiche_send_info *out_info);
 
+// Writes up to |max_pkts| packets, and at most 64, in one call. Packet i is
+// written at |out| + i * |out_len|, its length is stored in |out_lens|[i]
+// and its addresses and pacing time in |out_info|[i], ready to be passed to
+// sendmmsg(). Returns the number of packets written.
+ssize_t quiche_conn_send_batch(quiche_conn *conn, uint8_t *out, size_t out_len,
+                               size_t *out_lens, quiche_send_info *out_info,
+                               size_t max_pkts);
+
+// The maximum number of segments in one UDP GSO send.
+#define QUICHE_MAX_GSO_SEGMENTS 64
+
+// Returns the segment size to use with quiche_conn_send_segments().
+size_t quiche_conn_segment_size(const quiche_conn *conn);
+
+// Writes consecutive packets back to back into |out| for a single sendmsg()
+// with UDP_SEGMENT set to |segment_size|. All packets but the last one are
+// exactly |segment_size| bytes long. Returns the total number of bytes
+// written, and in |out_segment_size| the segment size to send them with,
+// which is the length of the first packet: it differs from |segment_size|
+// for a buffer of a single short packet or of a single Fec packet.
+ssize_t quiche_conn_send_segments(quiche_conn *conn, uint8_t *out, size_t out_len,
+                                  size_t segment_size, size_t *out_segment_size,
+                                  quiche_send_info *out_info);
+
 // Returns the size of the send quantum, in bytes.
 // size_t quiche_conn_send_quantum(const quiche_conn *conn);
 
@@ -228,10 +389,17 @@ uint64_t quiche_conn_timeout_as_millis(const quiche_conn *conn);
 // Processes a timeout event.
 void quiche_conn_on_timeout(quiche_conn *conn);
 
-// Closes the connection with the given error and reason.
+// Closes the connection with the given error and reason. The next call to
+// quiche_conn_send() returns the packet carrying them to the peer.
 int quiche_conn_close(quiche_conn *conn, bool app, uint64_t err,
                       const uint8_t *reason, size_t reason_len);
 
+// Retrieves the error the peer closed the connection with. Returns false if
+// it did not.
+bool quiche_conn_peer_error(const quiche_conn *conn, bool *is_app,
+                            uint64_t *error_code, const uint8_t **reason,
+                            size_t *reason_len);
+
 
 
 // Returns true if the connection handshake is complete.
@@ -245,19 +413,28 @@ bool quiche_conn_is_closed(const quiche_conn *conn);
 // Returns true if the connection was closed due to the idle timeout.
 bool quiche_conn_is_timed_out(const quiche_conn *conn);
 
+// Writes the events traced on the connection as qlog JSON-SEQ to a new file
+// at |path|, or to the file descriptor |fd|. Only available when the library
+// is built with the "qlog" feature.
+bool quiche_conn_write_qlog_path(const quiche_conn *conn, const char *path);
+bool quiche_conn_write_qlog_fd(const quiche_conn *conn, int fd);
+
+
 
+// The number of priority levels data blocks are classified into.
+#define QUICHE_PRIORITY_LEVELS 3
 
 typedef struct {
-    // The number of QUIC packets received on this connection.
+    // The number of packets received on this connection.
     size_t recv;
 
-    // The number of QUIC packets sent on this connection.
+    // The number of packets sent on this connection.
     size_t sent;
 
-    // The number of QUIC packets that were lost.
+    // The number of data packets reported lost by the peer.
     size_t lost;
 
-    // The number of sent QUIC packets with retransmitted data.
+    // The number of data packets sent with retransmitted data.
     size_t retrans;
 
     // The number of sent bytes.
@@ -266,53 +443,33 @@ typedef struct {
     // The number of received bytes.
     uint64_t recv_bytes;
 
-    // The number of bytes lost.
+    // The number of data bytes reported lost by the peer.
     uint64_t lost_bytes;
 
-    // The number of stream bytes retransmitted.
-    uint64_t stream_retrans_bytes;
-
-    // The number of known paths for the connection.
-    size_t paths_count;
-
-    // The maximum idle timeout.
-    uint64_t peer_max_idle_timeout;
+    // The number of data bytes retransmitted.
+    uint64_t retrans_bytes;
 
-    // The maximum UDP payload size.
-    uint64_t peer_max_udp_payload_size;
+    // The number of times the congestion window was rolled back.
+    size_t rollbacks;
 
-    // The initial flow control maximum data for the connection.
-    uint64_t peer_initial_max_data;
+    // The number of data bytes acknowledged, per priority level (low to high).
+    uint64_t delivered_bytes[QUICHE_PRIORITY_LEVELS];
 
-    // The initial flow control maximum data for local bidirectional streams.
-    uint64_t peer_initial_max_stream_data_bidi_local;
+    // The number of data bytes reported lost, per priority level (low to high).
+    uint64_t lost_bytes_by_priority[QUICHE_PRIORITY_LEVELS];
 
-    // The initial flow control maximum data for remote bidirectional streams.
-    uint64_t peer_initial_max_stream_data_bidi_remote;
+    // The number of data bytes the sender gave up on, per priority level (low
+    // to high).
+    uint64_t given_up_bytes[QUICHE_PRIORITY_LEVELS];
 
-    // The initial flow control maximum data for unidirectional streams.
-    uint64_t peer_initial_max_stream_data_uni;
+    // The number of Fec packets sent.
+    size_t fec_sent;
 
-    // The initial maximum bidirectional streams.
-    uint64_t peer_initial_max_streams_bidi;
+    // The number of lost blocks rebuilt from Fec packets.
+    size_t fec_recovered;
 
-    // The initial maximum unidirectional streams.
-    uint64_t peer_initial_max_streams_uni;
-
-    // The ACK delay exponent.
-    uint64_t peer_ack_delay_exponent;
-
-    // The max ACK delay.
-    uint64_t peer_max_ack_delay;
-
-    // Whether active migration is disabled.
-    bool peer_disable_active_migration;
-
-    // The active connection ID limit.
-    uint64_t peer_active_conn_id_limit;
-
-    // DATAGRAM frame extension parameter, if any.
-    ssize_t peer_max_datagram_frame_size;
+    // The number of known paths for the connection.
+    size_t paths_count;
 } quiche_stats;
 
 // Collects and returns statistics about the connection.
@@ -327,27 +484,28 @@ typedef struct {
     struct sockaddr_storage peer_addr;
     socklen_t peer_addr_len;
 
-    // The validation state of the path.
-    ssize_t validation_state;
-
     // Whether this path is active.
     bool active;
 
-    // The number of QUIC packets received on this path.
+    // The number of packets received on this path.
     size_t recv;
 
-    // The number of QUIC packets sent on this path.
+    // The number of packets sent on this path.
     size_t sent;
 
-    // The number of QUIC packets that were lost on this path.
+    // The number of data packets reported lost on this path.
     size_t lost;
 
-    // The number of sent QUIC packets with retransmitted data on this path.
+    // The number of data packets sent with retransmitted data on this path.
     size_t retrans;
 
-    // The estimated round-trip time of the path (in nanoseconds).
+    // The smoothed round-trip time of the path (in nanoseconds).
     uint64_t rtt;
 
+    // The minimum round-trip time of the path over the last 5 minutes (in
+    // nanoseconds).
+    uint64_t min_rtt;
+
     // The size of the path's congestion window in bytes.
     size_t cwnd;
 
@@ -357,16 +515,16 @@ typedef struct {
     // The number of received bytes on this path.
     uint64_t recv_bytes;
 
-    // The number of bytes lost on this path.
+    // The number of data bytes lost on this path.
     uint64_t lost_bytes;
 
-    // The number of stream bytes retransmitted on this path.
-    uint64_t stream_retrans_bytes;
+    // The number of data bytes retransmitted on this path.
+    uint64_t retrans_bytes;
 
-    // The current PMTU for the path.
+    // The maximum UDP payload size of the path.
     size_t pmtu;
 
-    // The most recent data delivery rate estimate in bytes/s.
+    // The data delivery rate over the last window in bytes/s.
     uint64_t delivery_rate;
 } quiche_path_stats;
 
@@ -0,0 +1,513 @@
+// Forward error correction of data blocks.
+//
+// The sender XORs the blocks it sends into stripes, one open stripe per
+// priority, and sends the parity of every stripe in a Fec packet once the
+// stripe is full or the group of packets ends with an ElictAck. High
+// priority blocks get narrower stripes, i.e. more parity, and low priority
+// blocks none. A receiver missing a single block of a stripe rebuilds it
+// from the parity and the other blocks, before the ElictAck makes it report
+// the block lost.
+//
+// A Fec payload lists the blocks of the stripe as a varint count followed by
+// a `(block index, length)` varint pair per block, then holds the parity,
+// as long as the longest block. Shorter blocks are XORed as if padded with
+// zeros.
+
+use std::collections::VecDeque;
+
+use crate::Error;
+use crate::Result;
+
+/// The maximum number of blocks covered by a parity.
+pub const MAX_STRIPE: usize = 4;
+
+/// The largest Fec payload on top of the parity: the block count and a
+/// pair of 4 byte varints per block.
+pub const MAX_OVERHEAD: usize = 1 + MAX_STRIPE * 8;
+
+/// The maximum number of stripes a receiver keeps while their blocks are
+/// missing.
+const MAX_PENDING: usize = 64;
+
+/// Returns the number of blocks of `priority` covered by one parity, or 0
+/// if blocks of `priority` aren't protected.
+#[inline]
+pub fn stripe_width(priority: u8) -> usize {
+    match priority {
+        3 => 2,
+        2 => MAX_STRIPE,
+        _ => 0,
+    }
+}
+
+/// A parity and the blocks it covers.
+#[derive(Default)]
+struct Stripe {
+    priority: u8,
+
+    /// The index and length of each block.
+    blocks: Vec<(u64, usize)>,
+
+    /// The XOR of the blocks.
+    parity: Vec<u8>,
+}
+
+impl Stripe {
+    /// XORs `data` into the parity.
+    fn add(&mut self, idx: u64, data: &[u8]) {
+        if self.parity.len() < data.len() {
+            self.parity.resize(data.len(), 0);
+        }
+
+        xor_into(&mut self.parity, data);
+        self.blocks.push((idx, data.len()));
+    }
+
+    fn clear(&mut self) {
+        self.blocks.clear();
+        self.parity.clear();
+    }
+}
+
+/// Sender side: builds the stripes of the blocks sent.
+#[derive(Default)]
+pub struct FecEncoder {
+    /// The stripe being filled, per protected priority (2 and 3).
+    open: [Stripe; 2],
+
+    /// Stripes whose parity is waiting to be sent.
+    ready: VecDeque<Stripe>,
+
+    /// Stripes already sent, kept for their buffers.
+    free: Vec<Stripe>,
+}
+
+impl FecEncoder {
+    /// Adds block `idx`, just sent with `priority`, to its stripe.
+    pub fn on_sent(&mut self, idx: u64, priority: u8, data: &[u8]) {
+        let width = stripe_width(priority);
+        if width == 0 {
+            return;
+        }
+
+        let stripe = &mut self.open[(priority - 2) as usize];
+        stripe.priority = priority;
+        stripe.add(idx, data);
+
+        if stripe.blocks.len() >= width {
+            let next = self.free.pop().unwrap_or_default();
+            let full = std::mem::replace(stripe, next);
+            self.ready.push_back(full);
+        }
+    }
+
+    /// Closes the stripes being filled, at the end of a group of packets.
+    pub fn flush(&mut self) {
+        // Highest priority first, so its parity goes out first.
+        for i in (0..self.open.len()).rev() {
+            if !self.open[i].blocks.is_empty() {
+                let next = self.free.pop().unwrap_or_default();
+                let stripe = std::mem::replace(&mut self.open[i], next);
+                self.ready.push_back(stripe);
+            }
+        }
+    }
+
+    /// Returns true if a parity is waiting to be sent.
+    #[inline]
+    pub fn has_ready(&self) -> bool {
+        !self.ready.is_empty()
+    }
+
+    /// Returns true if blocks are waiting for their parity, whether their
+    /// stripe is full or not.
+    pub fn has_pending(&self) -> bool {
+        self.has_ready() || self.open.iter().any(|s| !s.blocks.is_empty())
+    }
+
+    /// Writes the next parity payload into `out`, and returns the priority
+    /// of its blocks and its length.
+    ///
+    /// A stripe that doesn't fit is dropped, its blocks are left to be
+    /// retransmitted.
+    pub fn emit(&mut self, out: &mut [u8]) -> Result<(u8, usize)> {
+        let mut stripe = self.ready.pop_front().ok_or(Error::Done)?;
+
+        let res = encode(&stripe, out).map(|len| (stripe.priority, len));
+
+        stripe.clear();
+        self.free.push(stripe);
+
+        res
+    }
+
+    /// Drops all stripes, for a new iteration.
+    pub fn reset(&mut self) {
+        for s in self.open.iter_mut() {
+            s.clear();
+        }
+
+        while let Some(mut s) = self.ready.pop_front() {
+            s.clear();
+            self.free.push(s);
+        }
+    }
+}
+
+/// Receiver side: keeps the parities received until their blocks are.
+#[derive(Default)]
+pub struct FecDecoder {
+    /// Stripes with blocks still missing, oldest first.
+    pending: VecDeque<Stripe>,
+
+    /// Stripes already used, kept for their buffers.
+    free: Vec<Stripe>,
+
+    /// The last block rebuilt.
+    out: Vec<u8>,
+}
+
+impl FecDecoder {
+    /// Parses a Fec payload sent with `priority`, and keeps it until
+    /// `recover()` is called. Blocks longer than `block_size` are rejected.
+    pub fn on_parity(
+        &mut self, priority: u8, payload: &mut [u8], block_size: usize,
+    ) -> Result<()> {
+        let mut stripe = self.free.pop().unwrap_or_default();
+        stripe.clear();
+        stripe.priority = priority;
+
+        let mut b = octets::OctetsMut::with_slice(payload);
+        let count = b.get_varint()? as usize;
+
+        if count == 0 || count > MAX_STRIPE {
+            self.free.push(stripe);
+            return Err(Error::InvalidPacket);
+        }
+
+        let mut max_len = 0;
+        for _ in 0..count {
+            let idx = b.get_varint()?;
+            let len = b.get_varint()? as usize;
+
+            if len > block_size {
+                self.free.push(stripe);
+                return Err(Error::InvalidPacket);
+            }
+
+            max_len = max_len.max(len);
+            stripe.blocks.push((idx, len));
+        }
+
+        let parity = b.get_bytes(max_len)?;
+        stripe.parity.extend_from_slice(parity.buf());
+
+        if self.pending.len() >= MAX_PENDING {
+            if let Some(old) = self.pending.pop_front() {
+                self.free.push(old);
+            }
+        }
+
+        self.pending.push_back(stripe);
+        Ok(())
+    }
+
+    /// Rebuilds a missing block, if a stripe misses only one.
+    ///
+    /// `is_received` tells whether a block was received, and `block_data`
+    /// returns the data of a received block from its index and length.
+    /// Stripes with no block missing, or whose blocks can no longer be read,
+    /// are dropped.
+    ///
+    /// Returns the priority, the index and the data of the block rebuilt.
+    /// It has to be called until it returns `None`.
+    pub fn recover<'a, R, D>(
+        &mut self, is_received: R, block_data: D,
+    ) -> Option<(u8, u64, &mut [u8])>
+    where
+        R: Fn(u64) -> bool,
+        D: Fn(u64, usize) -> Option<&'a [u8]>,
+    {
+        let mut i = 0;
+
+        while i < self.pending.len() {
+            let stripe = &self.pending[i];
+
+            let mut missing = None;
+            let mut count = 0;
+            for (idx, len) in stripe.blocks.iter() {
+                if !is_received(*idx) {
+                    missing = Some((*idx, *len));
+                    count += 1;
+                }
+            }
+
+            let (idx, len) = match missing {
+                Some(v) if count == 1 => v,
+
+                // Two blocks or more are missing, wait for retransmissions.
+                Some(_) => {
+                    i += 1;
+                    continue;
+                },
+
+                None => {
+                    self.drop_pending(i);
+                    continue;
+                },
+            };
+
+            self.out.clear();
+            self.out.extend_from_slice(&stripe.parity);
+
+            let mut complete = true;
+            for (b, l) in stripe.blocks.iter().filter(|(b, _)| *b != idx) {
+                match block_data(*b, *l) {
+                    Some(data) => xor_into(&mut self.out, data),
+
+                    None => {
+                        complete = false;
+                        break;
+                    },
+                }
+            }
+
+            let priority = stripe.priority;
+            self.drop_pending(i);
+
+            if complete {
+                self.out.truncate(len);
+                return Some((priority, idx, &mut self.out));
+            }
+        }
+
+        None
+    }
+
+    /// Drops all stripes, for a new iteration.
+    pub fn reset(&mut self) {
+        while let Some(s) = self.pending.pop_front() {
+            self.free.push(s);
+        }
+    }
+
+    fn drop_pending(&mut self, i: usize) {
+        if let Some(s) = self.pending.remove(i) {
+            self.free.push(s);
+        }
+    }
+}
+
+/// Writes the payload of `stripe` into `out`, and returns its length.
+fn encode(stripe: &Stripe, out: &mut [u8]) -> Result<usize> {
+    let mut b = octets::OctetsMut::with_slice(out);
+
+    b.put_varint(stripe.blocks.len() as u64)?;
+
+    for (idx, len) in stripe.blocks.iter() {
+        b.put_varint(*idx)?;
+        b.put_varint(*len as u64)?;
+    }
+
+    b.put_bytes(&stripe.parity)?;
+
+    Ok(b.off())
+}
+
+/// XORs `src` into the start of `dst`, a word at a time. The compiler turns
+/// the word loop into vector instructions.
+#[inline]
+fn xor_into(dst: &mut [u8], src: &[u8]) {
+    let dst = &mut dst[..src.len()];
+    let words = src.len() / 8 * 8;
+
+    let (dst_words, dst_tail) = dst.split_at_mut(words);
+    let (src_words, src_tail) = src.split_at(words);
+
+    for (d, s) in dst_words.chunks_exact_mut(8).zip(src_words.chunks_exact(8)) {
+        let v = u64::from_ne_bytes(d.try_into().unwrap()) ^
+            u64::from_ne_bytes(s.try_into().unwrap());
+        d.copy_from_slice(&v.to_ne_bytes());
+    }
+
+    for (d, s) in dst_tail.iter_mut().zip(src_tail) {
+        *d ^= s;
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Returns `n` blocks of `len` bytes, the last one `last` bytes long.
+    fn blocks(n: usize, len: usize, last: usize) -> Vec<Vec<u8>> {
+        (0..n)
+            .map(|i| {
+                let len = if i == n - 1 { last } else { len };
+                (0..len).map(|j| (i * 31 + j * 7) as u8).collect()
+            })
+            .collect()
+    }
+
+    /// Sends `data` as blocks of `priority` from index 10, and returns the
+    /// parities emitted.
+    fn encode_all(priority: u8, data: &[Vec<u8>]) -> Vec<(u8, Vec<u8>)> {
+        let mut enc = FecEncoder::default();
+
+        for (i, d) in data.iter().enumerate() {
+            enc.on_sent(10 + i as u64, priority, d);
+        }
+
+        enc.flush();
+
+        let mut out = Vec::new();
+        let mut buf = [0; 2048];
+        while enc.has_ready() {
+            let (p, len) = enc.emit(&mut buf).unwrap();
+            out.push((p, buf[..len].to_vec()));
+        }
+
+        assert_eq!(enc.emit(&mut buf), Err(Error::Done));
+        assert!(!enc.has_pending());
+        out
+    }
+
+    #[test]
+    fn stripe_widths() {
+        assert_eq!(stripe_width(3), 2);
+        assert_eq!(stripe_width(2), MAX_STRIPE);
+        assert_eq!(stripe_width(1), 0);
+        assert_eq!(stripe_width(0), 0);
+    }
+
+    #[test]
+    fn recover_single_missing_block() {
+        for (priority, width) in [(3, 2), (2, 4)] {
+            let data = blocks(width, 100, 37);
+
+            let parities = encode_all(priority, &data);
+            assert_eq!(parities.len(), 1);
+
+            for missing in 0..width {
+                let mut dec = FecDecoder::default();
+                let (p, mut payload) = parities[0].clone();
+                dec.on_parity(p, &mut payload, 100).unwrap();
+
+                let idx = 10 + missing as u64;
+                let (p, got, out) = dec
+                    .recover(
+                        |b| b != idx,
+                        |b, l| Some(&data[(b - 10) as usize][..l]),
+                    )
+                    .unwrap();
+
+                assert_eq!(p, priority);
+                assert_eq!(got, idx);
+                assert_eq!(out, &data[missing][..]);
+
+                assert!(dec.recover(|_| true, |_, _| None).is_none());
+            }
+        }
+    }
+
+    #[test]
+    fn two_missing_blocks_wait() {
+        let data = blocks(4, 64, 64);
+
+        let (p, mut payload) = encode_all(2, &data).remove(0);
+
+        let mut dec = FecDecoder::default();
+        dec.on_parity(p, &mut payload, 64).unwrap();
+
+        let received = |b: u64| b != 10 && b != 11;
+        let block = |b: u64, l: usize| Some(&data[(b - 10) as usize][..l]);
+        assert!(dec.recover(received, block).is_none());
+
+        // Once block 10 is retransmitted, block 11 can be rebuilt.
+        let (_, idx, out) = dec.recover(|b| b != 11, block).unwrap();
+        assert_eq!(idx, 11);
+        assert_eq!(out, &data[1][..]);
+    }
+
+    #[test]
+    fn low_priority_not_protected() {
+        assert!(encode_all(1, &blocks(8, 64, 64)).is_empty());
+    }
+
+    #[test]
+    fn flush_closes_partial_stripes() {
+        let data = blocks(3, 64, 64);
+
+        let mut enc = FecEncoder::default();
+        enc.on_sent(0, 2, &data[0]);
+        enc.on_sent(1, 3, &data[1]);
+
+        assert!(enc.has_pending());
+        assert!(!enc.has_ready());
+
+        // Completes the stripe of priority 3.
+        enc.on_sent(2, 3, &data[2]);
+        assert!(enc.has_ready());
+
+        enc.flush();
+
+        let mut buf = [0; 256];
+        assert_eq!(enc.emit(&mut buf).unwrap().0, 3);
+        assert_eq!(enc.emit(&mut buf).unwrap().0, 2);
+        assert!(!enc.has_pending());
+    }
+
+    #[test]
+    fn emit_too_small() {
+        let mut enc = FecEncoder::default();
+        enc.on_sent(0, 3, &[1; 64]);
+        enc.flush();
+
+        let mut buf = [0; 32];
+        assert_eq!(enc.emit(&mut buf), Err(Error::BufferTooShort));
+
+        // The stripe is dropped.
+        assert!(!enc.has_pending());
+    }
+
+    #[test]
+    fn invalid_parity() {
+        let mut dec = FecDecoder::default();
+
+        // No block.
+        assert_eq!(dec.on_parity(3, &mut [0], 64), Err(Error::InvalidPacket));
+
+        // Too many blocks.
+        let mut payload = [MAX_STRIPE as u8 + 1, 0, 0];
+        assert_eq!(
+            dec.on_parity(3, &mut payload, 64),
+            Err(Error::InvalidPacket)
+        );
+
+        // Block longer than the block size.
+        let mut payload = [1, 0, 65, 0];
+        assert_eq!(
+            dec.on_parity(3, &mut payload, 64),
+            Err(Error::InvalidPacket)
+        );
+
+        // Truncated parity.
+        let mut payload = [1, 0, 4, 1, 2];
+        assert_eq!(
+            dec.on_parity(3, &mut payload, 64),
+            Err(Error::BufferTooShort)
+        );
+    }
+
+    #[test]
+    fn xor_tail() {
+        let mut dst = [0xffu8; 13];
+        let src: Vec<u8> = (0..11).collect();
+        xor_into(&mut dst, &src);
+
+        for (i, d) in dst.iter().enumerate() {
+            let expected = if i < 11 { 0xff ^ i as u8 } else { 0xff };
+            assert_eq!(*d, expected);
+        }
+    }
+}
@@ -143,6 +143,83 @@ pub extern fn quiche_config_set_cc_algorithm(
 
 
 
+#[no_mangle]
+pub extern fn quiche_config_set_quantile_algorithm_name(
+    config: &mut Config, name: *const c_char,
+) -> c_int {
+    let name = unsafe { ffi::CStr::from_ptr(name).to_str().unwrap() };
+    match config.set_quantile_algorithm_name(name) {
+        Ok(_) => 0,
+
+        Err(e) => e.to_c() as c_int,
+    }
+}
+
+#[no_mangle]
+pub extern fn quiche_config_set_quantile_algorithm(
+    config: &mut Config, algo: QuantileAlgorithm,
+) {
+    config.set_quantile_algorithm(algo);
+}
+
+#[no_mangle]
+pub extern fn quiche_config_set_scheduling_policy_name(
+    config: &mut Config, name: *const c_char,
+) -> c_int {
+    let name = unsafe { ffi::CStr::from_ptr(name).to_str().unwrap() };
+    match config.set_scheduling_policy_name(name) {
+        Ok(_) => 0,
+
+        Err(e) => e.to_c() as c_int,
+    }
+}
+
+#[no_mangle]
+pub extern fn quiche_config_set_scheduling_policy(
+    config: &mut Config, policy: SchedulingPolicy,
+) {
+    config.set_scheduling_policy(policy);
+}
+
+#[no_mangle]
+pub extern fn quiche_config_enable_pacing(config: &mut Config, v: bool) {
+    config.enable_pacing(v);
+}
+
+#[no_mangle]
+pub extern fn quiche_config_enable_compact_ack(config: &mut Config, v: bool) {
+    config.enable_compact_ack(v);
+}
+
+#[no_mangle]
+pub extern fn quiche_config_enable_compact_header(config: &mut Config, v: bool) {
+    config.enable_compact_header(v);
+}
+
+#[no_mangle]
+pub extern fn quiche_config_enable_fec(config: &mut Config, v: bool) {
+    config.enable_fec(v);
+}
+
+#[no_mangle]
+pub extern fn quiche_config_set_max_send_udp_payload_size(
+    config: &mut Config, v: size_t,
+) {
+    config.set_max_send_udp_payload_size(v);
+}
+
+#[no_mangle]
+pub extern fn quiche_config_set_max_recv_udp_payload_size(
+    config: &mut Config, v: size_t,
+) {
+    config.set_max_recv_udp_payload_size(v);
+}
+
+#[no_mangle]
+pub extern fn quiche_config_set_max_idle_timeout(config: &mut Config, v: u64) {
+    config.set_max_idle_timeout(v);
+}
+
 #[no_mangle]
 pub extern fn quiche_config_free(config: *mut Config) {
     unsafe { Box::from_raw(config) };
@@ -153,7 +230,8 @@ pub extern fn quiche_header_info(
     buf: *mut u8, buf_len: size_t, ty: *mut u8, 
 ) -> c_int {
     let buf = unsafe { slice::from_raw_parts_mut(buf, buf_len) };
-    let hdr = match Header::from_slice(buf) {
+    // Only the type is reported, which doesn't depend on the block size.
+    let hdr = match Header::from_slice(buf, crate::SEND_BUFFER_SIZE) {
         Ok(v) => v,
 
         Err(e) => return e.to_c() as c_int,
@@ -288,6 +366,43 @@ pub extern fn quiche_connect(
 //     );
 // }
 
+#[no_mangle]
+#[cfg(feature = "qlog")]
+pub extern fn quiche_conn_write_qlog_path(
+    conn: &Connection, path: *const c_char,
+) -> bool {
+    use std::io::Write;
+
+    let filename = unsafe { ffi::CStr::from_ptr(path).to_str().unwrap() };
+
+    let file = std::fs::OpenOptions::new()
+        .write(true)
+        .create_new(true)
+        .open(filename);
+
+    let mut writer = match file {
+        Ok(f) => std::io::BufWriter::new(f),
+
+        Err(_) => return false,
+    };
+
+    conn.write_qlog(&mut writer).is_ok() && writer.flush().is_ok()
+}
+
+#[no_mangle]
+#[cfg(all(unix, feature = "qlog"))]
+pub extern fn quiche_conn_write_qlog_fd(conn: &Connection, fd: c_int) -> bool {
+    use std::io::Write;
+
+    // The descriptor is owned by the application, don't close it.
+    let f = std::mem::ManuallyDrop::new(unsafe {
+        std::fs::File::from_raw_fd(fd)
+    });
+    let mut writer = std::io::BufWriter::new(&*f);
+
+    conn.write_qlog(&mut writer).is_ok() && writer.flush().is_ok()
+}
+
 #[no_mangle]
 pub extern fn quiche_dada_send(conn:&mut Connection, buf:* const c_char){
     let c_str:&CStr = unsafe{CStr::from_ptr(buf)};
@@ -296,6 +411,89 @@ pub extern fn quiche_dada_send(conn:&mut Connection, buf:* const c_char){
     conn.data_send(str_buf);
 }
 
+#[no_mangle]
+pub extern fn quiche_conn_write(
+    conn: &mut Connection, buf: *const u8, buf_len: size_t, _sent: ssize_t,
+) -> ssize_t {
+    if buf_len > <ssize_t>::max_value() as usize {
+        panic!("The provided buffer is too large");
+    }
+
+    let buf = unsafe { slice::from_raw_parts(buf, buf_len) };
+
+    match conn.data_write(buf.to_vec()) {
+        Ok(v) => v as ssize_t,
+
+        Err(e) => e.to_c(),
+    }
+}
+
+#[no_mangle]
+pub extern fn quiche_conn_write_borrowed(
+    conn: &mut Connection, buf: *const u8, buf_len: size_t,
+) -> ssize_t {
+    if buf_len > <ssize_t>::max_value() as usize {
+        panic!("The provided buffer is too large");
+    }
+
+    let buf = unsafe { slice::from_raw_parts(buf, buf_len) };
+
+    match unsafe { conn.data_write_borrowed(buf) } {
+        Ok(v) => v as ssize_t,
+
+        Err(e) => e.to_c(),
+    }
+}
+
+#[no_mangle]
+pub extern fn quiche_conn_write_f32(
+    conn: &mut Connection, buf: *const f32, len: size_t,
+) -> ssize_t {
+    quiche_conn_write_borrowed(
+        conn,
+        buf as *const u8,
+        len * std::mem::size_of::<f32>(),
+    )
+}
+
+#[no_mangle]
+pub extern fn quiche_conn_data_begin(conn: &mut Connection) {
+    conn.data_begin();
+}
+
+#[no_mangle]
+pub extern fn quiche_conn_data_append(
+    conn: &mut Connection, buf: *const u8, buf_len: size_t,
+) -> ssize_t {
+    if buf_len > <ssize_t>::max_value() as usize {
+        panic!("The provided buffer is too large");
+    }
+
+    let buf = unsafe { slice::from_raw_parts(buf, buf_len) };
+
+    match conn.data_append(buf) {
+        Ok(v) => v as ssize_t,
+
+        Err(e) => e.to_c(),
+    }
+}
+
+#[no_mangle]
+pub extern fn quiche_conn_data_append_f32(
+    conn: &mut Connection, buf: *const f32, len: size_t,
+) -> ssize_t {
+    quiche_conn_data_append(conn, buf as *const u8, len * std::mem::size_of::<f32>())
+}
+
+#[no_mangle]
+pub extern fn quiche_conn_data_finish(conn: &mut Connection) -> c_int {
+    match conn.data_finish() {
+        Ok(_) => 0,
+
+        Err(e) => e.to_c() as c_int,
+    }
+}
+
 #[no_mangle]
 pub extern fn quiche_conn_send_all(
     conn: &mut Connection,
@@ -353,12 +551,153 @@ pub extern fn quiche_conn_recv(
     }
 }
 
+#[no_mangle]
+pub extern fn quiche_conn_recv_segments(
+    conn: &mut Connection, buf: *mut u8, buf_len: size_t, segment_size: size_t,
+) -> ssize_t {
+    if buf_len > <ssize_t>::max_value() as usize {
+        panic!("The provided buffer is too large");
+    }
+
+    let buf = unsafe { slice::from_raw_parts_mut(buf, buf_len) };
+
+    match conn.recv_segments(buf, segment_size) {
+        Ok(v) => v as ssize_t,
+
+        Err(e) => e.to_c(),
+    }
+}
+
+#[no_mangle]
+pub extern fn quiche_conn_recv_batch(
+    conn: &mut Connection, buf: *mut u8, buf_len: size_t, lens: *const size_t,
+    segment_sizes: *const size_t, n: size_t,
+) -> ssize_t {
+    if buf_len.checked_mul(n).map_or(true, |v| v > <ssize_t>::max_value() as usize) {
+        panic!("The provided buffer is too large");
+    }
+
+    let buf = unsafe { slice::from_raw_parts_mut(buf, buf_len * n) };
+    let lens = unsafe { slice::from_raw_parts(lens, n) };
+    let segment_sizes = unsafe { slice::from_raw_parts(segment_sizes, n) };
+
+    match conn.recv_batch(buf, buf_len, lens, segment_sizes) {
+        Ok(v) => v as ssize_t,
+
+        Err(e) => e.to_c(),
+    }
+}
+
+#[no_mangle]
+pub extern fn quiche_conn_recv_into(
+    conn: &mut Connection, buf: *mut u8, buf_len: size_t,
+) {
+    let buf = unsafe { slice::from_raw_parts_mut(buf, buf_len) };
+
+    unsafe { conn.recv_into_borrowed(buf) };
+}
+
+#[no_mangle]
+pub extern fn quiche_conn_recv_into_f32(
+    conn: &mut Connection, buf: *mut f32, len: size_t,
+) {
+    quiche_conn_recv_into(conn, buf as *mut u8, len * std::mem::size_of::<f32>())
+}
+
+#[no_mangle]
+pub extern fn quiche_conn_recv_release(conn: &mut Connection) {
+    conn.take_recv_buffer();
+}
+
+#[no_mangle]
+pub extern fn quiche_conn_received_blocks(
+    conn: &Connection, out: *mut u64, out_len: size_t,
+) -> size_t {
+    let out = unsafe { slice::from_raw_parts_mut(out, out_len) };
+    let received = conn.received_blocks();
+
+    let len = cmp::min(out.len(), received.len());
+    out[..len].copy_from_slice(&received[..len]);
+
+    received.len()
+}
+
+#[no_mangle]
+pub extern fn quiche_conn_reset_received_blocks(conn: &mut Connection) {
+    conn.reset_received_blocks();
+}
+
+#[no_mangle]
+pub extern fn quiche_conn_block_priority(conn: &Connection, idx: size_t) -> c_int {
+    conn.block_priority(idx).map_or(0, |p| p as c_int)
+}
+
+#[no_mangle]
+pub extern fn quiche_conn_set_iteration_policy(
+    conn: &mut Connection, deadline_nanos: u64, high_priority_fraction: f64,
+) {
+    let deadline = if deadline_nanos == std::u64::MAX {
+        None
+    } else {
+        Some(std::time::Instant::now() + std::time::Duration::from_nanos(deadline_nanos))
+    };
+
+    let high_priority_fraction = if high_priority_fraction > 0.0 {
+        Some(high_priority_fraction)
+    } else {
+        None
+    };
+
+    conn.set_iteration_policy(IterationPolicy {
+        deadline,
+        high_priority_fraction,
+    });
+}
+
+#[no_mangle]
+pub extern fn quiche_conn_is_iteration_complete(conn: &Connection) -> bool {
+    conn.is_iteration_complete()
+}
+
+#[no_mangle]
+pub extern fn quiche_conn_iteration_timeout_as_nanos(conn: &Connection) -> u64 {
+    match conn.iteration_timeout() {
+        Some(timeout) => timeout.as_nanos() as u64,
+
+        None => std::u64::MAX,
+    }
+}
+
+#[no_mangle]
+pub extern fn quiche_conn_set_reliability_policy(
+    conn: &mut Connection, retransmit_budget: *const u8,
+    acceptable_loss: *const f64,
+) {
+    let retransmit_budget =
+        unsafe { slice::from_raw_parts(retransmit_budget, PRIORITY_LEVELS) };
+    let acceptable_loss =
+        unsafe { slice::from_raw_parts(acceptable_loss, PRIORITY_LEVELS) };
+
+    let mut policy = ReliabilityPolicy::default();
+    policy.retransmit_budget.copy_from_slice(retransmit_budget);
+    policy.acceptable_loss.copy_from_slice(acceptable_loss);
+
+    conn.set_reliability_policy(policy);
+}
+
+#[no_mangle]
+pub extern fn quiche_conn_is_send_complete(conn: &Connection) -> bool {
+    conn.is_send_complete()
+}
+
 #[repr(C)]
 pub struct SendInfo {
     from: sockaddr_storage,
     from_len: socklen_t,
     to: sockaddr_storage,
     to_len: socklen_t,
+
+    at: timespec,
 }
 
 ///modified later
@@ -387,6 +726,75 @@ pub extern fn quiche_conn_send(
 }
 
 
+/// The maximum number of packets written by one quiche_conn_send_batch()
+/// call.
+const MAX_SEND_BATCH: usize = 64;
+
+#[no_mangle]
+pub extern fn quiche_conn_send_batch(
+    conn: &mut Connection, out: *mut u8, out_len: size_t, out_lens: *mut size_t,
+    out_info: *mut SendInfo, max_pkts: size_t,
+) -> ssize_t {
+    if out_len.checked_mul(max_pkts).map_or(true, |v| v > <ssize_t>::max_value() as usize) {
+        panic!("The provided buffer is too large");
+    }
+
+    // Keep the send times on the stack, so sending doesn't allocate.
+    let max_pkts = cmp::min(max_pkts, MAX_SEND_BATCH);
+    let mut at = [std::time::Instant::now(); MAX_SEND_BATCH];
+
+    let out = unsafe { slice::from_raw_parts_mut(out, out_len * max_pkts) };
+    let out_lens = unsafe { slice::from_raw_parts_mut(out_lens, max_pkts) };
+    let out_info = unsafe { slice::from_raw_parts_mut(out_info, max_pkts) };
+
+    match conn.send_batch(out, out_len, out_lens, &mut at[..max_pkts]) {
+        Ok((n, info)) => {
+            for (i, at) in out_info[..n].iter_mut().zip(at.iter()) {
+                i.from_len = std_addr_to_c(&info.from, &mut i.from);
+                i.to_len = std_addr_to_c(&info.to, &mut i.to);
+
+                std_time_to_c(at, &mut i.at);
+            }
+
+            n as ssize_t
+        },
+
+        Err(e) => e.to_c(),
+    }
+}
+
+#[no_mangle]
+pub extern fn quiche_conn_segment_size(conn: &Connection) -> size_t {
+    conn.segment_size()
+}
+
+#[no_mangle]
+pub extern fn quiche_conn_send_segments(
+    conn: &mut Connection, out: *mut u8, out_len: size_t, segment_size: size_t,
+    out_segment_size: &mut size_t, out_info: &mut SendInfo,
+) -> ssize_t {
+    if out_len > <ssize_t>::max_value() as usize {
+        panic!("The provided buffer is too large");
+    }
+
+    let out = unsafe { slice::from_raw_parts_mut(out, out_len) };
+
+    match conn.send_segments(out, segment_size) {
+        Ok((v, seg, info)) => {
+            *out_segment_size = seg;
+
+            out_info.from_len = std_addr_to_c(&info.from, &mut out_info.from);
+            out_info.to_len = std_addr_to_c(&info.to, &mut out_info.to);
+
+            std_time_to_c(&info.at, &mut out_info.at);
+
+            v as ssize_t
+        },
+
+        Err(e) => e.to_c(),
+    }
+}
+
 
 struct AppData(*mut c_void);
 unsafe impl Send for AppData {}
@@ -394,42 +802,46 @@ unsafe impl Sync for AppData {}
 
 
 
-// #[no_mangle]
-// pub extern fn quiche_conn_close(
-//     conn: &mut Connection, app: bool, err: u64, reason: *const u8,
-//     reason_len: size_t,
-// ) -> c_int {
-//     let reason = unsafe { slice::from_raw_parts(reason, reason_len) };
+#[no_mangle]
+pub extern fn quiche_conn_close(
+    conn: &mut Connection, app: bool, err: u64, reason: *const u8,
+    reason_len: size_t,
+) -> c_int {
+    let reason = if reason.is_null() {
+        &[]
+    } else {
+        unsafe { slice::from_raw_parts(reason, reason_len) }
+    };
 
-//     match conn.close(app, err, reason) {
-//         Ok(_) => 0,
+    match conn.close(app, err, reason) {
+        Ok(_) => 0,
 
-//         Err(e) => e.to_c() as c_int,
-//     }
-// }
+        Err(e) => e.to_c() as c_int,
+    }
+}
 
-// #[no_mangle]
-// pub extern fn quiche_conn_timeout_as_nanos(conn: &mut Connection) -> u64 {
-//     match conn.timeout() {
-//         Some(timeout) => timeout.as_nanos() as u64,
+#[no_mangle]
+pub extern fn quiche_conn_timeout_as_nanos(conn: &Connection) -> u64 {
+    match conn.timeout() {
+        Some(timeout) => timeout.as_nanos() as u64,
 
-//         None => std::u64::MAX,
-//     }
-// }
+        None => std::u64::MAX,
+    }
+}
 
-// #[no_mangle]
-// pub extern fn quiche_conn_timeout_as_millis(conn: &mut Connection) -> u64 {
-//     match conn.timeout() {
-//         Some(timeout) => timeout.as_millis() as u64,
+#[no_mangle]
+pub extern fn quiche_conn_timeout_as_millis(conn: &Connection) -> u64 {
+    match conn.timeout() {
+        Some(timeout) => timeout.as_millis() as u64,
 
-//         None => std::u64::MAX,
-//     }
-// }
+        None => std::u64::MAX,
+    }
+}
 
-// #[no_mangle]
-// pub extern fn quiche_conn_on_timeout(conn: &mut Connection) {
-//     conn.on_timeout()
-// }
+#[no_mangle]
+pub extern fn quiche_conn_on_timeout(conn: &mut Connection) {
+    conn.on_timeout()
+}
 
 // #[no_mangle]
 // pub extern fn quiche_conn_trace_id(
@@ -478,6 +890,25 @@ pub extern fn quiche_conn_is_timed_out(conn: &Connection) -> bool {
     conn.is_timed_out()
 }
 
+#[no_mangle]
+pub extern fn quiche_conn_peer_error(
+    conn: &Connection, is_app: *mut bool, error_code: *mut u64,
+    reason: &mut *const u8, reason_len: &mut size_t,
+) -> bool {
+    match conn.peer_error() {
+        Some(conn_err) => unsafe {
+            *is_app = conn_err.is_app;
+            *error_code = conn_err.error_code;
+            *reason = conn_err.reason.as_ptr();
+            *reason_len = conn_err.reason.len();
+
+            true
+        },
+
+        None => false,
+    }
+}
+
 // #[no_mangle]
 // pub extern fn quiche_conn_peer_error(
 //     conn: &mut Connection, is_app: *mut bool, error_code: *mut u64,
@@ -528,57 +959,36 @@ pub struct Stats {
     sent_bytes: u64,
     recv_bytes: u64,
     lost_bytes: u64,
-    stream_retrans_bytes: u64,
+    retrans_bytes: u64,
+    rollbacks: usize,
+    delivered_bytes: [u64; PRIORITY_LEVELS],
+    lost_bytes_by_priority: [u64; PRIORITY_LEVELS],
+    given_up_bytes: [u64; PRIORITY_LEVELS],
+    fec_sent: usize,
+    fec_recovered: usize,
     paths_count: usize,
-    peer_max_idle_timeout: u64,
-    peer_max_udp_payload_size: u64,
-    peer_initial_max_data: u64,
-    peer_initial_max_stream_data_bidi_local: u64,
-    peer_initial_max_stream_data_bidi_remote: u64,
-    peer_initial_max_stream_data_uni: u64,
-    peer_initial_max_streams_bidi: u64,
-    peer_initial_max_streams_uni: u64,
-    peer_ack_delay_exponent: u64,
-    peer_max_ack_delay: u64,
-    peer_disable_active_migration: bool,
-    peer_active_conn_id_limit: u64,
-    peer_max_datagram_frame_size: ssize_t,
-    paths: [PathStats; 8],
 }
 
-// #[no_mangle]
-// pub extern fn quiche_conn_stats(conn: &Connection, out: &mut Stats) {
-//     let stats = conn.stats();
-
-//     out.recv = stats.recv;
-//     out.sent = stats.sent;
-//     out.lost = stats.lost;
-//     out.retrans = stats.retrans;
-//     out.sent_bytes = stats.sent_bytes;
-//     out.recv_bytes = stats.recv_bytes;
-//     out.lost_bytes = stats.lost_bytes;
-//     out.stream_retrans_bytes = stats.stream_retrans_bytes;
-//     out.paths_count = stats.paths_count;
-//     out.peer_max_idle_timeout = stats.peer_max_idle_timeout;
-//     out.peer_max_udp_payload_size = stats.peer_max_udp_payload_size;
-//     out.peer_initial_max_data = stats.peer_initial_max_data;
-//     out.peer_initial_max_stream_data_bidi_local =
-//         stats.peer_initial_max_stream_data_bidi_local;
-//     out.peer_initial_max_stream_data_bidi_remote =
-//         stats.peer_initial_max_stream_data_bidi_remote;
-//     out.peer_initial_max_stream_data_uni = stats.peer_initial_max_stream_data_uni;
-//     out.peer_initial_max_streams_bidi = stats.peer_initial_max_streams_bidi;
-//     out.peer_initial_max_streams_uni = stats.peer_initial_max_streams_uni;
-//     out.peer_ack_delay_exponent = stats.peer_ack_delay_exponent;
-//     out.peer_max_ack_delay = stats.peer_max_ack_delay;
-//     out.peer_disable_active_migration = stats.peer_disable_active_migration;
-//     out.peer_active_conn_id_limit = stats.peer_active_conn_id_limit;
-//     out.peer_max_datagram_frame_size = match stats.peer_max_datagram_frame_size {
-//         None => Error::Done.to_c(),
-
-//         Some(v) => v as ssize_t,
-//     };
-// }
+#[no_mangle]
+pub extern fn quiche_conn_stats(conn: &Connection, out: &mut Stats) {
+    let stats = conn.stats();
+
+    out.recv = stats.recv;
+    out.sent = stats.sent;
+    out.lost = stats.lost;
+    out.retrans = stats.retrans;
+    out.sent_bytes = stats.sent_bytes;
+    out.recv_bytes = stats.recv_bytes;
+    out.lost_bytes = stats.lost_bytes;
+    out.retrans_bytes = stats.retrans_bytes;
+    out.rollbacks = stats.rollbacks;
+    out.delivered_bytes = stats.delivered_bytes;
+    out.lost_bytes_by_priority = stats.lost_bytes_by_priority;
+    out.given_up_bytes = stats.given_up_bytes;
+    out.fec_sent = stats.fec_sent;
+    out.fec_recovered = stats.fec_recovered;
+    out.paths_count = stats.paths_count;
+}
 
 #[repr(C)]
 pub struct PathStats {
@@ -586,50 +996,50 @@ pub struct PathStats {
     local_addr_len: socklen_t,
     peer_addr: sockaddr_storage,
     peer_addr_len: socklen_t,
-    validation_state: ssize_t,
     active: bool,
     recv: usize,
     sent: usize,
     lost: usize,
     retrans: usize,
     rtt: u64,
+    min_rtt: u64,
     cwnd: usize,
     sent_bytes: u64,
     recv_bytes: u64,
     lost_bytes: u64,
-    stream_retrans_bytes: u64,
+    retrans_bytes: u64,
     pmtu: usize,
     delivery_rate: u64,
 }
 
-// #[no_mangle]
-// pub extern fn quiche_conn_path_stats(
-//     conn: &Connection, idx: usize, out: &mut PathStats,
-// ) -> c_int {
-//     let stats = match conn.path_stats().nth(idx) {
-//         Some(p) => p,
-//         None => return Error::Done.to_c() as c_int,
-//     };
+#[no_mangle]
+pub extern fn quiche_conn_path_stats(
+    conn: &Connection, idx: usize, out: &mut PathStats,
+) -> c_int {
+    let stats = match conn.path_stats().nth(idx) {
+        Some(p) => p,
+        None => return Error::Done.to_c() as c_int,
+    };
 
-//     out.local_addr_len = std_addr_to_c(&stats.local_addr, &mut out.local_addr);
-//     out.peer_addr_len = std_addr_to_c(&stats.peer_addr, &mut out.peer_addr);
-//     out.validation_state = stats.validation_state.to_c();
-//     out.active = stats.active;
-//     out.recv = stats.recv;
-//     out.sent = stats.sent;
-//     out.lost = stats.lost;
-//     out.retrans = stats.retrans;
-//     out.rtt = stats.rtt.as_nanos() as u64;
-//     out.cwnd = stats.cwnd;
-//     out.sent_bytes = stats.sent_bytes;
-//     out.recv_bytes = stats.recv_bytes;
-//     out.lost_bytes = stats.lost_bytes;
-//     out.stream_retrans_bytes = stats.stream_retrans_bytes;
-//     out.pmtu = stats.pmtu;
-//     out.delivery_rate = stats.delivery_rate;
+    out.local_addr_len = std_addr_to_c(&stats.local_addr, &mut out.local_addr);
+    out.peer_addr_len = std_addr_to_c(&stats.peer_addr, &mut out.peer_addr);
+    out.active = stats.active;
+    out.recv = stats.recv;
+    out.sent = stats.sent;
+    out.lost = stats.lost;
+    out.retrans = stats.retrans;
+    out.rtt = stats.rtt.as_nanos() as u64;
+    out.min_rtt = stats.min_rtt.as_nanos() as u64;
+    out.cwnd = stats.cwnd;
+    out.sent_bytes = stats.sent_bytes;
+    out.recv_bytes = stats.recv_bytes;
+    out.lost_bytes = stats.lost_bytes;
+    out.retrans_bytes = stats.retrans_bytes;
+    out.pmtu = stats.pmtu;
+    out.delivery_rate = stats.delivery_rate;
 
-//     0
-// }
+    0
+}
 
 
 
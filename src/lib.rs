@@ -11,11 +11,10 @@ use std::net::SocketAddr;
 use std::str::FromStr;
 
 // use std::collections::HashSet;
-use std::collections::VecDeque;
+// use std::collections::VecDeque;
 // use std::collections::hash_map;
 use std::collections::BTreeMap;
 // use std::collections::BinaryHeap;
-use std::collections::HashMap;
 // use std::vec;
 // use rand::Rng;
 // use std::ops::Bound::Included;
@@ -26,6 +25,26 @@ const ELICT_FLAG: usize = 8;
 // use crate::ranges;
 const CONGESTION_THREAHOLD: f64 = 0.01;
 
+/// Records an event in the connection trace. Unless the `qlog` feature is
+/// enabled, the fields of the event are only referenced from a closure that
+/// is never called, so they are not evaluated but don't trigger unused
+/// warnings either.
+macro_rules! qlog_event {
+    ($trace:expr, $($ev:ident)::+ { $($field:ident $(: $value:expr)?),* $(,)? }) => {
+        #[cfg(feature = "qlog")]
+        $trace.record($($ev)::+ { $($field $(: $value)?),* });
+
+        #[cfg(not(feature = "qlog"))]
+        let _ = || {
+            $(let _ = &qlog_event!(@value $field $(: $value)?);)*
+        };
+    };
+
+    (@value $field:ident : $value:expr) => { $value };
+
+    (@value $field:ident) => { $field };
+}
+
 /// The minimum length of Initial packets sent by a client.
 pub const MIN_CLIENT_INITIAL_LEN: usize = 1350;
 
@@ -35,11 +54,33 @@ pub const MIN_CLIENT_INITIAL_LEN: usize = 1350;
 // The default max_datagram_size used in congestion control.
 const MAX_SEND_UDP_PAYLOAD_SIZE: usize = 1350;
 
+// The largest UDP payload of an IPv4 datagram.
+const MAX_UDP_PAYLOAD_SIZE: usize = 65507;
+
 // The default length of DATAGRAM queues.
 // const DEFAULT_MAX_DGRAM_QUEUE_LEN: usize = 0;
 
+/// The default block size, and the unit of negotiated block sizes.
 const SEND_BUFFER_SIZE:usize = 1024;
 
+/// The largest block size, the largest that a UDP datagram carries after
+/// the header of its packet.
+const MAX_BLOCK_SIZE: usize =
+    (MAX_UDP_PAYLOAD_SIZE - HEADER_LENGTH) / SEND_BUFFER_SIZE * SEND_BUFFER_SIZE;
+
+/// The maximum number of segments the kernel accepts in one UDP GSO send.
+pub const MAX_GSO_SEGMENTS: usize = 64;
+
+/// Packets paced closer together than this are sent in the same burst.
+const PACING_GRANULARITY: Duration = Duration::from_millis(1);
+
+/// The maximum number of blocks a probe ElictAck asks about, so that the
+/// list fits in a packet in either ACK format.
+const MAX_PROBE_BLOCKS: usize = (MAX_SEND_UDP_PAYLOAD_SIZE - HEADER_LENGTH) / 8;
+
+/// The number of ElictAck packets whose send time is kept for RTT sampling.
+const ELICIT_HISTORY: usize = 8;
+
 pub type Result<T> = std::result::Result<T, Error>;
 
 /// A QUIC error.
@@ -182,6 +223,19 @@ pub struct RecvInfo {
     pub to: SocketAddr,
 }
 
+/// Information about an error that caused a connection to close.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct ConnectionError {
+    /// Whether the error came from the application or the transport.
+    pub is_app: bool,
+
+    /// The error code.
+    pub error_code: u64,
+
+    /// The reason phrase, truncated to what fits in a packet.
+    pub reason: Vec<u8>,
+}
+
 /// Ancillary information about outgoing packets.
 #[derive(Clone, Copy, Debug, PartialEq, Eq)]
 pub struct SendInfo {
@@ -191,6 +245,228 @@ pub struct SendInfo {
     /// The remote address the packet should be sent to.
     pub to: SocketAddr,
 
+    /// The time to send the packet out, see `Config::enable_pacing()`.
+    pub at: Instant,
+}
+
+/// The number of priority levels blocks are classified into.
+pub const PRIORITY_LEVELS: usize = 3;
+
+/// Conditions under which the receiver considers an iteration complete,
+/// see `Connection::set_iteration_policy()`.
+///
+/// An iteration is always complete once every block has been received.
+#[derive(Clone, Copy, Debug, Default)]
+pub struct IterationPolicy {
+    /// The iteration is complete at this time, whatever has been received.
+    pub deadline: Option<Instant>,
+
+    /// The iteration is complete once this fraction (0 to 1) of the high
+    /// priority blocks has been received.
+    pub high_priority_fraction: Option<f64>,
+}
+
+/// The retransmit budget of blocks that are never given up on.
+pub const RETRANSMIT_UNLIMITED: u8 = u8::MAX;
+
+/// Reliability the sender provides to each priority level, see
+/// `Connection::set_reliability_policy()`.
+///
+/// Both arrays are indexed by priority level, low to high.
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub struct ReliabilityPolicy {
+    /// The number of times a block can be retransmitted before the sender
+    /// gives up on it, or `RETRANSMIT_UNLIMITED`.
+    pub retransmit_budget: [u8; PRIORITY_LEVELS],
+
+    /// The fraction (0 to 1) of the bytes of each priority level of the
+    /// iteration that can be lost. Once enough bytes of a level have been
+    /// delivered, the sender gives up on the remaining blocks of that level.
+    pub acceptable_loss: [f64; PRIORITY_LEVELS],
+}
+
+impl Default for ReliabilityPolicy {
+    /// Blocks can be retransmitted as many times as their priority, and all
+    /// of them are sent until they are delivered or out of budget.
+    fn default() -> Self {
+        ReliabilityPolicy {
+            retransmit_budget: [1, 2, 3],
+            acceptable_loss: [0.0; PRIORITY_LEVELS],
+        }
+    }
+}
+
+/// Statistics about the connection.
+///
+/// A connection's statistics can be collected using the [`stats()`] method.
+///
+/// [`stats()`]: struct.Connection.html#method.stats
+#[derive(Clone, Default)]
+pub struct Stats {
+    /// The number of packets received.
+    pub recv: usize,
+
+    /// The number of packets sent.
+    pub sent: usize,
+
+    /// The number of data packets reported lost by the peer.
+    pub lost: usize,
+
+    /// The number of data packets sent with retransmitted data.
+    pub retrans: usize,
+
+    /// The number of bytes sent.
+    pub sent_bytes: u64,
+
+    /// The number of bytes received.
+    pub recv_bytes: u64,
+
+    /// The number of data bytes reported lost by the peer.
+    pub lost_bytes: u64,
+
+    /// The number of data bytes retransmitted.
+    pub retrans_bytes: u64,
+
+    /// The number of times the congestion window was rolled back.
+    pub rollbacks: usize,
+
+    /// The number of data bytes acknowledged, per priority level (low to
+    /// high).
+    pub delivered_bytes: [u64; PRIORITY_LEVELS],
+
+    /// The number of data bytes reported lost, per priority level (low to
+    /// high).
+    pub lost_bytes_by_priority: [u64; PRIORITY_LEVELS],
+
+    /// The number of data bytes the sender gave up on, per priority level
+    /// (low to high).
+    pub given_up_bytes: [u64; PRIORITY_LEVELS],
+
+    /// The number of Fec packets sent.
+    pub fec_sent: usize,
+
+    /// The number of lost blocks rebuilt from Fec packets.
+    pub fec_recovered: usize,
+
+    /// The number of known paths for the connection.
+    pub paths_count: usize,
+}
+
+impl std::fmt::Debug for Stats {
+    #[inline]
+    fn fmt(&self, f: &mut std::fmt::Formatter) -> std::fmt::Result {
+        write!(
+            f,
+            "recv={} sent={} lost={} retrans={} rollbacks={}",
+            self.recv, self.sent, self.lost, self.retrans, self.rollbacks,
+        )?;
+
+        write!(
+            f,
+            " sent_bytes={} recv_bytes={} lost_bytes={} retrans_bytes={}",
+            self.sent_bytes, self.recv_bytes, self.lost_bytes, self.retrans_bytes,
+        )?;
+
+        write!(
+            f,
+            " delivered_bytes={:?} lost_bytes_by_priority={:?} given_up_bytes={:?}",
+            self.delivered_bytes, self.lost_bytes_by_priority, self.given_up_bytes,
+        )?;
+
+        write!(
+            f,
+            " fec_sent={} fec_recovered={}",
+            self.fec_sent, self.fec_recovered,
+        )
+    }
+}
+
+/// Statistics about the path of a connection.
+///
+/// A connection's path statistics can be collected using the
+/// [`path_stats()`] method.
+///
+/// [`path_stats()`]: struct.Connection.html#method.path_stats
+#[derive(Clone)]
+pub struct PathStats {
+    /// The local address of the path.
+    pub local_addr: SocketAddr,
+
+    /// The peer address of the path.
+    pub peer_addr: SocketAddr,
+
+    /// Whether this path is used to send packets.
+    pub active: bool,
+
+    /// The number of packets received on this path.
+    pub recv: usize,
+
+    /// The number of packets sent on this path.
+    pub sent: usize,
+
+    /// The number of data packets reported lost on this path.
+    pub lost: usize,
+
+    /// The number of data packets sent with retransmitted data on this path.
+    pub retrans: usize,
+
+    /// The smoothed round-trip time of the path.
+    pub rtt: Duration,
+
+    /// The minimum round-trip time of the path over the last 5 minutes.
+    pub min_rtt: Duration,
+
+    /// The size of the path's congestion window in bytes.
+    pub cwnd: usize,
+
+    /// The number of bytes sent on this path.
+    pub sent_bytes: u64,
+
+    /// The number of bytes received on this path.
+    pub recv_bytes: u64,
+
+    /// The number of data bytes reported lost on this path.
+    pub lost_bytes: u64,
+
+    /// The number of data bytes retransmitted on this path.
+    pub retrans_bytes: u64,
+
+    /// The maximum UDP payload size of the path.
+    pub pmtu: usize,
+
+    /// The rate at which data was acknowledged over the last window, in
+    /// bytes per second.
+    pub delivery_rate: u64,
+}
+
+impl std::fmt::Debug for PathStats {
+    #[inline]
+    fn fmt(&self, f: &mut std::fmt::Formatter) -> std::fmt::Result {
+        write!(
+            f,
+            "local_addr={:?} peer_addr={:?} active={}",
+            self.local_addr, self.peer_addr, self.active,
+        )?;
+
+        write!(
+            f,
+            " recv={} sent={} lost={} retrans={} rtt={:?} min_rtt={:?} cwnd={}",
+            self.recv, self.sent, self.lost, self.retrans, self.rtt,
+            self.min_rtt, self.cwnd,
+        )?;
+
+        write!(
+            f,
+            " sent_bytes={} recv_bytes={} lost_bytes={} retrans_bytes={}",
+            self.sent_bytes, self.recv_bytes, self.lost_bytes, self.retrans_bytes,
+        )?;
+
+        write!(
+            f,
+            " pmtu={} delivery_rate={}",
+            self.pmtu, self.delivery_rate,
+        )
+    }
 }
 
 /// Stores configuration shared between multiple connections.
@@ -198,9 +474,23 @@ pub struct Config {
 
     cc_algorithm: CongestionControlAlgorithm,
 
+    quantile_algorithm: QuantileAlgorithm,
+
+    scheduling_policy: SchedulingPolicy,
+
     max_send_udp_payload_size: usize,
 
+    max_recv_udp_payload_size: usize,
+
     max_idle_timeout: u64,
+
+    pacing: bool,
+
+    compact_ack: bool,
+
+    compact_header: bool,
+
+    fec: bool,
 }
 
 impl Config {
@@ -216,20 +506,52 @@ impl Config {
         Ok(Config {
             // local_transport_params: TransportParams::default(),
             cc_algorithm: CongestionControlAlgorithm::NEWCUBIC,
+
+            quantile_algorithm: QuantileAlgorithm::SELECT,
+
+            scheduling_policy: SchedulingPolicy::PRIORITY,
             // pacing: true,
 
             max_send_udp_payload_size: MAX_SEND_UDP_PAYLOAD_SIZE,
 
+            max_recv_udp_payload_size: MAX_SEND_UDP_PAYLOAD_SIZE,
+
             max_idle_timeout: 5000,
+
+            pacing: true,
+
+            compact_ack: true,
+
+            compact_header: true,
+
+            fec: false,
         })
     }
 
     /// Sets the `max_idle_timeout` transport parameter, in milliseconds.
     /// same with tcp max idle timeout
-    /// The default value is infinite, that is, no timeout is used.
+    /// The default value is 5000. Zero means no timeout is used.
     pub fn set_max_idle_timeout(&mut self, v: u64) {
         self.max_idle_timeout = v;
     }
+
+    /// Sets the maximum outgoing UDP payload size.
+    ///
+    /// The server probes the path for the largest payload up to this size
+    /// during the handshake. The default and minimum value is `1350`.
+    pub fn set_max_send_udp_payload_size(&mut self, v: usize) {
+        self.max_send_udp_payload_size =
+            v.clamp(MAX_SEND_UDP_PAYLOAD_SIZE, MAX_UDP_PAYLOAD_SIZE);
+    }
+
+    /// Sets the maximum incoming UDP payload size, which the client
+    /// advertises during the handshake.
+    ///
+    /// The default and minimum value is `1350`.
+    pub fn set_max_recv_udp_payload_size(&mut self, v: usize) {
+        self.max_recv_udp_payload_size =
+            v.clamp(MAX_SEND_UDP_PAYLOAD_SIZE, MAX_UDP_PAYLOAD_SIZE);
+    }
    
     /// Sets the congestion control algorithm used by string.
     ///
@@ -251,11 +573,91 @@ impl Config {
 
     /// Sets the congestion control algorithm used
     ///
-    /// The default value is `CongestionControlAlgorithm::CUBIC`.
+    /// The default value is `CongestionControlAlgorithm::NEWCUBIC`.
+    /// `CongestionControlAlgorithm::BBR` sizes the window after the delivery
+    /// rate and the minimum RTT instead of the loss weights of the ACKs.
     pub fn set_cc_algorithm(&mut self, algo: CongestionControlAlgorithm) {
         self.cc_algorithm = algo;
     }
 
+    /// Sets the algorithm used to compute the priority split points by
+    /// string.
+    ///
+    /// The default value is `select`. On error `Error::InvalidState` will be
+    /// returned.
+    pub fn set_quantile_algorithm_name(&mut self, name: &str) -> Result<()> {
+        self.quantile_algorithm = QuantileAlgorithm::from_str(name)?;
+
+        Ok(())
+    }
+
+    /// Sets the algorithm used to compute the priority split points.
+    ///
+    /// The default value is `QuantileAlgorithm::SELECT`.
+    pub fn set_quantile_algorithm(&mut self, algo: QuantileAlgorithm) {
+        self.quantile_algorithm = algo;
+    }
+
+    /// Sets the order the blocks of a congestion window are sent in by
+    /// string.
+    ///
+    /// The default value is `priority`. On error `Error::InvalidState` will
+    /// be returned.
+    pub fn set_scheduling_policy_name(&mut self, name: &str) -> Result<()> {
+        self.scheduling_policy = SchedulingPolicy::from_str(name)?;
+
+        Ok(())
+    }
+
+    /// Sets the order the blocks of a congestion window are sent in.
+    ///
+    /// The default value is `SchedulingPolicy::PRIORITY`.
+    pub fn set_scheduling_policy(&mut self, policy: SchedulingPolicy) {
+        self.scheduling_policy = policy;
+    }
+
+    /// Configures whether to spread the packets of a congestion window over
+    /// the RTT. The pacing time of each packet is returned in
+    /// `SendInfo::at`.
+    ///
+    /// The default value is `true`.
+    pub fn enable_pacing(&mut self, v: bool) {
+        self.pacing = v;
+    }
+
+    /// Configures whether to offer compact ACK and ElictAck payloads, which
+    /// report blocks as run-length ranges instead of one 8 byte offset
+    /// each. They are only used if both endpoints offer them in their
+    /// Handshake packets.
+    ///
+    /// The default value is `true`.
+    pub fn enable_compact_ack(&mut self, v: bool) {
+        self.compact_ack = v;
+    }
+
+    /// Configures whether to offer compact packet headers, which pack the
+    /// packet type and priority into one byte, send the packet number and
+    /// block index as varints and leave the payload length implicit. They
+    /// are only used if both endpoints offer them in their Handshake
+    /// packets.
+    ///
+    /// The default value is `true`.
+    pub fn enable_compact_header(&mut self, v: bool) {
+        self.compact_header = v;
+    }
+
+    /// Configures whether to offer forward error correction. The sender
+    /// then follows the data blocks of priority 2 and 3 with Fec packets
+    /// holding their XOR parity, from which the receiver rebuilds a lost
+    /// block without waiting for its retransmission. Priority 3 blocks get
+    /// a parity every 2 blocks, priority 2 blocks every 4. It is only used
+    /// if both endpoints offer it in their Handshake packets.
+    ///
+    /// The default value is `false`.
+    pub fn enable_fec(&mut self, v: bool) {
+        self.fec = v;
+    }
+
 }
 
 #[inline]
@@ -279,26 +681,213 @@ pub fn connect(
     Ok(conn)
 }
 
+/// Maps a block priority (1 to 3) to an index into per-priority counters.
+#[inline]
+fn priority_level(priority: u8) -> usize {
+    cmp::min((priority as usize).saturating_sub(1), PRIORITY_LEVELS - 1)
+}
+
+/// Returns the priority (1 to 3) of a block of squared L2 norm `norm2`,
+/// given the split points of the iteration.
+#[inline]
+fn norm2_priority(norm2: f32, low_split_point: f32, high_split_point: f32) -> u8 {
+    if norm2 < low_split_point {
+        1
+    } else if norm2 < high_split_point {
+        2
+    } else {
+        3
+    }
+}
+
+/// Returns the priority of block `idx` from the norms of the iteration.
+///
+/// The index can come from the peer, so a block without a norm, which only
+/// a bogus offset refers to, gets the lowest priority instead of panicking.
+#[inline]
+fn block_priority(
+    norm2_vec: &[f32], idx: usize, low_split_point: f32, high_split_point: f32,
+) -> u8 {
+    norm2_vec
+        .get(idx)
+        .map_or(1, |norm2| norm2_priority(*norm2, low_split_point, high_split_point))
+}
+
+/// Returns the number of high priority blocks among `blocks`, i.e. those at
+/// or above the 70% quantile of the block norms.
+#[inline]
+fn high_priority_blocks(blocks: usize) -> usize {
+    blocks - blocks * 7 / 10
+}
+
+/// Returns the bytes of a packet of the path MTU that can't hold a block:
+/// the longest header and, if `fec` is used, the room a Fec packet needs
+/// on top of its parity, so that it fits in the path MTU too.
+#[inline]
+fn block_overhead(fec: bool) -> usize {
+    HEADER_LENGTH + if fec { fec::MAX_OVERHEAD } else { 0 }
+}
+
+/// Returns true if `block_size` is a non-zero multiple of `SEND_BUFFER_SIZE`
+/// of at most `MAX_BLOCK_SIZE`.
+#[inline]
+fn is_valid_block_size(block_size: usize) -> bool {
+    block_size != 0 &&
+        block_size % SEND_BUFFER_SIZE == 0 &&
+        block_size <= MAX_BLOCK_SIZE
+}
+
+/// Returns the block size carried by data packets of `pmtu` bytes: the
+/// largest multiple of `SEND_BUFFER_SIZE` that fits after the overhead.
+fn block_size_for(pmtu: usize, fec: bool) -> usize {
+    cmp::max(pmtu.saturating_sub(block_overhead(fec)) / SEND_BUFFER_SIZE, 1) *
+        SEND_BUFFER_SIZE
+}
+
+/// Writes a compact ACK payload: the largest received offset, `blocks` as
+/// ranges, then one bit per block, set if the block was received.
+fn encode_compact_ack(
+    out: &mut [u8], max_off: u64, blocks: &[u64], state: &block::BlockTable,
+) -> Result<usize> {
+    let mut b = octets::OctetsMut::with_slice(out);
+
+    b.put_varint(max_off)?;
+    packet::encode_block_ranges(&mut b, blocks)?;
+
+    for chunk in blocks.chunks(8) {
+        let mut bits: u8 = 0;
+
+        for (i, idx) in chunk.iter().enumerate() {
+            if state.is_received(*idx) {
+                bits |= 1 << i;
+            }
+        }
+
+        b.put_u8(bits)?;
+    }
+
+    Ok(b.off())
+}
+
+/// Parses a compact ACK payload written by `encode_compact_ack()`, and
+/// returns the largest received offset and the received bit-plane.
+fn decode_compact_ack<'a>(
+    buf: &'a mut [u8], blocks: &mut Vec<u64>,
+) -> Result<(u64, &'a [u8])> {
+    let mut b = octets::OctetsMut::with_slice(buf);
+
+    let max_off = b.get_varint()?;
+    packet::decode_block_ranges(&mut b, block::MAX_BLOCKS, blocks)?;
+
+    let start = b.off();
+    let plane_len = (blocks.len() + 7) / 8;
+    if b.cap() < plane_len {
+        return Err(Error::BufferTooShort);
+    }
+
+    Ok((max_off, &buf[start..start + plane_len]))
+}
+
+/// A dmludp connection.
 pub struct Connection {
 
     /// Total number of received packets.
     recv_count: usize,
 
-    /// Total number of sent packets.
+    /// Number of data packets sent since the last ElictAck.
     sent_count: usize,
 
+    /// Total number of sent packets.
+    sent_pkts: usize,
+
     /// Total number of lost packets.
-    // lost_count: usize,
+    lost_count: usize,
 
     /// Total number of packets sent with data retransmitted.
-    // retrans_count: usize,
+    retrans_count: usize,
+
+    /// Total number of bytes sent over the connection.
+    sent_bytes: u64,
+
+    /// Total number of bytes received over the connection.
+    recv_bytes: u64,
 
     /// Total number of bytes sent lost over the connection.
-    // lost_bytes: u64,
+    lost_bytes: u64,
+
+    /// Total number of data bytes retransmitted over the connection.
+    retrans_bytes: u64,
+
+    /// Total number of congestion window rollbacks.
+    rollback_count: usize,
+
+    /// Data bytes acknowledged, per priority level.
+    delivered_bytes: [u64; PRIORITY_LEVELS],
+
+    /// Data bytes reported lost, per priority level.
+    priority_lost_bytes: [u64; PRIORITY_LEVELS],
+
+    /// Data bytes given up on, per priority level.
+    given_up_bytes: [u64; PRIORITY_LEVELS],
+
+    /// How many times the sender retransmits blocks, and how many of their
+    /// bytes it can lose.
+    reliability_policy: ReliabilityPolicy,
+
+    /// The bytes of the current iteration per priority level, once all of
+    /// them have been buffered.
+    iteration_bytes: Option<[u64; PRIORITY_LEVELS]>,
+
+    /// Data bytes of the current iteration acknowledged, per priority level.
+    iteration_delivered: [u64; PRIORITY_LEVELS],
+
+    /// Whether each priority level of the current iteration met its loss
+    /// target.
+    level_met: [bool; PRIORITY_LEVELS],
+
+    /// When the current congestion window was opened.
+    window_start: Instant,
+
+    /// When the receiver considers the current iteration complete.
+    iteration_policy: IterationPolicy,
+
+    /// Data bytes acknowledged since the current window was opened.
+    window_delivered: u64,
+
+    /// Delivery rate over the last window, in bytes per second.
+    delivery_rate: u64,
 
     /// Draining timeout expiration time.
     draining_timer: Option<time::Instant>,
 
+    /// The idle timeout, if any.
+    idle_timeout: Option<Duration>,
+
+    /// Idle timeout expiration time.
+    idle_timer: Option<Instant>,
+
+    /// Whether an ElictAck must be sent to probe for blocks no ACK answered.
+    elicit_probe: bool,
+
+    /// The packet number and send time of the last ElictAck packets, indexed
+    /// by packet number modulo `ELICIT_HISTORY`.
+    elicit_sent: [Option<(u64, Instant)>; ELICIT_HISTORY],
+
+    /// The largest UDP payload the server sends, or the client receives.
+    local_max_udp_payload_size: usize,
+
+    /// The UDP payload size of data packets, confirmed during the handshake.
+    pmtu: usize,
+
+    /// Whether `pmtu` was confirmed.
+    pmtu_confirmed: bool,
+
+    /// The number of blocks the next Handshake probe is sized for.
+    pmtu_probe_blocks: usize,
+
+    /// The size of a block, which is the payload of a data packet.
+    block_size: usize,
+
     /// Whether this is a server-side connection.
     is_server: bool,
 
@@ -316,16 +905,23 @@ pub struct Connection {
 
     /// Whether an ack-eliciting packet has been sent since last receiving a
     /// packet.
-    // ack_eliciting_sent: bool,
+    ack_eliciting_sent: bool,
 
     /// Whether the connection is closed.
     closed: bool,
 
+    /// The error the connection was closed with by `close()`, sent to the
+    /// peer in a Fin packet.
+    local_error: Option<ConnectionError>,
+
+    /// The error the peer closed the connection with.
+    peer_error: Option<ConnectionError>,
+
     // Whether the connection was timed out
     timed_out: bool,
 
     #[cfg(feature = "qlog")]
-    qlog: QlogInfo,
+    qlog: trace::Trace,
 
     server: bool,
 
@@ -351,7 +947,6 @@ pub struct Connection {
 
     stop_ack: bool,
 
-    prioritydic: HashMap<u64,u8>,
 
     // off: u64,
 
@@ -359,17 +954,33 @@ pub struct Connection {
 
     // recv_pkt:Vec<u64>,
 
-    recv_dic: HashMap<u64,u8>,
+    /// Per-block state of the current iteration.
+    blocks: block::BlockTable,
 
     //used to compute priority
     low_split_point: f32,
     high_split_point: f32,
 
     //store data
-    send_data:Vec<u8>,
+    send_data: SendData,
     //store norm2 for every 256 bits float
     norm2_vec:Vec<f32>,
 
+    quantile_algorithm: QuantileAlgorithm,
+
+    /// The order the blocks of a congestion window are sent in.
+    scheduling_policy: SchedulingPolicy,
+
+    //estimates split points when quantile_algorithm is SKETCH, and while
+    //data of an iteration is still being appended
+    norm2_sketch: quantile::Sketch,
+
+    //number of entries of norm2_vec inserted into norm2_sketch
+    norm2_sketched: usize,
+
+    //false between data_begin() and data_finish()
+    data_finished: bool,
+
     //total offset for the each iteration parameter
     // offset_vec:Vec<u64>,
 
@@ -377,8 +988,6 @@ pub struct Connection {
 
     recv_flag: bool,
 
-    recv_hashmap: HashMap<u64, u64>,
-
     feed_back: bool,
 
     ack_point: usize,
@@ -393,7 +1002,38 @@ pub struct Connection {
 
     recv_pkt_sent_num: Vec<usize>,
 
-    sent_dic: HashMap<u64, u64>,
+    /// Whether compact ACKs were offered by the local endpoint.
+    local_compact_ack: bool,
+
+    /// Whether compact ACKs were negotiated with the peer.
+    compact_ack: bool,
+
+    /// Whether compact headers were offered by the local endpoint.
+    local_compact_header: bool,
+
+    /// Whether compact headers were negotiated with the peer.
+    compact_header: bool,
+
+    /// Block indices being encoded or decoded, reused across ACKs.
+    ack_blocks: Vec<u64>,
+
+    /// Whether forward error correction was offered by the local endpoint.
+    local_fec: bool,
+
+    /// Whether forward error correction was negotiated with the peer.
+    fec: bool,
+
+    /// Builds the parity of the blocks sent.
+    fec_encoder: fec::FecEncoder,
+
+    /// Rebuilds lost blocks from the parity received.
+    fec_decoder: fec::FecDecoder,
+
+    /// The number of Fec packets sent.
+    fec_sent: usize,
+
+    /// The number of blocks rebuilt from Fec packets.
+    fec_recovered: usize,
 }
 
 impl Connection {
@@ -420,12 +1060,60 @@ impl Connection {
 
             recv_count: 0,
             sent_count: 0,
-            // lost_count: 0,
-            // retrans_count: 0,
+            sent_pkts: 0,
+            lost_count: 0,
+            retrans_count: 0,
+
+            sent_bytes: 0,
+            recv_bytes: 0,
+            lost_bytes: 0,
+            retrans_bytes: 0,
+
+            rollback_count: 0,
+            delivered_bytes: [0; PRIORITY_LEVELS],
+            priority_lost_bytes: [0; PRIORITY_LEVELS],
+            given_up_bytes: [0; PRIORITY_LEVELS],
+
+            reliability_policy: ReliabilityPolicy::default(),
+            iteration_bytes: None,
+            iteration_delivered: [0; PRIORITY_LEVELS],
+            level_met: [false; PRIORITY_LEVELS],
 
-            // lost_bytes: 0,
+            iteration_policy: IterationPolicy::default(),
+
+            window_start: Instant::now(),
+            window_delivered: 0,
+            delivery_rate: 0,
 
             draining_timer: None,
+
+            idle_timeout: if config.max_idle_timeout == 0 {
+                None
+            } else {
+                Some(Duration::from_millis(config.max_idle_timeout))
+            },
+
+            idle_timer: None,
+
+            elicit_probe: false,
+
+            elicit_sent: [None; ELICIT_HISTORY],
+
+            local_max_udp_payload_size: if is_server {
+                config.max_send_udp_payload_size
+            } else {
+                config.max_recv_udp_payload_size
+            },
+
+            pmtu: MAX_SEND_UDP_PAYLOAD_SIZE,
+
+            pmtu_confirmed: false,
+
+            pmtu_probe_blocks: (config.max_send_udp_payload_size -
+                block_overhead(config.fec)) / SEND_BUFFER_SIZE,
+
+            block_size: SEND_BUFFER_SIZE,
+
             is_server,
 
             // Assume clients validate the server's address implicitly.
@@ -436,12 +1124,19 @@ impl Connection {
 
             handshake_confirmed: true,
 
-            // ack_eliciting_sent: false,
+            ack_eliciting_sent: false,
 
             closed: false,
 
+            local_error: None,
+
+            peer_error: None,
+
             timed_out: false,
 
+            #[cfg(feature = "qlog")]
+            qlog: trace::Trace::new(is_server),
+
             server: is_server,
 
             localaddr: local,
@@ -464,9 +1159,8 @@ impl Connection {
             stop_flag: false,
             stop_ack: false,
 
-            prioritydic:HashMap::new(),
 
-            recv_dic:HashMap::new(),
+            blocks: block::BlockTable::default(),
 
             // off: 0,
 
@@ -476,16 +1170,24 @@ impl Connection {
             low_split_point:0.0,
             high_split_point:0.0,
 
-            send_data:Vec::<u8>::new(),
+            send_data: SendData::default(),
             norm2_vec:Vec::<f32>::new(),
 
+            quantile_algorithm: config.quantile_algorithm,
+
+            scheduling_policy: config.scheduling_policy,
+
+            norm2_sketch: quantile::Sketch::default(),
+
+            norm2_sketched: 0,
+
+            data_finished: true,
+
             // offset_vec:Vec::<u64>::new(),
             total_offset:0,
 
             recv_flag: false,
 
-            recv_hashmap:HashMap::new(),
-
             feed_back: false,
 
             ack_point: 0,
@@ -500,29 +1202,65 @@ impl Connection {
 
             recv_pkt_sent_num:Vec::<usize>::new(),
 
-            sent_dic:HashMap::new(),
+            local_compact_ack: config.compact_ack,
+
+            compact_ack: false,
+
+            local_compact_header: config.compact_header,
+
+            compact_header: false,
+
+            ack_blocks: Vec::new(),
+
+            local_fec: config.fec,
+
+            fec: false,
+
+            fec_encoder: fec::FecEncoder::default(),
+
+            fec_decoder: fec::FecDecoder::default(),
+
+            fec_sent: 0,
+
+            fec_recovered: 0,
         };
 
         conn.recovery.on_init();
+
+        conn.idle_timer = conn.idle_timeout.map(|t| Instant::now() + t);
  
 
         Ok(conn)
     }
 
+    /// Takes an RTT sample from the Handshake exchange.
     fn update_rtt(&mut self){
         let arrive_time = Instant::now();
-        if self.rtt == Duration::ZERO{
-            self.rtt = arrive_time.duration_since(self.handshake);
-        }else{
-            // self.rtt = self.rtt/8 + 15*arrive_time.duration_since(self.handshake)/16;
-            self.rtt = 17*arrive_time.duration_since(self.handshake)/16;
-        }
-        
+        self.new_rtt(arrive_time.duration_since(self.handshake));
     }
 
+    /// Feeds an RTT sample to the estimator, and updates `rtt` to the
+    /// smoothed RTT.
     pub fn new_rtt(& mut self, last: Duration){
-        println!("Pre rtt: {:?}, last: {:?}",self.rtt, last);
-        self.rtt = self.rtt/4 + 3*last/4;
+        self.recovery.update_rtt(last, Instant::now());
+        self.rtt = self.recovery.rtt();
+        qlog_event!(self.qlog, trace::Event::RttUpdated { latest: last, rtt: self.rtt });
+    }
+
+    /// Takes an RTT sample from an ACK, which echoes the packet number of
+    /// the ElictAck it answers. Only the first ACK for an ElictAck is
+    /// sampled.
+    fn on_ack_rtt_sample(&mut self, pkt_num: u64){
+        let slot = &mut self.elicit_sent[(pkt_num % ELICIT_HISTORY as u64) as usize];
+
+        match *slot {
+            Some((pn, sent)) if pn == pkt_num => {
+                *slot = None;
+                self.new_rtt(Instant::now().saturating_duration_since(sent));
+            },
+
+            _ => (),
+        }
     }
 
     pub fn recv_slice(&mut self, buf: &mut [u8]) ->Result<usize>{
@@ -531,51 +1269,210 @@ impl Connection {
         if len == 0{
             return Err(Error::BufferTooShort);
         }
+        if self.closed {
+            return Err(Error::Done);
+        }
+
         self.recv_count += 1;
+        self.recv_bytes += len as u64;
+        self.idle_timer = self.idle_timeout.map(|t| Instant::now() + t);
+        self.ack_eliciting_sent = false;
 
         let mut b = octets::OctetsMut::with_slice(buf);
 
-        let hdr = Header::from_bytes(&mut b)?;
+        let hdr = Header::from_bytes(&mut b, self.block_size)?;
+        let hdr_len = b.off();
+        let end = cmp::min(len, hdr_len + hdr.pkt_length as usize);
+
+        qlog_event!(self.qlog, trace::Event::PacketReceived {
+            ty: hdr.ty,
+            pkt_num: hdr.pkt_num,
+            offset: hdr.offset,
+            len: hdr.pkt_length,
+            priority: hdr.priority,
+        });
 
         let mut read:usize = 0;
 
+        if hdr.ty == packet::Type::Handshake{
+            self.compact_ack = self.local_compact_ack &&
+                hdr.priority & packet::HANDSHAKE_COMPACT_ACK != 0;
+            self.compact_header = self.local_compact_header &&
+                hdr.priority & packet::HANDSHAKE_COMPACT_HEADER != 0;
+            self.fec = self.local_fec &&
+                hdr.priority & packet::HANDSHAKE_FEC != 0;
+        }
+
         if hdr.ty == packet::Type::Handshake && self.is_server{
+            // Peers that don't probe report 0 and keep the base size.
+            if !self.pmtu_confirmed && hdr.offset != 0 {
+                let pmtu = cmp::min(hdr.offset, self.local_max_udp_payload_size as u64);
+                self.set_pmtu(cmp::max(pmtu as usize, MAX_SEND_UDP_PAYLOAD_SIZE))?;
+            }
             self.update_rtt();
             self.handshake_completed = true;
         }
         
         //If receiver receives a Handshake packet, it will be papred to send a Handshank.
         if hdr.ty == packet::Type::Handshake && !self.is_server{
+            // The first Handshake received is the largest probe that made it
+            // through. Base size payloads are always assumed to.
+            if !self.pmtu_confirmed {
+                let pmtu = if hdr.offset == 0 {
+                    MAX_SEND_UDP_PAYLOAD_SIZE
+                } else {
+                    cmp::min(cmp::max(len, MAX_SEND_UDP_PAYLOAD_SIZE), self.local_max_udp_payload_size)
+                };
+                self.set_pmtu(pmtu)?;
+            }
             self.handshake_confirmed = false;
             self.feed_back = true;
         }
         //receiver send back the sent info to sender
         if hdr.ty == packet::Type::ACK && self.is_server{
             //println!("{:?}",self.send_buffer.offset_index);
-            self.process_ack(buf);
+            self.on_ack_rtt_sample(hdr.pkt_num);
+            if self.compact_ack{
+                self.process_compact_ack(&mut buf[hdr_len..end])?;
+            }else{
+                self.process_ack(&buf[hdr_len..end])?;
+            }
             //self.update_rtt();
         }
 
+        if hdr.ty == packet::Type::Fec && self.fec{
+            self.fec_decoder.on_parity(hdr.priority, &mut buf[hdr_len..end], self.block_size)?;
+            self.fec_recover()?;
+        }
+
         if hdr.ty == packet::Type::ElictAck{
+            if self.fec{
+                self.fec_recover()?;
+            }
             self.recv_flag = true;
-            self.send_num = u64::from_be_bytes(buf[1..9].try_into().unwrap());
-            self.check_loss(&mut buf[26..]);
+            self.send_num = hdr.pkt_num;
+            if self.compact_ack{
+                self.check_loss_compact(&mut buf[hdr_len..end])?;
+            }else{
+                self.check_loss(&mut buf[hdr_len..end]);
+            }
             self.feed_back = true;
         }
 
         if hdr.ty == packet::Type::Application{
-            self.recv_count += 1;
             read = hdr.pkt_length as usize;
-            self.rec_buffer.write(&mut buf[26..],hdr.offset).unwrap();
+            if self.rec_buffer.is_placing() {
+                self.rec_buffer.place(&buf[hdr_len..], hdr.offset, hdr.priority)?;
+            } else {
+                self.rec_buffer.write(&mut buf[hdr_len..], hdr.offset, hdr.priority)?;
+            }
             // self.prioritydic.insert(hdr.offset, hdr.priority);
-            self.recv_dic.insert(hdr.offset, hdr.priority);
-            println!("offset: {:?}, length: {:?}", hdr.offset, hdr.pkt_length);
+            self.blocks.on_received(hdr.offset / self.block_size as u64, hdr.priority);
         }
 
         if hdr.ty == packet::Type::Stop{
             return Err(Error::Stopped);
         }
 
+        if hdr.ty == packet::Type::Fin{
+            let mut b = octets::Octets::with_slice(&buf[hdr_len..end]);
+
+            self.peer_error = Some(ConnectionError {
+                is_app: hdr.priority != 0,
+                error_code: b.get_u64()?,
+                reason: b.buf()[b.off()..].to_vec(),
+            });
+            self.closed = true;
+            self.recovery.stop_loss_detection_timer();
+        }
+
+        Ok(read)
+    }
+
+    /// Rebuilds the blocks the parity received allows to, and stores them as
+    /// if their data packet had been received.
+    fn fec_recover(&mut self) -> Result<()>{
+        let block_size = self.block_size;
+
+        loop {
+            let blocks = &self.blocks;
+            let rec_buffer = &self.rec_buffer;
+            let recovered = self.fec_decoder.recover(
+                |idx| blocks.is_received(idx),
+                |idx, len| rec_buffer.block_data(idx * block_size as u64, len),
+            );
+
+            let (priority, idx, data) = match recovered {
+                Some(v) => v,
+
+                None => return Ok(()),
+            };
+
+            let off = idx * block_size as u64;
+            if self.rec_buffer.is_placing() {
+                self.rec_buffer.place(data, off, priority)?;
+            } else {
+                self.rec_buffer.write(data, off, priority)?;
+            }
+            self.blocks.on_received(idx, priority);
+            self.fec_recovered += 1;
+        }
+    }
+
+    /// Processes a buffer of back to back datagrams of `segment_size` bytes,
+    /// as returned by a socket with the `UDP_GRO` option. The last datagram
+    /// may be shorter. A `segment_size` of 0 means `buf` is a single datagram.
+    ///
+    /// Returns the total number of payload bytes read. `Error::Stopped` is
+    /// returned as soon as a Stop packet is processed, other errors only
+    /// drop the datagram that caused them.
+    pub fn recv_segments(&mut self, buf: &mut [u8], segment_size: usize) -> Result<usize> {
+        let segment_size = if segment_size == 0 { buf.len() } else { segment_size };
+
+        if buf.is_empty() {
+            return Err(Error::BufferTooShort);
+        }
+
+        let mut read = 0;
+        for segment in buf.chunks_mut(segment_size) {
+            match self.recv_slice(segment) {
+                Ok(v) => read += v,
+
+                Err(Error::Stopped) => return Err(Error::Stopped),
+
+                Err(_) => (),
+            }
+        }
+
+        Ok(read)
+    }
+
+    /// Processes up to `lens.len()` buffers in one call, e.g. as filled by
+    /// `recvmmsg()`.
+    ///
+    /// Buffer `i` starts at `buf[i * stride..]` and holds `lens[i]` bytes of
+    /// back to back datagrams of `segment_sizes[i]` bytes each, see
+    /// [`recv_segments()`].
+    ///
+    /// [`recv_segments()`]: struct.Connection.html#method.recv_segments
+    pub fn recv_batch(
+        &mut self, buf: &mut [u8], stride: usize, lens: &[usize],
+        segment_sizes: &[usize],
+    ) -> Result<usize> {
+        if stride == 0 || buf.len() < stride {
+            return Err(Error::BufferTooShort);
+        }
+
+        let mut read = 0;
+        for ((b, len), seg) in buf.chunks_mut(stride).zip(lens).zip(segment_sizes) {
+            let len = cmp::min(*len, b.len());
+            if len == 0 {
+                continue;
+            }
+
+            read += self.recv_segments(&mut b[..len], *seg)?;
+        }
+
         Ok(read)
     }
 
@@ -583,49 +1480,121 @@ impl Connection {
         self.feed_back
     }
     
-    //Get unack offset. 
-    fn process_ack(&mut self, buf: &mut [u8]){
-        let unackbuf = &buf[26..];
-        let max_ack = u64::from_be_bytes(unackbuf[..8].try_into().unwrap());
+    /// Processes an ACK: the largest received offset, then an `(offset,
+    /// priority)` pair per reported block, the priority being 0 if the block
+    /// was received. A payload of any other length is rejected with
+    /// `Error::InvalidPacket`, before any block is applied.
+    fn process_ack(&mut self, unackbuf: &[u8]) -> Result<()>{
+        let len = unackbuf.len();
+        if len < 8 || (len - 8) % 16 != 0 {
+            return Err(Error::InvalidPacket);
+        }
+
+        let mut b = octets::Octets::with_slice(unackbuf);
+        let max_ack = b.get_u64()?;
         if max_ack > self.max_off{
             self.max_off = max_ack;
         }
-        let len = unackbuf.len();
-        let mut start = 8;
         let mut weights:f32 = 0.0;
-        // let mut b = octets::OctetsMut::with_slice(buf);
-        let mut _ack_set:u64 = 0 ;
-        while start < len{
-            let unack = u64::from_be_bytes(unackbuf[start..start+8].try_into().unwrap());
-            start += 8;
-            let mut priority = u64::from_be_bytes(unackbuf[start..start+8].try_into().unwrap());
-            if let Some(recviecd) = self.sent_dic.get(&unack){
-                if *recviecd == 0{
-                    self.send_buffer.ack_and_drop(unack);
-                }
-            }
-            if priority != 0{
-                priority = self.priority_calculation(unack) as u64;
-            }
-            start += 8;
-            if priority == 1{
-                weights += 0.15;
-            }else if priority == 2 {
-                weights += 0.2;
-            }else if priority == 3 {
-                weights += 0.25;
-            }else{
-                println!("offset: {:?}, received",unack);
-                self.send_buffer.ack_and_drop(unack);
+        let counters = (self.window_delivered, self.lost_bytes);
+        while b.cap() > 0{
+            let unack = b.get_u64()?;
+            let priority = b.get_u64()?;
+            weights += self.on_block_status(unack, priority != 0);
+        }
+
+        self.on_ack_processed(max_ack, (len - 8) / 16, weights, counters);
+        Ok(())
+    }
+
+    /// Processes a compact ACK: the largest received offset, the reported
+    /// blocks as ranges, then a bit-plane holding one bit per reported
+    /// block, set if the block was received.
+    fn process_compact_ack(&mut self, payload: &mut [u8]) -> Result<()>{
+        let mut blocks = std::mem::take(&mut self.ack_blocks);
+        blocks.clear();
+
+        let (max_ack, plane) = match decode_compact_ack(payload, &mut blocks) {
+            Ok(v) => v,
+
+            Err(e) => {
+                self.ack_blocks = blocks;
+                return Err(e);
+            },
+        };
+
+        if max_ack > self.max_off{
+            self.max_off = max_ack;
+        }
+
+        let mut weights:f32 = 0.0;
+        let counters = (self.window_delivered, self.lost_bytes);
+        for (i, idx) in blocks.iter().enumerate(){
+            let received = plane[i / 8] & (1 << (i % 8)) != 0;
+            weights += self.on_block_status(idx * self.block_size as u64, !received);
+        }
+
+        self.on_ack_processed(max_ack, blocks.len(), weights, counters);
+        self.ack_blocks = blocks;
+        Ok(())
+    }
+
+    /// Applies the status of a block reported by an ACK, and returns the
+    /// block's weight in the congestion window update.
+    fn on_block_status(&mut self, unack: u64, lost: bool) -> f32{
+        self.blocks.unreport(unack / self.block_size as u64);
+        // The weight follows the priority the block went out with, the
+        // per-level accounting the split of the whole iteration.
+        let real_priority = self.priority_calculation(unack);
+        let sent_priority = self.sent_priority(unack);
+        let priority = if lost { sent_priority } else { 0 };
+
+        let (block_len, acked) = self.send_buffer
+            .block(unack)
+            .map_or((self.block_size, true), |b| (b.len(), b.is_acked()));
+        let block_len = block_len as u64;
+        let level = priority_level(real_priority);
+
+        // A block is counted delivered once, and lost once per transmission,
+        // however many ACKs report it.
+        let first_loss = lost && !acked && self.send_buffer.on_lost(unack);
+
+        if !acked {
+            if !lost {
+                self.iteration_delivered[level] += block_len;
+                self.delivered_bytes[level] += block_len;
+                self.window_delivered += block_len;
+            } else if self.blocks.is_exhausted(unack / self.block_size as u64) {
+                self.given_up_bytes[level] += self.send_buffer.give_up_block(unack) as u64;
             }
-            let real_priority = self.priority_calculation(unack);
-            println!("offset: {:?}, priority: {:?}",unack,priority);
-            println!("offset: {:?}, real priority: {:?}",unack,self.priority_calculation(unack));
-            if priority != 0 && real_priority == 3{
+        }
+
+        if first_loss {
+            self.lost_count += 1;
+            self.lost_bytes += block_len;
+            self.priority_lost_bytes[level] += block_len;
+
+            if sent_priority == 3 {
                 self.high_priority += 1;
             }
         }
 
+        if priority == 1{
+            0.15
+        }else if priority == 2 {
+            0.2
+        }else if priority == 3 {
+            0.25
+        }else{
+            self.send_buffer.ack_and_drop(unack);
+            0.0
+        }
+    }
+
+    /// Updates the congestion window once all blocks of an ACK have been
+    /// processed. `counters` holds the delivered and lost byte counters from
+    /// before the ACK.
+    fn on_ack_processed(&mut self, max_ack: u64, blocks: usize, weights: f32, counters: (u64, u64)){
         ///////////////////////////////////////////////////////////////////////
         // update congestion window size
         /////////////////////////////////////////////////////////////
@@ -638,12 +1607,230 @@ impl Connection {
         //     self.recovery.update_app_limited(b);
         // }
         // self.recovery.update_app_window(weights);
-        self.recovery.update_win(weights, (len/(8*2)) as f64);
-        
+        let acked = recovery::Acked {
+            weights,
+            blocks,
+            delivered: (self.window_delivered - counters.0) as usize,
+            lost: (self.lost_bytes - counters.1) as usize,
+            time: Instant::now(),
+        };
+        self.recovery.on_ack_received(&acked, self.blocks.reported_len() > 0);
+        self.apply_reliability_policy();
+
+        let elapsed = self.window_start.elapsed().as_secs_f64();
+        if elapsed > 0.0 {
+            self.delivery_rate = (self.window_delivered as f64 / elapsed) as u64;
+        }
+
+        qlog_event!(self.qlog, trace::Event::AckProcessed {
+            max_ack,
+            blocks,
+            weights,
+        });
+    }
+
+    /// Gives up on the blocks left of every priority level that met its loss
+    /// target. Targets are checked once all data of the iteration has been
+    /// buffered, as only then the bytes of each level are known.
+    fn apply_reliability_policy(&mut self){
+        let iteration_bytes = match self.iteration_bytes() {
+            Some(v) => v,
+
+            None => return,
+        };
+
+        for level in 0..PRIORITY_LEVELS {
+            if self.level_met[level] {
+                continue;
+            }
+
+            let loss = self.reliability_policy.acceptable_loss[level].clamp(0.0, 1.0);
+            let target = (iteration_bytes[level] as f64 * (1.0 - loss)).ceil() as u64;
+            if self.iteration_delivered[level] < target {
+                continue;
+            }
+
+            self.level_met[level] = true;
+
+            let norm2_vec = &self.norm2_vec;
+            let (low, high) = (self.low_split_point, self.high_split_point);
+            let priority = level as u8 + 1;
+
+            let given_up = self.send_buffer.give_up(|idx| {
+                block_priority(norm2_vec, idx, low, high) == priority
+            });
+            self.given_up_bytes[level] += given_up as u64;
+        }
+    }
+
+    /// Returns the bytes of the current iteration per priority level, once
+    /// all of them have been buffered.
+    fn iteration_bytes(&mut self) -> Option<[u64; PRIORITY_LEVELS]>{
+        if self.iteration_bytes.is_none() &&
+            self.data_finished &&
+            self.written_data >= self.send_data.len()
+        {
+            let mut bytes = [0; PRIORITY_LEVELS];
+            let len = self.send_data.len();
+
+            for (i, norm2) in self.norm2_vec.iter().enumerate() {
+                let block_len = cmp::min(self.block_size, len.saturating_sub(i * self.block_size));
+                let priority = norm2_priority(*norm2, self.low_split_point, self.high_split_point);
+                bytes[priority_level(priority)] += block_len as u64;
+            }
+
+            self.iteration_bytes = Some(bytes);
+        }
+
+        self.iteration_bytes
+    }
+
+    /// Writes a compact ACK payload into `out`, and returns its length.
+    ///
+    /// The blocks reported by the last ElictAck are sent as ranges, followed
+    /// by a bit-plane marking which of them were received. The sender knows
+    /// the priority of every block it sent, so no priority is sent back.
+    fn write_compact_ack(&mut self, out: &mut [u8]) -> Result<usize>{
+        let mut blocks = std::mem::take(&mut self.ack_blocks);
+        self.blocks.take_reported(&mut blocks);
+
+        let res = encode_compact_ack(out, self.max_ack(), &blocks, &self.blocks);
+
+        self.ack_blocks = blocks;
+        res
+    }
+
+    /// Writes a compact ElictAck payload into `out`, listing the blocks sent
+    /// since the last ElictAck as ranges, and returns its length.
+    fn write_compact_elict_ack(&mut self, out: &mut [u8]) -> Result<usize>{
+        let mut blocks = std::mem::take(&mut self.ack_blocks);
+        blocks.clear();
+        blocks.extend(self.sent_pkt[self.ack_point..].iter().map(|off| off / self.block_size as u64));
+        blocks.sort_unstable();
+        blocks.dedup();
+
+        for idx in blocks.iter() {
+            self.blocks.report(*idx);
+        }
+
+        let mut b = octets::OctetsMut::with_slice(out);
+        let res = packet::encode_block_ranges(&mut b, &blocks).map(|_| b.off());
+
+        self.ack_blocks = blocks;
+        res
+    }
+
+    /// Returns the size of the next Handshake sent by the server.
+    ///
+    /// Handshakes are padded to probe the path for the largest payload,
+    /// starting from the configured maximum. Every Handshake the client
+    /// hasn't answered yet carries a quarter fewer blocks than the previous
+    /// one, down to the base payload size, which every path is assumed to
+    /// carry and isn't probed. The client reports the largest Handshake it
+    /// received.
+    fn next_pmtu_probe(&mut self) -> usize{
+        let size = self.pmtu_probe_blocks * SEND_BUFFER_SIZE +
+            block_overhead(self.local_fec);
+        if self.pmtu_confirmed || size <= MAX_SEND_UDP_PAYLOAD_SIZE{
+            return HEADER_LENGTH;
+        }
+
+        self.pmtu_probe_blocks -= cmp::max(self.pmtu_probe_blocks / 4, 1);
+        size
+    }
+
+    /// Sets the payload size of data packets to `pmtu`, and the block size
+    /// to the one that fits in it.
+    ///
+    /// It is called once the handshake confirms the size, before any data
+    /// is sent, so data already buffered is simply split again. Returns
+    /// `Error::InvalidState` if data was received already, or if no valid
+    /// block size fits in `pmtu`.
+    fn set_pmtu(&mut self, pmtu: usize) -> Result<()>{
+        let block_size = block_size_for(pmtu, self.fec);
+        if block_size == self.block_size{
+            self.pmtu = pmtu;
+            self.pmtu_confirmed = true;
+            return Ok(());
+        }
+
+        // The receive buffer goes first, as it may refuse while the send
+        // buffer is emptied anyway.
+        self.rec_buffer.set_block_size(block_size)?;
+        self.send_buffer.clear();
+        self.send_buffer.set_block_size(block_size)?;
+
+        self.pmtu = pmtu;
+        self.pmtu_confirmed = true;
+        self.block_size = block_size;
+        self.recovery.set_max_datagram_size(block_size);
+        self.reset_blocks();
+        self.written_data = 0;
+        self.total_offset = 0;
+
+        if !self.norm2_vec.is_empty(){
+            self.update_norms();
+        }
+
+        Ok(())
+    }
+
+    /// Clears the state of the blocks, including the stripes they are part
+    /// of, for a new iteration.
+    fn reset_blocks(&mut self){
+        self.blocks.reset();
+        self.fec_encoder.reset();
+        self.fec_decoder.reset();
+        self.iteration_bytes = None;
+        self.iteration_delivered = [0; PRIORITY_LEVELS];
+        self.level_met = [false; PRIORITY_LEVELS];
+    }
+
+    /// Returns the flags sent in the `priority` field of Handshake packets.
+    fn handshake_flags(&self) -> u8{
+        let mut flags = 0;
+        if self.local_compact_ack{
+            flags |= packet::HANDSHAKE_COMPACT_ACK;
+        }
+        if self.local_compact_header{
+            flags |= packet::HANDSHAKE_COMPACT_HEADER;
+        }
+        if self.local_fec{
+            flags |= packet::HANDSHAKE_FEC;
+        }
+        flags
+    }
+
+    /// Returns the number of bytes the block index takes in a compact
+    /// header. It is sized for the largest block of the send buffer, so
+    /// that the header length of a data packet is known before the block
+    /// is picked.
+    fn block_index_len(&self) -> usize{
+        octets::varint_len(self.send_buffer.block_count() as u64)
+    }
+
+    /// Returns the length of the header of packet `pkt_num`, in the
+    /// negotiated format.
+    fn header_len(&self, pkt_num: u64) -> usize{
+        if self.compact_header{
+            packet::compact_header_len(pkt_num, self.block_index_len())
+        }else{
+            HEADER_LENGTH
+        }
+    }
+
+    /// Writes `hdr` at the start of `out`, in the negotiated format.
+    fn write_header(&self, hdr: &Header, out: &mut [u8]) -> Result<()>{
+        let mut b = octets::OctetsMut::with_slice(out);
+        if self.compact_header{
+            hdr.to_bytes_compact(&mut b, self.block_index_len(), self.block_size)
+        }else{
+            hdr.to_bytes(&mut b)
+        }
     }
 
     pub fn findweight(&mut self, unack:&u64)->u8{
-        *self.prioritydic.get(unack).unwrap()
+        self.blocks.priority(unack / self.block_size as u64).unwrap_or(0)
     }
 
     //pub fn send_all(&mut self, data: &mut [u8]) -> Result<bool> {
@@ -675,7 +1862,6 @@ impl Connection {
         /*if self.send_buffer.recv_index.len() != 0{
             self.send_buffer.recv_and_drop();
         }*/
-        println!("+++++++++++++++++++++++++++++++++++++++++++++++++++++");
         /*for da in self.send_buffer.data.iter(){
             println!("data in buffer: {:?}",da.off);
         }
@@ -683,12 +1869,11 @@ impl Connection {
         for (key, val) in self.send_buffer.offset_index.iter(){
             println!("key: {:?}, val: {:?}",key,val);
         }*/
-        println!("data len: {:?}",self.send_buffer.data.len());
 
         self.set_handshake();
 
         //if self.send_data.len() > self.written_data || !self.send_buffer.is_empty(){
-        if self.send_data.len() > self.written_data{
+        if self.sendable_len() > self.written_data{
             let write = self.write();
             self.written_data += write.unwrap();
             self.total_offset += write.unwrap() as u64;
@@ -702,7 +1887,7 @@ impl Connection {
             println!("data len: {:?}",self.send_buffer.data.len());*/
             Ok(true)
         }else {
-            if self.send_buffer.data.is_empty(){
+            if self.send_buffer.is_empty(){
                 Ok(false)
             }else{
             let write = self.write();
@@ -733,29 +1918,55 @@ impl Connection {
 
         let ty = self.write_pkt_type()?; 
 
-        let info = SendInfo {
+        let now = Instant::now();
+
+        let mut info = SendInfo {
             from: self.localaddr,
             to: self.peeraddr,
+            at: now,
         };
+
+        if ty == packet::Type::Fin{
+            let len = self.write_close(&mut out[.._left])?;
+
+            qlog_event!(self.qlog, trace::Event::PacketSent {
+                ty,
+                pkt_num: 0,
+                offset: 0,
+                len: (len - self.header_len(0)) as u64,
+                priority: 0,
+            });
+
+            self.closed = true;
+            self.on_packet_sent(len);
+            return Ok((len, info));
+        }
+
         if ty == packet::Type::Handshake && self.server{
+            // The offset advertises the largest payload the server sends,
+            // the padding probes the path.
+            let probe = cmp::max(cmp::min(self.next_pmtu_probe(), out.len()), HEADER_LENGTH);
+            psize = (probe - HEADER_LENGTH) as u64;
             let hdr = Header {
                 ty,
                 pkt_num: pn,
-                offset: offset,
-                priority: priority,
+                offset: self.local_max_udp_payload_size as u64,
+                priority: self.handshake_flags(),
                 pkt_length: psize,
             };
             let mut b = octets::OctetsMut::with_slice(out);
             hdr.to_bytes(&mut b)?;
+            out[HEADER_LENGTH..probe].fill(0);
             self.set_handshake();
         }
 
         if ty == packet::Type::Handshake && !self.server{
+            // The offset reports the payload size confirmed by the probes.
             let hdr = Header {
                 ty,
                 pkt_num: pn,
-                offset: offset,
-                priority: priority,
+                offset: self.pmtu as u64,
+                priority: self.handshake_flags(),
                 pkt_length: psize,
             };
             let mut b = octets::OctetsMut::with_slice(out);
@@ -764,10 +1975,21 @@ impl Connection {
         }
     
         //send the received packet condtion
-        if ty == packet::Type::ACK{
+        if ty == packet::Type::ACK && self.compact_ack{
             self.feed_back = false;
-            let mut b = octets::OctetsMut::with_slice(out);
-            psize = (self.recv_hashmap.len()*8*2 + 8) as u64;
+            total_len = self.header_len(self.send_num);
+            psize = self.write_compact_ack(&mut out[total_len..])? as u64;
+            let hdr = Header {
+                ty,
+                pkt_num: self.send_num,
+                offset: 0,
+                priority: 0,
+                pkt_length: psize,
+            };
+            self.write_header(&hdr, out)?;
+        }else if ty == packet::Type::ACK{
+            self.feed_back = false;
+            psize = (self.blocks.reported_len()*8*2 + 8) as u64;
             let hdr = Header {
                 ty,
                 pkt_num: self.send_num,
@@ -776,19 +1998,21 @@ impl Connection {
                 pkt_length: psize,
             };
             // offset = 8*16;
-            hdr.to_bytes(&mut b)?;
-            println!("ACk num: {:?}", self.send_num);
+            self.write_header(&hdr, out)?;
+            total_len = self.header_len(self.send_num);
+            let mut b = octets::OctetsMut::with_slice(&mut out[total_len..]);
             let max_off = self.max_ack();
             b.put_u64(max_off)?;
 
             // pkt_length may not be 8
-            for (key, val) in self.recv_hashmap.iter() {
+            let mut blocks = std::mem::take(&mut self.ack_blocks);
+            self.blocks.take_reported(&mut blocks);
+            for idx in blocks.iter() {
                 // let mut retrans = self.
-                b.put_u64(*key)?;
-                b.put_u64(*val)?;
+                b.put_u64(idx * self.block_size as u64)?;
+                b.put_u64(!self.blocks.is_received(*idx) as u64)?;
             }
-
-            self.recv_hashmap.clear();
+            self.ack_blocks = blocks;
 
         }
 
@@ -796,14 +2020,28 @@ impl Connection {
         if ty == packet::Type::ElictAck{
             pn =  self.pkt_num_spaces[1].next_pkt_num;
             self.pkt_num_spaces[1].next_pkt_num += 1;
-            println!("ElickAck num: {:?}", pn);
             // let ElictAck_time: Instant = Instant::now();
-            let mut b = octets::OctetsMut::with_slice(out);
-            if self.stop_flag == true{
+            total_len = self.header_len(pn);
+            if self.compact_ack{
+                psize = self.write_compact_elict_ack(&mut out[total_len..])? as u64;
+                let hdr = Header{
+                    ty,
+                    pkt_num: pn,
+                    offset: offset,
+                    priority: priority,
+                    pkt_length: psize,
+                };
+                self.write_header(&hdr, out)?;
+                self.sent_pkt.clear();
+                self.ack_point = self.sent_pkt.len();
+                if self.stop_flag{
+                    self.stop_ack = true;
+                }
+            }
+            else if self.stop_flag == true{
                 //When send_buf send out all data
                 // let pkt_counter = self.sent_pkt.len() - self.sent_pkt.len()%8;
                 // let res = &self.sent_pkt[pkt_counter..];
-                let res = &self.sent_pkt[self.ack_point..];
                 let pkt_counter = self.sent_pkt.len() - self.ack_point;
                 let hdr = Header{
                     ty,
@@ -812,35 +2050,68 @@ impl Connection {
                     priority: priority,
                     pkt_length: (pkt_counter*8) as u64,
                 };
-                hdr.to_bytes(&mut b).unwrap();
+                self.write_header(&hdr, out)?;
+                let res = &self.sent_pkt[self.ack_point..];
+                let mut b = octets::OctetsMut::with_slice(&mut out[total_len..]);
                 for i in 0..res.len() as usize{
                     b.put_u64(res[i])?;
-                    println!("ElictAck: {:?}",res[i]);
+                    self.blocks.report(res[i] / self.block_size as u64);
                 }
                 psize = (pkt_counter*8) as u64;
+                // Reuse the list's storage for the next ElictAck.
+                self.sent_pkt.clear();
                 self.ack_point = self.sent_pkt.len();
                 self.stop_ack = true;
             }
             else{
                 //normally, every 8 pakcets will send a ElictAck packet.
                 // let res = &self.sent_pkt[(self.sent_pkt.len()-self.sent_pkt.len()%8)..];
-                let res = &self.sent_pkt[self.ack_point..];
+                // A probe can list more or fewer than 8 blocks.
+                let pkt_counter = self.sent_pkt.len() - self.ack_point;
                 let hdr = Header{
                     ty,
                     pkt_num: pn,
                     offset: offset,
                     priority: priority,
-                    pkt_length: 64,
+                    pkt_length: (pkt_counter*8) as u64,
                 };
-                hdr.to_bytes(&mut b).unwrap();
+                self.write_header(&hdr, out)?;
+                let res = &self.sent_pkt[self.ack_point..];
+                let mut b = octets::OctetsMut::with_slice(&mut out[total_len..]);
                 for i in 0..res.len() as usize{
                     b.put_u64(res[i])?;
-                    println!("ElictAck: {:?}",res[i]);
+                    self.blocks.report(res[i] / self.block_size as u64);
                 }
+                self.sent_pkt.clear();
                 self.ack_point = self.sent_pkt.len();
-                psize = 64;
+                psize = (pkt_counter*8) as u64;
             }
             total_len += psize as usize;
+
+            self.recovery.on_elicit_sent(now);
+            self.elicit_probe = false;
+
+            // As in QUIC, the first ack-eliciting packet since the last one
+            // received restarts the idle timer, so that a sender does not
+            // time out while the receiver has nothing to say.
+            if !self.ack_eliciting_sent {
+                self.idle_timer = self.idle_timeout.map(|t| now + t);
+                self.ack_eliciting_sent = true;
+            }
+
+            qlog_event!(self.qlog, trace::Event::PacketSent {
+                ty,
+                pkt_num: pn,
+                offset: 0,
+                len: psize,
+                priority: 0,
+            });
+
+            // Paced like data packets, so it can't overtake the packets it
+            // asks about.
+            info.at = self.recovery.on_packet_sent(total_len, now);
+            self.elicit_sent[(pn % ELICIT_HISTORY as u64) as usize] = Some((pn, info.at));
+            self.on_packet_sent(total_len);
             return Ok((total_len, info))
         }
 
@@ -869,23 +2140,43 @@ impl Connection {
                 
         // }
         
+        if ty == packet::Type::Fec{
+            pn = self.pkt_num_spaces[0].next_pkt_num;
+            total_len = self.header_len(pn);
+            let payload = out.get_mut(total_len.._left).ok_or(Error::BufferTooShort)?;
+            let (fec_priority, len) = self.fec_encoder.emit(payload)?;
+            self.pkt_num_spaces[0].next_pkt_num += 1;
+            priority = fec_priority;
+            psize = len as u64;
+            let hdr = Header {
+                ty,
+                pkt_num: pn,
+                offset: 0,
+                priority,
+                pkt_length: psize,
+            };
+            self.write_header(&hdr, out)?;
+            self.fec_sent += 1;
+        }
+
         if ty == packet::Type::Application{
-            if let Ok((result_len, off, stop)) = self.send_buffer.emit(&mut out[26..]){
+            let hdr_len = self.header_len(self.pkt_num_spaces[0].next_pkt_num);
+            if let Ok((result_len, off, stop)) = self.send_buffer.emit(&mut out[hdr_len..], &self.send_data){
                 if off >= self.written_data.try_into().unwrap(){
                     return Err(Error::Done);
                 }            
                 self.sent_count += 1;
                 self.sent_number += 1;
-                let mut b = octets::OctetsMut::with_slice(&mut out[done..]);
+                if self.send_buffer.block(off).map_or(false, |b| b.sent_count() > 1) {
+                    self.retrans_count += 1;
+                    self.retrans_bytes += result_len as u64;
+                }
                 pn = self.pkt_num_spaces[0].next_pkt_num;
-                println!("Application off: {:?}",off); 
-                priority = self.priority_calculation(off);
+                priority = self.sent_priority(off);
+                self.send_buffer.set_priority(off, priority);
                 self.pkt_num_spaces[0].next_pkt_num += 1;
-                if let Some(x) = self.sent_dic.get_mut(&off) {
-                    *x -= 1;
-                }else {
-                    self.sent_dic.insert(off, priority as u64);
-                }
+                let budget = self.reliability_policy.retransmit_budget[priority_level(priority)];
+                self.blocks.on_sent(off / self.block_size as u64, priority, budget);
                 let hdr = Header {
                     ty,
                     pkt_num: pn,
@@ -895,7 +2186,20 @@ impl Connection {
                 };
                 offset = result_len as u64;
                 psize = result_len as u64;
-                hdr.to_bytes(&mut b)?;
+                self.write_header(&hdr, &mut out[done..])?;
+                total_len = hdr_len;
+                if self.fec{
+                    let data = &out[hdr_len..hdr_len + result_len];
+                    self.fec_encoder.on_sent(off / self.block_size as u64, priority, data);
+                }
+
+                qlog_event!(self.qlog, trace::Event::PacketSent {
+                    ty,
+                    pkt_num: pn,
+                    offset: off,
+                    len: psize,
+                    priority,
+                });
 
                 //Recording offset of each data.
                 // self.total_offset = std::cmp::max(off, self.total_offset);
@@ -908,8 +2212,17 @@ impl Connection {
             }
         }  
 
+        if ty != packet::Type::Application {
+            qlog_event!(self.qlog, trace::Event::PacketSent {
+                ty,
+                pkt_num: if ty == packet::Type::ACK { self.send_num } else { pn },
+                offset: 0,
+                len: psize,
+                priority,
+            });
+        }
+
         if ty == packet::Type::Stop{
-            let mut b = octets::OctetsMut::with_slice(out);
             let hdr = Header{
                 ty,
                 pkt_num: pn,
@@ -918,10 +2231,12 @@ impl Connection {
                 pkt_length: psize,
             };
 
-            hdr.to_bytes(&mut b)?;
+            self.write_header(&hdr, out)?;
+            total_len = self.header_len(pn);
             
             // total_len += offset as usize;
             total_len += psize as usize;
+            self.on_packet_sent(total_len);
             return Ok((total_len, info));
         }
 
@@ -934,27 +2249,382 @@ impl Connection {
 
         // total_len += offset as usize;
         total_len += psize as usize;
+
+        if ty == packet::Type::Application || ty == packet::Type::Fec {
+            info.at = self.recovery.on_packet_sent(total_len, now);
+        }
+
+        self.on_packet_sent(total_len);
+
         Ok((total_len, info))
     }
 
+    /// Updates the send counters for a packet of `len` bytes.
+    #[inline]
+    fn on_packet_sent(&mut self, len: usize) {
+        self.sent_pkts += 1;
+        self.sent_bytes += len as u64;
+    }
+
+    /// Writes a Fin packet carrying the error of `close()`: the error code,
+    /// then as much of the reason phrase as fits. Whether the error comes
+    /// from the application is carried in the priority field.
+    fn write_close(&mut self, out: &mut [u8]) -> Result<usize> {
+        let hdr_len = self.header_len(0);
+
+        let err = match self.local_error.as_ref() {
+            Some(v) => v,
+
+            None => return Err(Error::InvalidState),
+        };
+
+        let reason = cmp::min(
+            err.reason.len(),
+            out.len().saturating_sub(hdr_len + 8),
+        );
+
+        let hdr = Header {
+            ty: packet::Type::Fin,
+            pkt_num: 0,
+            offset: 0,
+            priority: err.is_app as u8,
+            pkt_length: (8 + reason) as u64,
+        };
+
+        self.write_header(&hdr, out)?;
+
+        let mut b = octets::OctetsMut::with_slice(&mut out[hdr_len..]);
+        b.put_u64(err.error_code)?;
+        b.put_bytes(&err.reason[..reason])?;
+
+        Ok(hdr_len + b.off())
+    }
+
+
+    /// Writes up to `lens.len()` packets into `out` in one call.
+    ///
+    /// Packet `i` is written at `out[i * stride..]`, its length is stored in
+    /// `lens[i]` and its pacing time in `at[i]`, so the result can be handed
+    /// to `sendmmsg()` directly. All packets of a connection share the same
+    /// addresses, which are returned once, with the pacing time of the first
+    /// packet.
+    ///
+    /// On success the number of packets written is returned. If no packet
+    /// could be written the error of the first [`send_data()`] call is
+    /// returned, e.g. `Error::Done`.
+    ///
+    /// [`send_data()`]: struct.Connection.html#method.send_data
+    pub fn send_batch(
+        &mut self, out: &mut [u8], stride: usize, lens: &mut [usize],
+        at: &mut [Instant],
+    ) -> Result<(usize, SendInfo)> {
+        if stride == 0 || out.len() < stride {
+            return Err(Error::BufferTooShort);
+        }
+
+        let mut info = SendInfo {
+            from: self.localaddr,
+            to: self.peeraddr,
+            at: Instant::now(),
+        };
+
+        let mut count = 0;
+        let pkts = lens.iter_mut().zip(at.iter_mut());
+        for (buf, (len, at)) in out.chunks_exact_mut(stride).zip(pkts) {
+            match self.send_data(buf) {
+                Ok((written, i)) => {
+                    if count == 0 {
+                        info.at = i.at;
+                    }
+
+                    *len = written;
+                    *at = i.at;
+                    count += 1;
+                },
+
+                Err(e) if count == 0 => return Err(e),
+
+                Err(_) => break,
+            }
+        }
+
+        Ok((count, info))
+    }
+
+    /// Returns the segment size to use with [`send_segments()`], which is the
+    /// size of a full data packet.
+    ///
+    /// [`send_segments()`]: struct.Connection.html#method.send_segments
+    pub fn segment_size(&self) -> usize {
+        self.header_len(self.pkt_num_spaces[0].next_pkt_num) + self.block_size
+    }
+
+    /// Writes consecutive packets back to back into `out`, for a single
+    /// `sendmsg()` with the `UDP_SEGMENT` option.
+    ///
+    /// Every packet but the last one is exactly `segment_size` bytes long, as
+    /// required by UDP GSO. The buffer ends with the first shorter packet
+    /// (e.g. an ElictAck at the end of a window), after `MAX_GSO_SEGMENTS`
+    /// packets, when `out` is full, or when the next packet is paced more
+    /// than `PACING_GRANULARITY` after the first one. The whole buffer is
+    /// sent at the pacing time of the first packet.
+    ///
+    /// Fec packets are longer than `segment_size`, so the buffer also ends
+    /// before one, and one is always returned on its own.
+    ///
+    /// On success the total number of bytes written is returned, along with
+    /// the segment size to send the buffer with, which is the length of its
+    /// first packet: `segment_size`, or less for a buffer of a single short
+    /// packet, or more for a single Fec packet. If no packet could be
+    /// written the error of the first [`send_data()`] call is returned, e.g.
+    /// `Error::Done`.
+    ///
+    /// [`send_data()`]: struct.Connection.html#method.send_data
+    pub fn send_segments(
+        &mut self, out: &mut [u8], segment_size: usize,
+    ) -> Result<(usize, usize, SendInfo)> {
+        if segment_size == 0 || out.len() < segment_size {
+            return Err(Error::BufferTooShort);
+        }
+
+        let mut info = SendInfo {
+            from: self.localaddr,
+            to: self.peeraddr,
+            at: Instant::now(),
+        };
+
+        if self.fec_pending() {
+            let (written, info) = self.send_data(out)?;
+
+            return Ok((written, written, info));
+        }
+
+        let mut total = 0;
+        let mut first = 0;
+        for buf in out.chunks_exact_mut(segment_size).take(MAX_GSO_SEGMENTS) {
+            if total > 0 &&
+                (self.recovery.next_pacing_time() > info.at + PACING_GRANULARITY ||
+                    self.fec_pending())
+            {
+                break;
+            }
+
+            match self.send_data(buf) {
+                Ok((written, i)) => {
+                    if total == 0 {
+                        info.at = i.at;
+                        first = written;
+                    }
+
+                    total += written;
+
+                    if written < segment_size {
+                        break;
+                    }
+                },
+
+                Err(e) if total == 0 => return Err(e),
+
+                Err(_) => break,
+            }
+        }
+
+        Ok((total, first, info))
+    }
+
+    pub fn is_stopped(&self)->bool{
+        self.stop_flag && self.stop_ack
+    }
+
+    //Start updating congestion control window and sending new data.
+    pub fn is_ack(&self)->bool{
+        let now = Instant::now();
+        let interval = now.duration_since(self.handshake);
+        if interval > self.rtt{
+            return true;
+        }
+        false
+    }
+
+    pub fn read(&mut self, out:&mut [u8]) -> Result<usize>{
+        self.rec_buffer.emit(out)
+
+    }
+
+    /// Registers `buf` as the destination of the data received from now on.
+    ///
+    /// Each data packet is copied once, straight to `buf[offset..]`, instead
+    /// of being queued for [`read()`], which returns `Done` while a buffer is
+    /// registered. Bytes of blocks that never arrive are left untouched.
+    /// Packets that don't fit in `buf` are dropped with `BufferTooShort`.
+    ///
+    /// The buffer is handed back by [`take_recv_buffer()`].
+    ///
+    /// [`read()`]: struct.Connection.html#method.read
+    /// [`take_recv_buffer()`]: struct.Connection.html#method.take_recv_buffer
+    pub fn recv_into(&mut self, buf: Vec<u8>) {
+        self.rec_buffer.set_placement(RecvData::Owned(buf));
+        self.reset_blocks();
+    }
+
+    /// Same as [`recv_into()`], but borrows `buf` instead of taking
+    /// ownership.
+    ///
+    /// # Safety
+    ///
+    /// `buf` must stay valid, and must not be accessed by the application
+    /// while packets are being received, until [`take_recv_buffer()`] is
+    /// called or another buffer is registered.
+    ///
+    /// [`recv_into()`]: struct.Connection.html#method.recv_into
+    /// [`take_recv_buffer()`]: struct.Connection.html#method.take_recv_buffer
+    pub unsafe fn recv_into_borrowed(&mut self, buf: &mut [u8]) {
+        let buf = RawBuf::new(buf.as_mut_ptr(), buf.len());
+        self.rec_buffer.set_placement(RecvData::Borrowed(buf));
+        self.reset_blocks();
+    }
+
+    /// Unregisters the buffer set by [`recv_into()`] or
+    /// [`recv_into_borrowed()`], and returns it if it is owned.
+    ///
+    /// [`recv_into()`]: struct.Connection.html#method.recv_into
+    /// [`recv_into_borrowed()`]: struct.Connection.html#method.recv_into_borrowed
+    pub fn take_recv_buffer(&mut self) -> Option<Vec<u8>> {
+        match self.rec_buffer.take_placement() {
+            Some(RecvData::Owned(v)) => Some(v),
+
+            _ => None,
+        }
+    }
+
+    /// Returns the received-block bitmap: bit `i % 64` of word `i / 64` is
+    /// set once block `i`, the [`block_size()`] bytes at offset
+    /// `i * block_size()`, has arrived.
+    ///
+    /// The bitmap is reset when a buffer is registered with
+    /// [`recv_into()`], or by [`reset_received_blocks()`], so it can be used
+    /// to impute the blocks missing from an iteration, e.g. with the
+    /// previous iteration's values.
+    ///
+    /// [`block_size()`]: struct.Connection.html#method.block_size
+    /// [`recv_into()`]: struct.Connection.html#method.recv_into
+    /// [`reset_received_blocks()`]: struct.Connection.html#method.reset_received_blocks
+    pub fn received_blocks(&self) -> &[u64] {
+        self.rec_buffer.received()
+    }
+
+    /// Forgets the blocks received so far, for a new iteration read with
+    /// [`read()`]: [`received_blocks()`], [`is_block_received()`],
+    /// [`block_priority()`], [`is_iteration_complete()`] and FEC recovery
+    /// then only account for the blocks received from now on.
+    ///
+    /// Data already buffered is kept for [`read()`]. Registering a buffer
+    /// with [`recv_into()`] does the same.
+    ///
+    /// [`read()`]: struct.Connection.html#method.read
+    /// [`received_blocks()`]: struct.Connection.html#method.received_blocks
+    /// [`is_block_received()`]: struct.Connection.html#method.is_block_received
+    /// [`block_priority()`]: struct.Connection.html#method.block_priority
+    /// [`is_iteration_complete()`]: struct.Connection.html#method.is_iteration_complete
+    /// [`recv_into()`]: struct.Connection.html#method.recv_into
+    pub fn reset_received_blocks(&mut self) {
+        self.rec_buffer.clear_received();
+        self.reset_blocks();
+    }
+
+    /// Returns true if the block at index `idx` has been received.
+    pub fn is_block_received(&self, idx: usize) -> bool {
+        self.rec_buffer.is_received((idx * self.block_size) as u64)
+    }
+
+    /// Returns the priority the sender gave the block at index `idx`, if it
+    /// has been received.
+    pub fn block_priority(&self, idx: usize) -> Option<u8> {
+        if self.blocks.is_received(idx as u64) {
+            self.blocks.priority(idx as u64)
+        } else {
+            None
+        }
+    }
+
+    /// Sets when the current iteration is considered complete, see
+    /// [`is_iteration_complete()`].
+    ///
+    /// The fraction of high priority blocks is computed against the size of
+    /// the buffer registered with [`recv_into()`]; without one only the
+    /// deadline applies.
+    ///
+    /// [`is_iteration_complete()`]: struct.Connection.html#method.is_iteration_complete
+    /// [`recv_into()`]: struct.Connection.html#method.recv_into
+    pub fn set_iteration_policy(&mut self, policy: IterationPolicy) {
+        self.iteration_policy = policy;
+    }
+
+    /// Sets how many times blocks of each priority level are retransmitted,
+    /// and the fraction of their bytes that can be lost, see
+    /// [`is_send_complete()`].
+    ///
+    /// Applies to the blocks sent from now on.
+    ///
+    /// [`is_send_complete()`]: struct.Connection.html#method.is_send_complete
+    pub fn set_reliability_policy(&mut self, policy: ReliabilityPolicy) {
+        self.reliability_policy = policy;
+    }
+
+    /// Returns true once every priority level of the current iteration met
+    /// the reliability policy: enough of its bytes have been delivered and
+    /// the sender gave up on the rest.
+    ///
+    /// A level whose blocks run out of retransmit budget can miss its target,
+    /// in which case [`send_all()`] returns false with the iteration
+    /// incomplete.
+    ///
+    /// [`send_all()`]: struct.Connection.html#method.send_all
+    pub fn is_send_complete(&self) -> bool {
+        self.iteration_bytes.is_some() && self.level_met.iter().all(|met| *met)
+    }
+
+    /// Returns true once the receiver can stop waiting for the current
+    /// iteration: every block has arrived, the deadline has passed, or
+    /// enough high priority blocks have arrived.
+    ///
+    /// The missing blocks can then be found with [`received_blocks()`].
+    ///
+    /// [`received_blocks()`]: struct.Connection.html#method.received_blocks
+    pub fn is_iteration_complete(&self) -> bool {
+        if let Some(deadline) = self.iteration_policy.deadline {
+            if Instant::now() >= deadline {
+                return true;
+            }
+        }
+
+        let total = match self.rec_buffer.expected_blocks() {
+            Some(v) if v > 0 => v,
 
-    pub fn is_stopped(&self)->bool{
-        self.stop_flag && self.stop_ack
-    }
+            _ => return false,
+        };
 
-    //Start updating congestion control window and sending new data.
-    pub fn is_ack(&self)->bool{
-        let now = Instant::now();
-        let interval = now.duration_since(self.handshake);
-        if interval > self.rtt{
+        if self.rec_buffer.received_count() >= total {
             return true;
         }
+
+        if let Some(fraction) = self.iteration_policy.high_priority_fraction {
+            let high = self.rec_buffer.received_by_priority(3) as f64;
+            let expected = high_priority_blocks(total) as f64;
+
+            if high >= fraction * expected {
+                return true;
+            }
+        }
+
         false
     }
 
-    pub fn read(&mut self, out:&mut [u8]) -> Result<usize>{
-        self.rec_buffer.emit(out)
-
+    /// Returns the amount of time until the iteration deadline, if any.
+    pub fn iteration_timeout(&self) -> Option<Duration> {
+        self.iteration_policy
+            .deadline
+            .map(|deadline| deadline.saturating_duration_since(Instant::now()))
     }
 
     pub fn max_ack(&mut self) -> u64{
@@ -964,44 +2634,81 @@ impl Connection {
     //Writing data to send buffer.
     pub fn write(&mut self) -> Result<usize> {
         //?/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-        let toffset = self.total_offset % 1024;
-        let mut off_len: usize = 0;
-        if toffset % 1024 != 0{
-            off_len = 1024 - (self.total_offset % 1024) as usize;
-        }
         let high_ratio = self.high_priority as f64 / self.sent_number as f64;
-        println!("hight_ratio: {:?}", high_ratio);
         self.high_priority = 0;
         self.sent_number = 0;
-        // let off_len = 1024 - (self.total_offset % 1024) as usize;
         //Note: written_data refers to the non-retransmitted data.
         let mut congestion_window = 0;
         if high_ratio > CONGESTION_THREAHOLD{
             congestion_window = self.recovery.rollback();
+            self.rollback_count += 1;
+            qlog_event!(self.qlog, trace::Event::Rollback { cwnd: congestion_window, high_ratio });
         }else{
             congestion_window = self.recovery.cwnd();
+            qlog_event!(self.qlog, trace::Event::WindowComputed { cwnd: congestion_window, high_ratio });
         }
-        println!("cwnd: {:?}", congestion_window);
-        self.send_buffer.write(&self.send_data[self.written_data..], congestion_window, off_len, self.max_off)
+        self.recovery.update_pacing_rate(congestion_window, self.rtt);
+        self.window_start = Instant::now();
+        self.window_delivered = 0;
+        let end = self.sendable_len();
+        let written = self.send_buffer.write(&self.send_data[self.written_data..end], congestion_window, self.max_off)?;
+        self.schedule_window();
+        qlog_event!(self.qlog, trace::Event::DataBuffered { len: written });
+        Ok(written)
     }
 
-    pub fn  priority_calculation(&self, off: u64) -> u8{
-        let real_index = off/1024;
-        if self.norm2_vec[real_index as usize] < self.low_split_point{
-            1
-        }
-        else if self.norm2_vec[real_index as usize] < self.high_split_point {
-            2
-        }
-        else {
-            3
+    /// Writes the events traced on this connection as qlog JSON-SEQ.
+    ///
+    /// Only the most recent `TRACE_CAPACITY` events are kept.
+    #[cfg(feature = "qlog")]
+    pub fn write_qlog<W: std::io::Write>(&self, w: &mut W) -> std::io::Result<()> {
+        self.qlog.write_json_seq(w)
+    }
+
+    /// Returns the length of data that can be written to the send buffer.
+    ///
+    /// While an iteration is still being appended, only whole blocks have a
+    /// priority, so the trailing partial block is held back until
+    /// `data_finish()` is called.
+    fn sendable_len(&self) -> usize {
+        if self.data_finished {
+            self.send_data.len()
+        } else {
+            self.norm2_vec.len() * self.block_size
         }
+    }
+
+    pub fn  priority_calculation(&self, off: u64) -> u8{
+        let real_index = off / self.block_size as u64;
+        block_priority(&self.norm2_vec, real_index as usize, self.low_split_point, self.high_split_point)
+    }
+
+    /// Returns the priority of the block at `off` on the wire: the one it
+    /// was first sent with in this iteration, or its current one if it was
+    /// not sent yet.
+    fn sent_priority(&self, off: u64) -> u8 {
+        self.blocks
+            .priority(off / self.block_size as u64)
+            .unwrap_or_else(|| self.priority_calculation(off))
+    }
 
+    /// Orders the blocks of the window being started, after the scheduling
+    /// policy, so that the most valuable ones leave first.
+    fn schedule_window(&mut self) {
+        let norm2_vec = &self.norm2_vec;
+        let (low, high) = (self.low_split_point, self.high_split_point);
+
+        self.send_buffer.schedule(self.scheduling_policy, |idx| {
+            block_priority(norm2_vec, idx, low, high)
+        });
     }
 
     pub fn reset(& mut self){
         self.norm2_vec.clear();
         self.send_buffer.clear();
+        self.reset_blocks();
+        self.written_data = 0;
+        self.total_offset = 0;
     }
 
     ///responce packet used to tell sender which packet loss
@@ -1061,14 +2768,28 @@ impl Connection {
     pub fn check_loss(&mut self, recv_buf: &mut [u8]){
         let mut b = octets::OctetsMut::with_slice(recv_buf);
         // let result:Vec<u64> = Vec::new();
-        while b.cap()>0 {
-            let offset = b.get_u64().unwrap();
-            if self.recv_dic.contains_key(&offset){
-                self.recv_hashmap.insert(offset, 0);
-            }else{
-                self.recv_hashmap.insert(offset, 1);
+        while let Ok(offset) = b.get_u64() {
+            if offset % self.block_size as u64 == 0{
+                self.blocks.report(offset / self.block_size as u64);
+            }
+        }
+    }
+
+    /// Parses a compact ElictAck payload, see `check_loss()`.
+    fn check_loss_compact(&mut self, recv_buf: &mut [u8]) -> Result<()>{
+        let mut blocks = std::mem::take(&mut self.ack_blocks);
+        blocks.clear();
+        let mut b = octets::OctetsMut::with_slice(recv_buf);
+        let res = packet::decode_block_ranges(&mut b, block::MAX_BLOCKS, &mut blocks);
+
+        if res.is_ok(){
+            for idx in blocks.iter(){
+                self.blocks.report(*idx);
             }
         }
+
+        self.ack_blocks = blocks;
+        res
     }
 
     pub fn set_handshake(&mut self){
@@ -1112,19 +2833,28 @@ impl Connection {
 
     /// Returns the maximum possible size of egress UDP payloads.
     ///
-    /// This is the maximum size of UDP payloads that can be sent, and depends
-    /// on both the configured maximum send payload size of the local endpoint
-    /// (as configured with [`set_max_send_udp_payload_size()`]), as well as
-    /// the transport parameter advertised by the remote peer.
+    /// This is the size of data packets, and depends on the configured
+    /// maximum send payload size of the server (as configured with
+    /// [`set_max_send_udp_payload_size()`]), the maximum receive payload
+    /// size of the client (as configured with
+    /// [`set_max_recv_udp_payload_size()`]), and the largest payload the
+    /// path carried when probed during the handshake.
     ///
-    /// Note that this value can change during the lifetime of the connection,
-    /// but should remain stable across consecutive calls to [`send()`].
+    /// It only changes when the handshake completes.
     ///
     /// [`set_max_send_udp_payload_size()`]:
     ///     struct.Config.html#method.set_max_send_udp_payload_size
-    /// [`send()`]: struct.Connection.html#method.send
+    /// [`set_max_recv_udp_payload_size()`]:
+    ///     struct.Config.html#method.set_max_recv_udp_payload_size
     pub fn max_send_udp_payload_size(&self) -> usize {
-        MIN_CLIENT_INITIAL_LEN
+        self.pmtu
+    }
+
+    /// Returns the size of the data blocks, the data carried by a full data
+    /// packet. It follows the path MTU, so it only changes when the
+    /// handshake completes.
+    pub fn block_size(&self) -> usize {
+        self.block_size
     }
     
 
@@ -1169,21 +2899,227 @@ impl Connection {
         self.timed_out
     }
 
+    /// Returns the amount of time until the next timeout event.
+    ///
+    /// Once the given duration has elapsed, the [`on_timeout()`] method
+    /// should be called. A timeout of `None` means that the timer should be
+    /// disarmed.
+    ///
+    /// [`on_timeout()`]: struct.Connection.html#method.on_timeout
+    pub fn timeout(&self) -> Option<Duration> {
+        if self.closed {
+            return None;
+        }
+
+        let timeout = match (self.idle_timer, self.recovery.loss_detection_timer()) {
+            (Some(idle), Some(loss)) => Some(cmp::min(idle, loss)),
+            (idle, loss) => idle.or(loss),
+        };
+
+        timeout.map(|t| t.saturating_duration_since(Instant::now()))
+    }
+
+    /// Processes a timeout event.
+    ///
+    /// If no timer has expired this does nothing.
+    ///
+    /// When the idle timer expires the connection is closed. When the loss
+    /// detection timer expires, the blocks that an ElictAck asked about and
+    /// no ACK answered are asked about again in the next packet sent by
+    /// [`send_data()`], which arms the timer again with a doubled timeout.
+    ///
+    /// [`send_data()`]: struct.Connection.html#method.send_data
+    pub fn on_timeout(&mut self) {
+        let now = Instant::now();
+
+        if let Some(timer) = self.idle_timer {
+            if timer <= now {
+                self.closed = true;
+                self.timed_out = true;
+                return;
+            }
+        }
+
+        if let Some(timer) = self.recovery.loss_detection_timer() {
+            if timer <= now {
+                self.recovery.on_loss_detection_timeout();
+
+                let mut blocks = std::mem::take(&mut self.ack_blocks);
+                self.blocks.take_reported(&mut blocks);
+
+                // Blocks that don't fit in the probe wait for the next one.
+                for idx in blocks.iter().skip(MAX_PROBE_BLOCKS) {
+                    self.blocks.report(*idx);
+                }
+
+                let probed = cmp::min(blocks.len(), MAX_PROBE_BLOCKS);
+                for idx in blocks[..probed].iter() {
+                    self.sent_pkt.push(*idx * self.block_size as u64);
+                }
+
+                self.ack_blocks = blocks;
+                self.elicit_probe = probed > 0;
+
+                qlog_event!(self.qlog, trace::Event::PtoExpired {
+                    pto_count: self.recovery.pto_count(),
+                    blocks: probed,
+                });
+            }
+        }
+    }
+
+    /// Closes the connection with the given error and reason.
+    ///
+    /// The next call to [`send_data()`] returns a Fin packet carrying `app`,
+    /// `err` and as much of `reason` as fits, after which the connection is
+    /// closed. The peer closes its side on receiving it, and reports the
+    /// error through [`peer_error()`].
+    ///
+    /// Returns [`Done`] if the connection was already closed, or is already
+    /// being closed.
+    ///
+    /// [`send_data()`]: struct.Connection.html#method.send_data
+    /// [`peer_error()`]: struct.Connection.html#method.peer_error
+    /// [`Done`]: enum.Error.html#variant.Done
+    pub fn close(&mut self, app: bool, err: u64, reason: &[u8]) -> Result<()> {
+        if self.closed || self.local_error.is_some() {
+            return Err(Error::Done);
+        }
+
+        self.local_error = Some(ConnectionError {
+            is_app: app,
+            error_code: err,
+            reason: reason.to_vec(),
+        });
+        self.elicit_probe = false;
+        self.recovery.stop_loss_detection_timer();
+
+        Ok(())
+    }
+
+    /// Returns the error the peer closed the connection with, if any.
+    #[inline]
+    pub fn peer_error(&self) -> Option<&ConnectionError> {
+        self.peer_error.as_ref()
+    }
+
+    /// Returns the error the connection was closed with locally, if any.
+    #[inline]
+    pub fn local_error(&self) -> Option<&ConnectionError> {
+        self.local_error.as_ref()
+    }
+
+    /// Collects and returns statistics about the connection.
+    #[inline]
+    pub fn stats(&self) -> Stats {
+        Stats {
+            recv: self.recv_count,
+            sent: self.sent_pkts,
+            lost: self.lost_count,
+            retrans: self.retrans_count,
+            sent_bytes: self.sent_bytes,
+            recv_bytes: self.recv_bytes,
+            lost_bytes: self.lost_bytes,
+            retrans_bytes: self.retrans_bytes,
+            rollbacks: self.rollback_count,
+            delivered_bytes: self.delivered_bytes,
+            lost_bytes_by_priority: self.priority_lost_bytes,
+            given_up_bytes: self.given_up_bytes,
+            fec_sent: self.fec_sent,
+            fec_recovered: self.fec_recovered,
+            paths_count: 1,
+        }
+    }
+
+    /// Returns an iterator over statistics about each path of the
+    /// connection. A connection only ever has one path.
+    #[inline]
+    pub fn path_stats(&self) -> impl Iterator<Item = PathStats> {
+        std::iter::once(PathStats {
+            local_addr: self.localaddr,
+            peer_addr: self.peeraddr,
+            active: true,
+            recv: self.recv_count,
+            sent: self.sent_pkts,
+            lost: self.lost_count,
+            retrans: self.retrans_count,
+            rtt: self.rtt,
+            min_rtt: self.recovery.min_rtt(),
+            cwnd: self.recovery.congestion_window(),
+            sent_bytes: self.sent_bytes,
+            recv_bytes: self.recv_bytes,
+            lost_bytes: self.lost_bytes,
+            retrans_bytes: self.retrans_bytes,
+            pmtu: self.max_send_udp_payload_size(),
+            delivery_rate: self.delivery_rate,
+        })
+    }
+
     
+    /// Returns true if the next packet asks the receiver which blocks it
+    /// got: every `ELICT_FLAG` data packets, once all data was sent, and
+    /// when the loss timer expires.
+    fn elicit_due(&self) -> bool{
+        (self.sent_count % ELICT_FLAG == 0 && self.sent_count > 0) || self.stop_flag || self.elicit_probe
+    }
+
+    /// Returns true if the next packet is a Handshake packet.
+    fn handshake_due(&self) -> bool{
+        if self.is_server {
+            // The server handshakes until it has an RTT sample.
+            self.rtt == Duration::ZERO
+        } else {
+            !self.handshake_confirmed
+        }
+    }
+
+    /// Returns true if the next packet is a Fec packet, following the
+    /// order of `write_pkt_type()`.
+    ///
+    /// No parity is sent before the first RTT sample, as the server is
+    /// still handshaking then and has sent no data to protect.
+    fn fec_pending(&self) -> bool{
+        self.fec && !self.closed && self.local_error.is_none() &&
+            !self.handshake_due() &&
+            (self.fec_encoder.has_ready() ||
+                (self.elicit_due() && self.fec_encoder.has_pending()))
+    }
+
     /// Selects the packet type for the next outgoing packet.
     fn write_pkt_type(& mut self) -> Result<packet::Type> {
         // let now = Instant::now();
-        if self.rtt == Duration::ZERO && self.is_server == true{
-            self.handshake_completed = true;
-            return Ok(packet::Type::Handshake);
+        if self.closed {
+            return Err(Error::Done);
+        }
+
+        if self.local_error.is_some() {
+            return Ok(packet::Type::Fin);
         }
 
-        if self.handshake_confirmed == false && self.is_server == false{
-            self.handshake_confirmed = true;
+        if self.handshake_due(){
+            if self.is_server {
+                self.handshake_completed = true;
+            } else {
+                self.handshake_confirmed = true;
+            }
+
             return Ok(packet::Type::Handshake);
         }
 
-        if (self.sent_count % ELICT_FLAG == 0 && self.sent_count > 0) || self.stop_flag == true{
+        // The parity of a group goes out before the ElictAck closing it, so
+        // that lost blocks are rebuilt before being reported.
+        let elicit = self.elicit_due();
+        if self.fec{
+            if elicit{
+                self.fec_encoder.flush();
+            }
+
+            if self.fec_encoder.has_ready(){
+                return Ok(packet::Type::Fec);
+            }
+        }
+
+        if elicit{
             self.sent_count = 0;
             return Ok(packet::Type::ElictAck);
         }
@@ -1200,7 +3136,7 @@ impl Connection {
             return Ok(packet::Type::Application);
         }
 
-        if self.send_buffer.data.is_empty(){
+        if self.send_buffer.is_empty(){
             return Ok(packet::Type::Stop);
         }
 
@@ -1214,26 +3150,19 @@ impl Connection {
         output = output.replace("\"", "");
         output = output.replace("\r","");
         let new_parts = output.split(">");
-        self.norm2_vec.clear();
-        self.send_data.clear();
-        // let mut send_data:Vec<f32> = Vec::new();
-        self.low_split_point = 0.0;
-        self.high_split_point = 0.0;
+        self.send_data = SendData::Owned(Vec::new());
 
-        let mut norm2_tmp:Vec<f32>=Vec::new();
         for part in new_parts{
             if part == "" {
                 break;
             }
-            self.process_string(part.to_string(),&mut norm2_tmp);
+            self.process_string(part.to_string());
         }
-        norm2_tmp.sort_by(|a, b| a.partial_cmp(b).unwrap());
-        self.low_split_point = norm2_tmp[norm2_tmp.len()*3/10 as usize];
-        self.high_split_point = norm2_tmp[norm2_tmp.len()*7/10 as usize];
+        self.compute_priority();
     }
 
-    //store data and compute priority in advance
-    pub fn process_string(& mut self, test_data: String, norm2_tmp: &mut Vec<f32>){
+    //store data, priority is computed once all data is stored
+    pub fn process_string(& mut self, test_data: String){
         let new_parts = test_data.split("[");
         let collection: Vec<&str> = new_parts.collect();
         let data = collection[1].to_string();
@@ -1244,23 +3173,303 @@ impl Connection {
         let white_space = "";
         single_data.retain(|&x| x != white_space);
     
-        let mut norm2:f32 = 0.0;
-        let mut it = 0;
         for item in single_data{
-            it +=1;
             let my_float:f32 = FromStr::from_str(&item.to_string()).unwrap();
-            norm2 +=my_float*my_float;
             let float_array = my_float.to_ne_bytes();
-            self.send_data.extend(float_array);
-            if it%256 == 255 {
-                norm2_tmp.push(norm2);
-                self.norm2_vec.push(norm2);
-                norm2 = 0.0;
-            }
+            self.send_data.owned_mut().extend(float_array);
         }
     
     }
 
+    /// Hands one iteration of binary data to the connection.
+    ///
+    /// `data` holds native-endian `f32` values and is moved into the
+    /// connection without copying. Block priorities are computed directly
+    /// from the binary data, no text parsing is involved.
+    ///
+    /// Returns the number of bytes accepted.
+    pub fn data_write(&mut self, data: Vec<u8>) -> Result<usize> {
+        let len = data.len();
+        self.send_data = SendData::Owned(data);
+        self.reset_blocks();
+        self.compute_priority();
+        Ok(len)
+    }
+
+    /// Same as [`data_write()`], but borrows `data` instead of taking
+    /// ownership, so the application buffer is never copied.
+    ///
+    /// # Safety
+    ///
+    /// `data` must stay valid and unmodified until [`reset()`] is called or
+    /// new data is handed to the connection, including when the connection
+    /// is moved to another thread.
+    ///
+    /// [`data_write()`]: struct.Connection.html#method.data_write
+    /// [`reset()`]: struct.Connection.html#method.reset
+    pub unsafe fn data_write_borrowed(&mut self, data: &[u8]) -> Result<usize> {
+        let len = data.len();
+        self.send_data = SendData::Borrowed(RawBuf::new(data.as_ptr(), len));
+        self.reset_blocks();
+        self.compute_priority();
+        Ok(len)
+    }
+
+    /// Starts a new iteration whose data is handed to the connection in
+    /// pieces with [`data_append()`], e.g. layer by layer while the rest of
+    /// the gradients are still being computed.
+    ///
+    /// Blocks are sent by [`send_all()`] as soon as they are complete, using
+    /// split points estimated from the blocks appended so far. The exact
+    /// split points are computed by [`data_finish()`].
+    ///
+    /// [`data_append()`]: struct.Connection.html#method.data_append
+    /// [`data_finish()`]: struct.Connection.html#method.data_finish
+    /// [`send_all()`]: struct.Connection.html#method.send_all
+    pub fn data_begin(&mut self) {
+        self.reset();
+        self.send_data = SendData::default();
+        self.norm2_sketch.clear();
+        self.norm2_sketched = 0;
+        self.low_split_point = 0.0;
+        self.high_split_point = 0.0;
+        self.data_finished = false;
+    }
+
+    /// Appends native-endian `f32` values to the current iteration.
+    ///
+    /// Returns the number of bytes accepted. If no iteration was started
+    /// with [`data_begin()`], `Error::InvalidState` is returned.
+    ///
+    /// [`data_begin()`]: struct.Connection.html#method.data_begin
+    pub fn data_append(&mut self, data: &[u8]) -> Result<usize> {
+        if self.data_finished {
+            return Err(Error::InvalidState);
+        }
+
+        self.send_data.owned_mut().extend_from_slice(data);
+
+        // Only whole blocks get a norm, the remainder is picked up by the
+        // next append.
+        let start = self.norm2_vec.len() * self.block_size;
+        let end = self.send_data.len() / self.block_size * self.block_size;
+        if end > start {
+            norm::block_norm2(&self.send_data[start..end], self.block_size, &mut self.norm2_vec);
+            self.update_sketch();
+            self.low_split_point = self.norm2_sketch.quantile(0.3).unwrap_or(0.0);
+            self.high_split_point = self.norm2_sketch.quantile(0.7).unwrap_or(0.0);
+        }
+
+        Ok(data.len())
+    }
+
+    /// Marks the current iteration as complete.
+    ///
+    /// The trailing partial block is released to the send buffer and the
+    /// split points are recomputed with the configured algorithm. Blocks
+    /// that were already sent keep the priority they were sent with, in the
+    /// header and the FEC stripe of their retransmissions and in the loss
+    /// weight of their ACKs.
+    pub fn data_finish(&mut self) -> Result<()> {
+        if self.data_finished {
+            return Err(Error::InvalidState);
+        }
+
+        let start = self.norm2_vec.len() * self.block_size;
+        norm::block_norm2(&self.send_data[start..], self.block_size, &mut self.norm2_vec);
+        self.data_finished = true;
+        self.update_split_points();
+
+        Ok(())
+    }
+
+    /// Returns true if all data of the current iteration has been handed to
+    /// the connection.
+    pub fn is_data_finished(&self) -> bool {
+        self.data_finished
+    }
+
+    /// Computes the squared L2 norm of every block of
+    /// `send_data` and the split points used by `priority_calculation()`.
+    fn compute_priority(&mut self) {
+        self.norm2_vec.clear();
+        self.norm2_sketch.clear();
+        self.norm2_sketched = 0;
+        self.low_split_point = 0.0;
+        self.high_split_point = 0.0;
+        self.data_finished = true;
+
+        norm::block_norm2(&self.send_data, self.block_size, &mut self.norm2_vec);
+
+        self.update_split_points();
+    }
+
+    /// Computes the norms of the blocks of `send_data` again, after the block
+    /// size changed.
+    fn update_norms(&mut self) {
+        self.norm2_vec.clear();
+        self.norm2_sketch.clear();
+        self.norm2_sketched = 0;
+
+        let end = if self.data_finished {
+            self.send_data.len()
+        } else {
+            self.send_data.len() / self.block_size * self.block_size
+        };
+        norm::block_norm2(&self.send_data[..end], self.block_size, &mut self.norm2_vec);
+
+        self.update_split_points();
+    }
+
+    /// Computes the split points from all norms in `norm2_vec`.
+    fn update_split_points(&mut self) {
+        if self.norm2_vec.is_empty() {
+            return;
+        }
+
+        match self.quantile_algorithm {
+            QuantileAlgorithm::SELECT => {
+                let mut norm2_tmp = self.norm2_vec.clone();
+                let [low, high] = quantile::select_deciles(&mut norm2_tmp, [3, 7]);
+                self.low_split_point = low;
+                self.high_split_point = high;
+            },
+
+            QuantileAlgorithm::SKETCH => {
+                self.update_sketch();
+                self.low_split_point = self.norm2_sketch.quantile(0.3).unwrap_or(0.0);
+                self.high_split_point = self.norm2_sketch.quantile(0.7).unwrap_or(0.0);
+            },
+        }
+    }
+
+    /// Inserts the norms that are not yet part of `norm2_sketch`.
+    fn update_sketch(&mut self) {
+        for norm2 in self.norm2_vec[self.norm2_sketched..].iter() {
+            self.norm2_sketch.insert(*norm2);
+        }
+        self.norm2_sketched = self.norm2_vec.len();
+    }
+
+}
+
+/// Application data of the current iteration.
+#[derive(Debug)]
+enum SendData {
+    /// Data owned by the connection.
+    Owned(Vec<u8>),
+
+    /// Data borrowed from the application, see
+    /// `Connection::data_write_borrowed()`.
+    Borrowed(RawBuf),
+}
+
+impl SendData {
+    /// Returns the owned buffer, converting borrowed data into an empty
+    /// owned buffer first.
+    fn owned_mut(&mut self) -> &mut Vec<u8> {
+        if let SendData::Borrowed(..) = self {
+            *self = SendData::Owned(Vec::new());
+        }
+
+        match self {
+            SendData::Owned(v) => v,
+            SendData::Borrowed(..) => unreachable!(),
+        }
+    }
+}
+
+/// Application buffer received data is placed into, see
+/// `Connection::recv_into()`.
+#[derive(Debug)]
+enum RecvData {
+    /// Buffer owned by the connection until it is taken back.
+    Owned(Vec<u8>),
+
+    /// Buffer borrowed from the application, see
+    /// `Connection::recv_into_borrowed()`.
+    Borrowed(RawBuf),
+}
+
+/// An application buffer borrowed by the connection.
+///
+/// The callers of `Connection::data_write_borrowed()` and
+/// `Connection::recv_into_borrowed()` guarantee that the buffer outlives
+/// its use by the connection and isn't accessed meanwhile, wherever the
+/// connection is used from, so the buffer moves with the connection.
+#[derive(Debug)]
+struct RawBuf {
+    ptr: *const u8,
+
+    len: usize,
+}
+
+unsafe impl Send for RawBuf {}
+
+unsafe impl Sync for RawBuf {}
+
+impl RawBuf {
+    fn new(ptr: *const u8, len: usize) -> RawBuf {
+        RawBuf { ptr, len }
+    }
+
+    /// # Safety
+    ///
+    /// The buffer must still be valid.
+    unsafe fn as_slice(&self) -> &[u8] {
+        std::slice::from_raw_parts(self.ptr, self.len)
+    }
+
+    /// # Safety
+    ///
+    /// The buffer must still be valid, and must have been borrowed mutably.
+    unsafe fn as_mut_slice(&mut self) -> &mut [u8] {
+        std::slice::from_raw_parts_mut(self.ptr as *mut u8, self.len)
+    }
+}
+
+impl std::ops::Deref for RecvData {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        match self {
+            RecvData::Owned(v) => v,
+
+            // The caller of `recv_into_borrowed()` guarantees the buffer
+            // outlives its use by the connection.
+            RecvData::Borrowed(buf) => unsafe { buf.as_slice() },
+        }
+    }
+}
+
+impl std::ops::DerefMut for RecvData {
+    fn deref_mut(&mut self) -> &mut [u8] {
+        match self {
+            RecvData::Owned(v) => v,
+
+            RecvData::Borrowed(buf) => unsafe { buf.as_mut_slice() },
+        }
+    }
+}
+
+impl Default for SendData {
+    fn default() -> SendData {
+        SendData::Owned(Vec::new())
+    }
+}
+
+impl std::ops::Deref for SendData {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        match self {
+            SendData::Owned(v) => v,
+
+            // The caller of `data_write_borrowed()` guarantees the buffer
+            // outlives its use by the connection.
+            SendData::Borrowed(buf) => unsafe { buf.as_slice() },
+        }
+    }
 }
 
 
@@ -1291,15 +3500,25 @@ pub struct RangeBuf {
 impl RangeBuf {
     /// Creates a new `RangeBuf` from the given slice.
     pub fn from(buf: &[u8], off: u64) -> RangeBuf {
+        RangeBuf::from_vec(Vec::from(buf), off)
+    }
+
+    /// Creates a new `RangeBuf` taking ownership of the given buffer.
+    pub fn from_vec(data: Vec<u8>, off: u64) -> RangeBuf {
         RangeBuf {
-            data: Vec::from(buf),
+            len: data.len(),
+            data,
             start: 0,
             pos: 0,
-            len: buf.len(),
             off,
         }
     }
 
+    /// Returns the internal buffer, so it can be recycled.
+    fn into_vec(self) -> Vec<u8> {
+        self.data
+    }
+
     /// start refers to the start of all data.
     /// Returns the starting offset of `self`.
     /// Lowest offset of data, start == 0, pos == 0
@@ -1397,23 +3616,65 @@ pub struct RecvBuf {
     last_maxoff: u64,
 
     max_recv_off: u64,
+
+    /// The highest offset received so far.
+    max_end: u64,
+
+    /// The application buffer data is placed into, if any.
+    placement: Option<RecvData>,
+
+    /// One bit per block, set when the block is received.
+    received: Vec<u64>,
+
+    /// The number of bits set in `received`.
+    received_count: usize,
+
+    /// The number of blocks received, per priority level.
+    received_by_priority: [usize; PRIORITY_LEVELS],
+
+    /// Recycles the buffers of the chunks in `data`.
+    pool: pool::BlockPool,
+
+    /// The size of a block, which is the payload of a data packet.
+    block_size: usize,
 }
 
 impl RecvBuf {
     /// Creates a new receive buffer.
     fn new() -> RecvBuf {
         RecvBuf {
+            block_size: SEND_BUFFER_SIZE,
             ..RecvBuf::default()
         }
     }
 
+    /// Sets the block size, and sizes the pooled buffers after it.
+    ///
+    /// Returns `Error::InvalidState` if data was received already, or if
+    /// `block_size` is not a valid block size.
+    fn set_block_size(&mut self, block_size: usize) -> Result<()> {
+        if !is_valid_block_size(block_size) ||
+            !self.data.is_empty() ||
+            self.received_count != 0
+        {
+            return Err(Error::InvalidState);
+        }
+
+        self.block_size = block_size;
+        self.pool = pool::BlockPool::new(block_size, pool::POOL_MAX_FREE);
+
+        Ok(())
+    }
+
     /// Inserts the given chunk of data in the buffer.
     ///
     /// This also takes care of enforcing stream flow control limits, as well
     /// as handling incoming data that overlaps data that is already in the
     /// buffer.
-    pub fn write(&mut self, out: &mut [u8], out_off: u64) -> Result<()> {
-        let buf = RangeBuf::from(out,out_off);
+    pub fn write(&mut self, out: &mut [u8], out_off: u64, priority: u8) -> Result<()> {
+        self.mark_received(out_off, priority)?;
+
+        let buf = RangeBuf::from_vec(self.pool.get(out), out_off);
 
         let buf_len = buf.len();
         let tmp_off = buf.max_off()-buf_len as u64;
@@ -1423,7 +3684,9 @@ impl RecvBuf {
                 self.max_recv_off = tmp_off;
             }
         }   
-        self.data.insert(buf.max_off(), buf);
+        if let Some(old) = self.data.insert(buf.max_off(), buf) {
+            self.pool.put(old.into_vec());
+        }
         Ok(())
     }
 
@@ -1431,6 +3694,153 @@ impl RecvBuf {
         self.max_recv_off
     }
 
+    /// Returns true if received data is placed into an application buffer.
+    fn is_placing(&self) -> bool {
+        self.placement.is_some()
+    }
+
+    /// Sets the application buffer received data is placed into, and starts
+    /// tracking received blocks afresh.
+    fn set_placement(&mut self, buf: RecvData) {
+        let blocks = (buf.len() + self.block_size - 1) / self.block_size;
+
+        self.clear_received();
+        self.received.resize((blocks + 63) / 64, 0);
+
+        self.max_recv_off = 0;
+        self.max_end = 0;
+
+        self.placement = Some(buf);
+    }
+
+    /// Forgets the blocks received, keeping the storage of the bitmap.
+    fn clear_received(&mut self) {
+        self.received.clear();
+        self.received_count = 0;
+        self.received_by_priority = [0; PRIORITY_LEVELS];
+    }
+
+    /// Unregisters the application buffer.
+    fn take_placement(&mut self) -> Option<RecvData> {
+        self.placement.take()
+    }
+
+    /// Copies a data packet payload to its offset in the application buffer.
+    ///
+    /// Blocks that were already received are not copied again.
+    fn place(&mut self, data: &[u8], off: u64, priority: u8) -> Result<()> {
+        let cap = match self.placement.as_ref() {
+            Some(v) => v.len(),
+
+            None => return Err(Error::InvalidState),
+        };
+
+        let start = off as usize;
+        let end = start
+            .checked_add(data.len())
+            .filter(|end| *end <= cap)
+            .ok_or(Error::BufferTooShort)?;
+
+        if !self.mark_received(off, priority)? {
+            return Ok(());
+        }
+
+        if let Some(dst) = self.placement.as_mut() {
+            dst[start..end].copy_from_slice(data);
+        }
+
+        if off == self.max_end {
+            self.max_recv_off = off;
+        }
+        self.max_end = cmp::max(self.max_end, end as u64);
+
+        Ok(())
+    }
+
+    /// Marks the block at `off` as received. Returns false if it already
+    /// was.
+    ///
+    /// Blocks past the application buffer, or past `MAX_BLOCKS` without
+    /// one, can only come from a bogus packet and are rejected with
+    /// `Error::InvalidPacket`.
+    fn mark_received(&mut self, off: u64, priority: u8) -> Result<bool> {
+        let limit = self
+            .expected_blocks()
+            .map_or(block::MAX_BLOCKS, |blocks| blocks as u64);
+
+        let idx = off / self.block_size as u64;
+        if idx >= limit {
+            return Err(Error::InvalidPacket);
+        }
+
+        let idx = idx as usize;
+        let (word, bit) = (idx / 64, 1 << (idx % 64));
+
+        if word >= self.received.len() {
+            self.received.resize(word + 1, 0);
+        }
+
+        if self.received[word] & bit != 0 {
+            return Ok(false);
+        }
+
+        self.received[word] |= bit;
+        self.received_count += 1;
+        self.received_by_priority[priority_level(priority)] += 1;
+
+        Ok(true)
+    }
+
+    /// Returns the `len` bytes of the block received at `off`, if they are
+    /// still buffered.
+    fn block_data(&self, off: u64, len: usize) -> Option<&[u8]> {
+        if !self.is_received(off) {
+            return None;
+        }
+
+        match self.placement.as_ref() {
+            Some(buf) => buf.get(off as usize..off as usize + len),
+
+            None => self
+                .data
+                .get(&(off + len as u64))
+                .filter(|b| b.off() == off && b.len() == len)
+                .map(|b| &b[..]),
+        }
+    }
+
+    /// Returns the received-block bitmap.
+    pub fn received(&self) -> &[u64] {
+        &self.received
+    }
+
+    /// Returns the number of blocks received.
+    pub fn received_count(&self) -> usize {
+        self.received_count
+    }
+
+    /// Returns the number of blocks of the given priority received.
+    pub fn received_by_priority(&self, priority: u8) -> usize {
+        self.received_by_priority[priority_level(priority)]
+    }
+
+    /// Returns the number of blocks that fit in the application buffer, if
+    /// one is registered.
+    pub fn expected_blocks(&self) -> Option<usize> {
+        self.placement
+            .as_ref()
+            .map(|buf| (buf.len() + self.block_size - 1) / self.block_size)
+    }
+
+    /// Returns true if the block at `off` was received.
+    pub fn is_received(&self, off: u64) -> bool {
+        let idx = (off / self.block_size as u64) as usize;
+
+        self.received
+            .get(idx / 64)
+            .map_or(false, |word| word & (1 << (idx % 64)) != 0)
+    }
+
     /// Writes data from the receive buffer into the given output buffer.
     ///
     /// Only contiguous data is written to the output buffer, starting from
@@ -1445,7 +3855,7 @@ impl RecvBuf {
         let mut len:usize = 0;
         let mut cap = out.len();
 
-        if !self.ready() {
+        if !self.ready() || self.is_placing() {
             return Err(Error::Done);
         }
 
@@ -1489,7 +3899,7 @@ impl RecvBuf {
                     // We reached the maximum capacity, so end here.
                     break;
                 }
-                entry.remove();
+                self.pool.put(entry.remove().into_vec());
             }else if zero_len == cap as u64 {
                 self.last_maxoff += zero_len;
                 // cap -= zero_len as usize;
@@ -1539,7 +3949,7 @@ impl RecvBuf {
         // Clear all data already buffered.
         self.off = final_size;
 
-        self.data.clear();
+        self.clear_data();
 
        
 
@@ -1547,9 +3957,16 @@ impl RecvBuf {
     }
 
 
+    /// Drops all buffered chunks, recycling their buffers.
+    fn clear_data(&mut self) {
+        while let Some((_, buf)) = self.data.pop_first() {
+            self.pool.put(buf.into_vec());
+        }
+    }
+
     /// Shuts down receiving data.
     pub fn shutdown(&mut self)  {
-        self.data.clear();
+        self.clear_data();
 
     }
 
@@ -1578,31 +3995,117 @@ impl RecvBuf {
     
 }
 
+/// Send state of one block of application data.
+///
+/// The offset of a block is implied by its index in `SendBuf`.
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct SendBlock {
+    /// The length of the block. Only the last block of the data can be
+    /// shorter than the block size.
+    len: usize,
+
+    /// Whether the block was acknowledged, or given up on.
+    acked: bool,
+
+    /// Whether the block was given up on.
+    given_up: bool,
+
+    /// The priority the block was last sent with.
+    priority: u8,
+
+    /// The number of times the block was sent.
+    sent_count: u32,
+
+    /// The transmission the block was last reported lost for, 0 if none.
+    lost_reported: u32,
+
+    /// The time the block was last sent.
+    last_sent: Option<Instant>,
+}
+
+impl SendBlock {
+    fn new(len: usize) -> SendBlock {
+        SendBlock {
+            len,
+            ..SendBlock::default()
+        }
+    }
+
+    /// Returns the length of `self`.
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    /// Returns true if `self` has a length of zero bytes.
+    pub fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    /// Returns true if `self` was acknowledged.
+    pub fn is_acked(&self) -> bool {
+        self.acked
+    }
+
+    /// Returns true if `self` was given up on.
+    pub fn is_given_up(&self) -> bool {
+        self.given_up
+    }
+
+    /// Returns the priority `self` was last sent with.
+    pub fn priority(&self) -> u8 {
+        self.priority
+    }
+
+    /// Returns the number of times `self` was sent.
+    pub fn sent_count(&self) -> u32 {
+        self.sent_count
+    }
+
+    /// Returns the time `self` was last sent.
+    pub fn last_sent(&self) -> Option<Instant> {
+        self.last_sent
+    }
+}
+
 /// Send-side stream buffer.
 ///
-/// Stream data scheduled to be sent to the peer is buffered in a list of data
-/// chunks ordered by offset in ascending order. Contiguous data can then be
-/// read into a slice.
+/// The data of an iteration is split into `block_size` blocks whose send
+/// state is kept in a table indexed by `offset / block_size`, so
+/// acknowledging a block and accounting for buffered data are O(1). Blocks
+/// only refer to the application data owned by the connection, which is
+/// passed to `emit()`, so data is copied once, directly into the outgoing
+/// packet.
 ///
-/// By default, new data is appended at the end of the stream, but data can be
-/// inserted at the start of the buffer (this is to allow data that needs to be
-/// retransmitted to be re-buffered).
+/// Every congestion window re-sends the blocks that have not been
+/// acknowledged yet, followed by new data, unless `schedule()` orders them
+/// otherwise.
 #[derive(Debug, Default)]
 pub struct SendBuf {
-    /// Chunks of data to be sent, ordered by offset.
-    data: VecDeque<RangeBuf>,
+    /// Send state of all blocks written so far, indexed by
+    /// `offset / block_size`.
+    blocks: Vec<SendBlock>,
+
+    /// The size of a block, which is the payload of a data packet.
+    block_size: usize,
+
+    /// Indices of the blocks that were not acknowledged when the window
+    /// started, in the order they are sent in.
+    pending: Vec<usize>,
+
+    /// Orders `pending` at the start of every window.
+    scheduler: scheduler::Scheduler,
 
-    // data:BTreeMap<u64, RangeBuf>,
-    //retransmission buffer.
-    // retran_data: VecDeque<RangeBuf>,
+    /// The index of the first block not acknowledged, as `pending` isn't
+    /// in offset order.
+    front: usize,
 
-    /// The index of the buffer that needs to be sent next.
+    /// The index in `pending` of the block that needs to be sent next.
     pos: usize,
 
     /// The maximum offset of data buffered in the stream.
     off: u64,
 
-    /// The amount of data currently buffered.
+    /// The amount of data that has not been acknowledged.
     len: u64,
 
     /// The maximum offset we are allowed to send to the peer.
@@ -1613,26 +4116,11 @@ pub struct SendBuf {
     /// The error code received via STOP_SENDING.
     error: Option<u64>,
 
-
     /// retransmission data in sendbuf
     used_length: usize,
 
-    
-    // Ranges of data offsets that have been acked.
-    // acked: ranges::RangeSet,
-    // offset_index: BTreeMap<u64,u64>,
-
-    // recv_index: Vec<bool>,
-
-    offset_recv: BTreeMap<u64, bool>,
-
-    // index: u64,
-
-    removed: u64,
-
+    /// The amount of data sent in the current window.
     sent: usize,
-
-    // drop_pkts: usize,
 }
 
 impl SendBuf {
@@ -1641,10 +4129,25 @@ impl SendBuf {
     fn new(max_data: u64) -> SendBuf {
         SendBuf {
             max_data,
+            block_size: SEND_BUFFER_SIZE,
             ..SendBuf::default()
         }
     }
 
+    /// Sets the block size.
+    ///
+    /// Returns `Error::InvalidState` if data was written already, or if
+    /// `block_size` is not a valid block size.
+    fn set_block_size(&mut self, block_size: usize) -> Result<()> {
+        if !is_valid_block_size(block_size) || !self.blocks.is_empty() {
+            return Err(Error::InvalidState);
+        }
+
+        self.block_size = block_size;
+
+        Ok(())
+    }
+
     /// Returns the outgoing flow control capacity.
     pub fn cap(&mut self) -> Result<usize> {
         // The stream was stopped, so return the error code instead.
@@ -1655,21 +4158,17 @@ impl SendBuf {
         Ok((self.max_data - self.used_length as u64) as usize)
     }
 
-    /// Inserts the given slice of data at the end of the buffer.
+    /// Appends the given slice of data as new blocks.
     ///
     /// The number of bytes that were actually stored in the buffer is returned
     /// (this may be lower than the size of the input buffer, in case of partial
     /// writes).
     /// write function is used to write new data into sendbuf, one congestion window 
     /// will run once.
-    pub fn write(&mut self, mut data: &[u8], window_size: usize, off_len: usize, max_ack: u64) -> Result<usize> {
+    pub fn write(&mut self, mut data: &[u8], window_size: usize, max_ack: u64) -> Result<usize> {
         self.recv_and_drop(max_ack);
         self.max_data = window_size as u64;
-        self.removed = 0;
         self.sent = 0;
-        // Get the stream send capacity. This will return an error if the stream
-        // was stopped.
-        self.len = self.len() as u64;
         self.used_length = self.len();
         //Addressing left data is greater than the window size
         if self.len >= window_size.try_into().unwrap(){
@@ -1681,172 +4180,118 @@ impl SendBuf {
         }
     
         let capacity = self.cap()?;
-        // self.used_length = window_size;
-        // self.used_length = 0;
-        
+
         if data.len() > capacity {
-            // Truncate the input buffer according to the stream's capacity.
-            let len = capacity;
+            // Truncate the input buffer to whole blocks, so that only the end
+            // of the data can be a partial block and every block starts at a
+            // multiple of the block size.
+            let len = capacity / self.block_size * self.block_size;
             data = &data[..len];
-
         }
 
-        // We already recorded the final offset, so we can just discard the
-        // empty buffer now.
         if data.is_empty() {
-            return Ok(data.len());
-        }
-
-        let mut len = 0;
-
-        // Split function to set priority and message size
-        // let mut split_result = split(data);
-
-        println!("data.len(): {:?}, off_len: {:?}", data.len(), off_len);
-        /////
-        if off_len > 0 {
-            if data.len() > off_len{
-            println!("data.len >> off_len");
-            let first_buf: RangeBuf = RangeBuf::from(&data[..off_len], self.off);
-            // self.offset_index.insert( self.off,self.index);
-            // println!("Insert: offset: {:?}, index: {:?}",self.off, self.index);
-            // self.index = self.index+1;
-
-            // self.recv_index.push(true);
-
-            self.offset_recv.insert(self.off, true);
-
-            self.data.push_back(first_buf);
-            self.off += off_len as u64;
-            self.len += off_len as u64;
-            self.used_length += off_len;
-            len += off_len;
-            }else{
-                println!("data.len << off_len");
-                let first_buf: RangeBuf = RangeBuf::from(&data[..], self.off);
-                self.offset_recv.insert(self.off, true);
-
-                self.data.push_back(first_buf);
-                self.off += data.len() as u64;
-                self.len += data.len() as u64;
-                self.used_length += data.len();
-                len += data.len();
-                return Ok(len);
-            }
-
+            return Ok(0);
         }
-        for chunk in data[off_len..].chunks(SEND_BUFFER_SIZE){
-
-        // Split the remaining input data into consistently-sized buffers to
-        // avoid fragmentation.
-        //for chunk in data.chunks(SEND_BUFFER_SIZE) {
-            
-            len += chunk.len();          
 
-            let buf = RangeBuf::from(chunk, self.off);
-            
-            // self.offset_index.insert( self.off,self.index);
+        debug_assert!(self.off % self.block_size as u64 == 0);
 
-            self.offset_recv.insert(self.off, true);
-            //println!("Insert: offset: {:?}, index: {:?}",self.off, self.index);
-            // self.index = self.index + 1;
-            // self.recv_index.push(true);
-            // The new data can simply be appended at the end of the send buffer.
-            self.data.push_back(buf);
+        for chunk in data.chunks(self.block_size) {
+            self.pending.push(self.blocks.len());
+            self.blocks.push(SendBlock::new(chunk.len()));
 
             self.off += chunk.len() as u64;
             self.len += chunk.len() as u64;
             self.used_length += chunk.len();
         }
-        Ok(len)
+
+        Ok(data.len())
     }
 
     /// Returns the lowest offset of data buffered.
     pub fn off_front(&self) -> u64 {
-        let mut pos = self.pos;
+        if self.front < self.blocks.len() {
+            (self.front * self.block_size) as u64
+        } else {
+            self.off
+        }
+    }
 
-        // Skip empty buffers from the start of the queue.
-        while let Some(b) = self.data.get(pos) {
-            if !b.is_empty() {
-                return b.off();
-            }
-            pos += 1;
+    /// Moves `front` past the blocks acknowledged. Blocks are never
+    /// unacknowledged, so this is amortized O(1) per block.
+    fn advance_front(&mut self) {
+        while self.blocks.get(self.front).map_or(false, |b| b.acked) {
+            self.front += 1;
         }
+    }
 
-        self.off
+    /// Orders the blocks left to send in the window after `policy`.
+    ///
+    /// `priority` returns the priority of a block from its index. Blocks
+    /// sent before are retransmissions.
+    pub fn schedule<F>(&mut self, policy: SchedulingPolicy, priority: F)
+    where
+        F: Fn(usize) -> u8,
+    {
+        let blocks = &self.blocks;
+        let pos = cmp::min(self.pos, self.pending.len());
+
+        self.scheduler.schedule(policy, &mut self.pending[pos..], |idx| {
+            (priority(idx), blocks[idx].sent_count > 0)
+        });
     }
 
-    /// Returns true if there is data to be written.
-    fn ready(&self) -> bool {
-        // !self.data.is_empty() && self.off_front() < self.off
-        !self.data.is_empty()
-    }
-///////////////////////////////////////////////////////////////////////
-///////////////////////////////////////////////////////////////////////
-///////////////////////////////////////////////////////////////////////
-    /// Writes data from the send buffer into the given output buffer.
-    pub fn emit(&mut self, out: &mut [u8]) -> Result<(usize,u64,bool)> {
+    /// Writes the next block from the send buffer into the given output
+    /// buffer.
+    ///
+    /// `data` is the application data the blocks refer to. Blocks that were
+    /// acknowledged since the window started are skipped.
+    pub fn emit(&mut self, out: &mut [u8], data: &[u8]) -> Result<(usize,u64,bool)> {
         let mut stop = false;
-        let mut out_len = out.len();
-        if self.data.is_empty(){
-            println!("no data");
-        }
-
-        let out_off = self.off_front();
+        let mut out_len = 0;
+        let mut out_off = self.off;
 
-        // let result_len = out.len();     
-        // let mut useout = false;
-        while out_len >= SEND_BUFFER_SIZE && self.ready() 
-        {
-            let buf = match self.data.get_mut(self.pos) {
-                Some(v) => v,
+        while out.len() >= self.block_size {
+            let idx = match self.pending.get(self.pos) {
+                Some(v) => *v,
 
                 None => break,
             };
-            // useout = true;
-            if buf.is_empty() {
-                self.pos += 1;
-                continue;
-            }
-
-            let buf_len = cmp::min(buf.len(), out_len);
-            let partial = buf_len <= buf.len();
-
-            // Copy data to the output buffer.
-            // let out_pos = (next_off - out_off) as usize;
-            let out_pos:usize = 0;
-            out[out_pos..out_pos + buf_len].copy_from_slice(&buf.data[..buf_len]);
 
-            self.len -= buf_len as u64;
-            self.used_length -= buf_len;
-
-            out_len = buf_len;
-
-            //buf.consume(buf_len);
             self.pos += 1;
 
-            if partial {
-                // We reached the maximum capacity, so end here.
-                break;
+            let block = &mut self.blocks[idx];
+            if block.acked || block.is_empty() {
+                continue;
             }
 
-            //When sent data reach max congestion window size
+            // Blocks of data that was replaced by the application are
+            // skipped.
+            let start = idx * self.block_size;
+            let src = match data.get(start..start + block.len) {
+                Some(v) => v,
+
+                None => continue,
+            };
+
+            out[..block.len].copy_from_slice(src);
+            out_len = block.len;
+            out_off = start as u64;
 
+            block.sent_count += 1;
+            block.last_sent = Some(Instant::now());
 
+            break;
         }
-        self.sent += out_len;
 
-        // result_len = out_len;
+        self.sent += out_len;
 
-        //All data in the congestion control window has been sent. need to modify
-        if self.sent  >= self.max_data.try_into().unwrap() {
+        //All data in the congestion control window has been sent.
+        if self.sent >= self.max_data.try_into().unwrap() {
             stop = true;
-            // result_len = (self.max_data as usize)-self.sent;
             self.pos = 0;
         }
-        if self.pos == self.data.len(){
+        if self.pos >= self.pending.len(){
             stop = true;
-            // result_len = (self.max_data as usize)-self.sent;
             self.pos = 0;
         }
         Ok((out_len, out_off, stop))
@@ -1854,99 +4299,134 @@ impl SendBuf {
 
     /// Updates the max_data limit to the given value.
     pub fn update_max_data(&mut self, max_data: u64) {
-        // self.max_data = cmp::max(self.max_data, max_data);
         self.max_data = max_data;
     }
 
-    // pub fn recv_and_drop(&mut self, ack_set: &[u64], unack_set: &[u64],len: usize) {
+    /// Removes acknowledged blocks from the list of blocks to send.
     pub fn recv_and_drop(&mut self, _max_ack: u64) {
-        if self.data.is_empty() {
-            return;
+        let blocks = &self.blocks;
+        self.pending.retain(|idx| !blocks[*idx].acked);
+        self.pos = cmp::min(self.pos, self.pending.len());
+    }
+
+    /// Gives up on the blocks not acknowledged for which `f` returns true,
+    /// from their index: they are not sent again. Returns the number of bytes
+    /// given up on.
+    pub fn give_up<F>(&mut self, f: F) -> usize
+    where
+        F: Fn(usize) -> bool,
+    {
+        let mut bytes = 0;
+
+        for idx in self.pending.iter() {
+            let block = &mut self.blocks[*idx];
+            if !block.acked && !block.given_up && f(*idx) {
+                block.acked = true;
+                block.given_up = true;
+                bytes += block.len;
+            }
         }
 
-        // let upper_bound = max_ack;
-        // let keys_to_remove: Vec<_> = self.offset_index.range((Included(&0), Included(&upper_bound)))
-        //     .map(|(&key, &_value)| key)
-        //     .collect();
+        self.len -= bytes as u64;
+        self.advance_front();
+        bytes
+    }
 
-        // for key in keys_to_remove {
-        //     if let Some(value) = self.offset_index.remove(&key) {
-        //         self.recv_index[value as usize] = false;
-        //     }
-        // }
+    /// Gives up on the block at `offset`, if it was neither acknowledged
+    /// nor given up on yet. Returns the number of bytes given up on.
+    pub fn give_up_block(&mut self, offset: u64) -> usize {
+        let len = match self.block_mut(offset) {
+            Some(block) if !block.acked && !block.given_up => {
+                block.acked = true;
+                block.given_up = true;
+                block.len
+            },
+
+            _ => return 0,
+        };
 
+        self.len -= len as u64;
+        self.advance_front();
+        len
+    }
 
-        // let mut iter = self.recv_index.iter();
-        // println!("Before dropping, data len: {:?}, recv_index len: {:?}, offset_index len: {:?}",self.data.len(),self.recv_index.len(),self.offset_index.len());
-        // self.data.retain(|_| *iter.next().unwrap());
-        // self.recv_index.clear();
-        // // self.retransmit(unack_set);
-        // self.index = self.data.len() as u64;
-        // let mut counter = 0;
-        // for (_, val) in self.offset_index.iter_mut() {
-        //     *val = counter;
-        //     counter += 1;
-        //     self.recv_index.push(true);
-        // }
-        
-        //println!("Before dropping, data len: {:?}, offset_recv len: {:?}",self.data.len(),self.offset_recv.len());
-        let recv_drop:Vec<bool> = self.offset_recv.values().cloned().collect();
-        let mut iter = recv_drop.iter();
-        self.data.retain(|_| *iter.next().unwrap());
-        self.offset_recv.retain(|_, & mut v| v == true);
-        //println!("After dropping, data len: {:?}, offset_recv len: {:?}",self.data.len(),self.offset_recv.len());
-  
+    /// Marks the block at `offset` as acknowledged, it is not sent again.
+    pub fn ack_and_drop(&mut self, offset:u64){
+        if let Some(block) = self.block_mut(offset) {
+            if !block.acked {
+                block.acked = true;
+                let len = block.len as u64;
+                self.len -= len;
+                self.advance_front();
+            }
+        }
     }
 
+    /// Records that the block at `offset` was reported lost. Returns true
+    /// if it is the first report for its last transmission.
+    pub fn on_lost(&mut self, offset: u64) -> bool {
+        match self.block_mut(offset) {
+            Some(block)
+                if !block.acked && block.lost_reported < block.sent_count =>
+            {
+                block.lost_reported = block.sent_count;
+                true
+            },
+
+            _ => false,
+        }
+    }
 
-    pub fn ack_and_drop(&mut self, offset:u64){
-        /*println!("ack_and_drop: {:?}",offset);
-        for (key, val) in self.offset_index.iter(){
-            println!("Akey: {:?}, Avak: {:?}",key,val);
-        }*/
-        if let Some(x) = self.offset_recv.get_mut(&offset) {
-            *x = false;
+    /// Records the priority the block at `offset` was sent with.
+    pub fn set_priority(&mut self, offset: u64, priority: u8) {
+        if let Some(block) = self.block_mut(offset) {
+            block.priority = priority;
         }
-        // let index = self.offset_index.get(&offset).unwrap();
-        // self.recv_index[*index as usize]=false;
-        // self.drop_pkts = self.drop_pkts - 1;
     }
 
+    /// Returns the send state of the block at `offset`.
+    pub fn block(&self, offset: u64) -> Option<&SendBlock> {
+        if offset % self.block_size as u64 != 0 {
+            return None;
+        }
 
-    // pub fn retransmit(&mut self, unack_set:&[u64]) {
-    //     for i in unack_set{
-    //         let position = self.pos;
-    //         let b = self.data.get((self.offset_index.get(&i).unwrap() - self.removed).try_into().unwrap());  
-    //         self.offset_index.entry(*i).or_insert(position.try_into().unwrap());   
-    //         let index_off = self.offset_index.get(&i).unwrap() - self.removed;   
-    //         self.data.remove(index_off.try_into().unwrap());
-    //         self.index -= 1;
-    //         self.removed +=1;
-    //     }
-    // }
+        self.blocks.get((offset / self.block_size as u64) as usize)
+    }
+
+    /// Returns the number of blocks of the send buffer.
+    pub fn block_count(&self) -> usize {
+        self.blocks.len()
+    }
+
+    fn block_mut(&mut self, offset: u64) -> Option<&mut SendBlock> {
+        if offset % self.block_size as u64 != 0 {
+            return None;
+        }
 
+        self.blocks.get_mut((offset / self.block_size as u64) as usize)
+    }
 
-    ////rewritetv
     /// Resets the stream at the current offset and clears all buffered data.
     pub fn reset(&mut self) -> Result<u64> {
         let unsent_off = self.off_front();
         let unsent_len = self.off_back() - unsent_off;
 
-
         // Drop all buffered data.
-        self.data.clear();
+        self.clear();
 
-        self.pos = 0;
-        self.len = 0;
         self.off = unsent_off;
 
         Ok(unsent_len)
     }
 
     pub fn clear(&mut self){
-        self.data.clear();
+        self.blocks.clear();
+        self.pending.clear();
         self.pos = 0;
+        self.front = 0;
         self.off = 0;
+        self.len = 0;
+        self.sent = 0;
     }
 
     /// Returns the largest offset of data buffered.
@@ -1960,19 +4440,14 @@ impl SendBuf {
     }
 
     pub fn is_empty(&self) -> bool {
-        self.data.is_empty()
+        self.pending.is_empty()
     }
 
+    /// Returns the amount of data that has not been acknowledged.
     pub fn len(&self) -> usize{
-        let mut length = 0;
-        if self.data.is_empty(){
-            return 0;
-        }
-        for item in self.data.iter(){
-            length += item.data.len();
-        }
-        length
+        self.len as usize
     }
+
     /// Returns true if the stream was stopped before completion.
     pub fn is_stopped(&self) -> bool {
         self.error.is_some()
@@ -1984,12 +4459,264 @@ impl SendBuf {
 
 mod recovery;
 mod packet;
-// mod minmax;
+mod norm;
+mod quantile;
+mod pool;
+mod block;
+#[cfg(feature = "qlog")]
+mod trace;
+mod minmax;
+mod fec;
+mod scheduler;
 use recovery::Recovery;
 
 pub use crate::recovery::CongestionControlAlgorithm;
+pub use crate::quantile::QuantileAlgorithm;
+pub use crate::quantile::Sketch;
+pub use crate::scheduler::SchedulingPolicy;
+
+/// Internals used by the benchmarks in `benches/`. Not part of the API.
+#[doc(hidden)]
+pub mod bench {
+    pub use crate::packet::decode_block_ranges;
+    pub use crate::packet::encode_block_ranges;
+    pub use crate::quantile::select_deciles;
+
+    use crate::packet::Header;
+    use crate::packet::Type;
+    use crate::Result;
+
+    /// Returns a header for a payload of `len` bytes at `offset`.
+    pub fn header(
+        ty: Type, pkt_num: u64, priority: u8, offset: u64, len: u64,
+    ) -> Header {
+        Header {
+            ty,
+            pkt_num,
+            priority,
+            offset,
+            pkt_length: len,
+        }
+    }
+
+    /// Writes `hdr` in the legacy format, returning its length.
+    pub fn header_to_bytes(hdr: &Header, out: &mut [u8]) -> Result<usize> {
+        let mut b = octets::OctetsMut::with_slice(out);
+        hdr.to_bytes(&mut b)?;
+
+        Ok(b.off())
+    }
+
+    /// Writes `hdr` in the compact format, returning its length.
+    pub fn header_to_bytes_compact(
+        hdr: &Header, out: &mut [u8], index_len: usize, block_size: usize,
+    ) -> Result<usize> {
+        let mut b = octets::OctetsMut::with_slice(out);
+        hdr.to_bytes_compact(&mut b, index_len, block_size)?;
+
+        Ok(b.off())
+    }
+
+    /// Parses a header in either format.
+    pub fn header_from_bytes(buf: &mut [u8], block_size: usize) -> Result<Header> {
+        let mut b = octets::OctetsMut::with_slice(buf);
+        Header::from_bytes(&mut b, block_size)
+    }
+}
 pub use crate::packet::Header;
 pub use crate::packet::Type;
 #[cfg(feature = "ffi")]
 mod ffi;
 
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn send_buf_block_size() {
+        let mut buf = SendBuf::new(u64::MAX);
+
+        assert_eq!(buf.set_block_size(0), Err(Error::InvalidState));
+        assert_eq!(buf.set_block_size(1000), Err(Error::InvalidState));
+        assert_eq!(
+            buf.set_block_size(MAX_BLOCK_SIZE + SEND_BUFFER_SIZE),
+            Err(Error::InvalidState)
+        );
+        assert_eq!(buf.set_block_size(MAX_BLOCK_SIZE), Ok(()));
+        assert_eq!(buf.set_block_size(2 * SEND_BUFFER_SIZE), Ok(()));
+        assert_eq!(buf.block_size, 2 * SEND_BUFFER_SIZE);
+
+        // Not once data was written.
+        let data = vec![0; 4 * SEND_BUFFER_SIZE];
+        assert!(buf.write(&data, data.len(), 0).unwrap() > 0);
+        assert_eq!(
+            buf.set_block_size(SEND_BUFFER_SIZE),
+            Err(Error::InvalidState)
+        );
+        assert_eq!(buf.block_size, 2 * SEND_BUFFER_SIZE);
+
+        buf.clear();
+        assert_eq!(buf.set_block_size(SEND_BUFFER_SIZE), Ok(()));
+    }
+
+    /// Returns a server and a client connection past the handshake, the
+    /// server holding an iteration of 64 zero blocks.
+    fn pair() -> (Connection, Connection) {
+        let mut cfg = Config::new().unwrap();
+        let a = "127.0.0.1:1".parse().unwrap();
+        let b = "127.0.0.1:2".parse().unwrap();
+        let mut s = accept(a, b, &mut cfg).unwrap();
+        let mut c = connect(b, a, &mut cfg).unwrap();
+
+        s.data_write(vec![0; 64 * SEND_BUFFER_SIZE]).unwrap();
+
+        let mut out = vec![0; MAX_UDP_PAYLOAD_SIZE];
+        let (n, _) = s.send_data(&mut out).unwrap();
+        c.recv_slice(&mut out[..n]).unwrap();
+        let (n, _) = c.send_data(&mut out).unwrap();
+        s.recv_slice(&mut out[..n]).unwrap();
+
+        (s, c)
+    }
+
+    /// Returns a server connection that sent the first `blocks` blocks of
+    /// an iteration, none of which was acknowledged.
+    fn sender(blocks: usize) -> Connection {
+        let (mut s, _) = pair();
+        let mut out = vec![0; MAX_UDP_PAYLOAD_SIZE];
+
+        s.send_all().unwrap();
+
+        let last = (blocks - 1) as u64 * s.block_size as u64;
+        while s.send_buffer.block(last).unwrap().sent_count() == 0 {
+            s.send_data(&mut out).unwrap();
+        }
+
+        s
+    }
+
+    /// Returns an ACK payload reporting `blocks`, as `(index, lost)` pairs.
+    fn ack(s: &Connection, blocks: &[(u64, bool)]) -> Vec<u8> {
+        let mut payload = Vec::new();
+        payload.extend_from_slice(&0u64.to_be_bytes());
+
+        for (idx, lost) in blocks {
+            let off = idx * s.block_size as u64;
+            payload.extend_from_slice(&off.to_be_bytes());
+            payload.extend_from_slice(&(*lost as u64 * 3).to_be_bytes());
+        }
+
+        payload
+    }
+
+    /// The loss and delivery counters of `s`.
+    fn counters(
+        s: &Connection,
+    ) -> (usize, u64, [u64; PRIORITY_LEVELS], u64, [u64; PRIORITY_LEVELS], usize)
+    {
+        (
+            s.lost_count,
+            s.lost_bytes,
+            s.priority_lost_bytes,
+            s.window_delivered,
+            s.delivered_bytes,
+            s.high_priority,
+        )
+    }
+
+    #[test]
+    fn duplicate_ack_not_counted() {
+        let mut s = sender(4);
+        let block_len = s.block_size as u64;
+
+        let payload = ack(&s, &[(0, false), (1, true), (2, true)]);
+
+        s.process_ack(&payload).unwrap();
+        let first = counters(&s);
+        assert_eq!(first.0, 2);
+        assert_eq!(first.1, 2 * block_len);
+        assert_eq!(first.3, block_len);
+
+        s.process_ack(&payload).unwrap();
+        assert_eq!(counters(&s), first);
+
+        // A lost block then received is counted delivered once.
+        let payload = ack(&s, &[(1, false)]);
+        s.process_ack(&payload).unwrap();
+        s.process_ack(&payload).unwrap();
+
+        let second = counters(&s);
+        assert_eq!(second.0, 2);
+        assert_eq!(second.3, 2 * block_len);
+    }
+
+    #[test]
+    fn sent_blocks_keep_priority() {
+        // Zero data: every block has the highest priority.
+        let mut s = sender(2);
+        assert_eq!(s.sent_priority(0), 3);
+
+        // New split points, as after `data_finish()`.
+        s.low_split_point = 1.0;
+        s.high_split_point = 1.0;
+        assert_eq!(s.priority_calculation(0), 1);
+
+        assert_eq!(s.sent_priority(0), 3);
+        assert_eq!(s.on_block_status(0, true), 0.25);
+    }
+
+    #[test]
+    fn reset_received_blocks() {
+        let (mut s, mut c) = pair();
+        let mut out = vec![0; MAX_UDP_PAYLOAD_SIZE];
+
+        s.send_all().unwrap();
+        for _ in 0..4 {
+            let (n, _) = s.send_data(&mut out).unwrap();
+            c.recv_slice(&mut out[..n]).unwrap();
+        }
+
+        assert!(c.is_block_received(0));
+        assert_eq!(c.block_priority(0), Some(3));
+        assert_ne!(c.received_blocks(), []);
+
+        c.reset_received_blocks();
+
+        assert!(!c.is_block_received(0));
+        assert_eq!(c.block_priority(0), None);
+        assert_eq!(c.received_blocks(), []);
+
+        // The data received is still buffered.
+        assert!(c.rec_buffer.ready());
+    }
+
+    #[test]
+    fn connection_is_send_and_sync() {
+        fn assert_send_sync<T: Send + Sync>() {}
+
+        assert_send_sync::<Connection>();
+    }
+
+    #[test]
+    fn recv_buf_block_size() {
+        let mut buf = RecvBuf::new();
+
+        assert_eq!(buf.set_block_size(0), Err(Error::InvalidState));
+        assert_eq!(buf.set_block_size(1536), Err(Error::InvalidState));
+        assert_eq!(
+            buf.set_block_size(MAX_BLOCK_SIZE + SEND_BUFFER_SIZE),
+            Err(Error::InvalidState)
+        );
+        assert_eq!(buf.set_block_size(2 * SEND_BUFFER_SIZE), Ok(()));
+
+        // Not once data was received.
+        let mut data = vec![0; 2 * SEND_BUFFER_SIZE];
+        buf.write(&mut data, 0, 1).unwrap();
+        assert_eq!(
+            buf.set_block_size(SEND_BUFFER_SIZE),
+            Err(Error::InvalidState)
+        );
+        assert_eq!(buf.block_size, 2 * SEND_BUFFER_SIZE);
+    }
+}
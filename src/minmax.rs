@@ -0,0 +1,154 @@
+// Windowed minimum filter.
+//
+// Kathleen Nichols' algorithm for tracking the minimum of a value over a
+// sliding time window, as used by the Linux kernel and BBR for the minimum
+// RTT. Only the best, second best and third best samples are kept, so an
+// update is constant time and never allocates.
+
+use std::time::Duration;
+use std::time::Instant;
+
+/// A sample and the time it was taken.
+#[derive(Copy, Clone, Debug)]
+struct MinmaxSample<T> {
+    time: Instant,
+    value: T,
+}
+
+/// Tracks the minimum of a value over a sliding time window.
+#[derive(Copy, Clone, Debug)]
+pub struct Minmax<T> {
+    estimate: [MinmaxSample<T>; 3],
+}
+
+impl<T: PartialOrd + Copy> Minmax<T> {
+    /// Creates a filter whose estimate is `val` until a sample is taken.
+    pub fn new(val: T) -> Self {
+        Minmax {
+            estimate: [MinmaxSample {
+                time: Instant::now(),
+                value: val,
+            }; 3],
+        }
+    }
+
+    /// Restarts the window with `meas` taken at `time` as the only sample.
+    pub fn reset(&mut self, time: Instant, meas: T) -> T {
+        let val = MinmaxSample { time, value: meas };
+
+        for i in self.estimate.iter_mut() {
+            *i = val;
+        }
+
+        self.estimate[0].value
+    }
+
+    /// Adds sample `meas` taken at `time`, and returns the minimum over the
+    /// last `win`.
+    pub fn running_min(&mut self, win: Duration, time: Instant, meas: T) -> T {
+        let val = MinmaxSample { time, value: meas };
+
+        let delta_time = time.saturating_duration_since(self.estimate[2].time);
+
+        // Reset if there's nothing in the window or a new minimum value is
+        // found.
+        if val.value <= self.estimate[0].value || delta_time > win {
+            return self.reset(time, meas);
+        }
+
+        if val.value <= self.estimate[1].value {
+            self.estimate[2] = val;
+            self.estimate[1] = val;
+        } else if val.value <= self.estimate[2].value {
+            self.estimate[2] = val;
+        }
+
+        self.subwin_update(win, time, meas)
+    }
+
+    /// Updates the best samples as they age out of their part of the
+    /// window.
+    fn subwin_update(&mut self, win: Duration, time: Instant, meas: T) -> T {
+        let val = MinmaxSample { time, value: meas };
+
+        let delta_time = time.saturating_duration_since(self.estimate[0].time);
+
+        if delta_time > win {
+            // The best sample expired, promote the second and third best
+            // and start over with the new sample as third best.
+            self.estimate[0] = self.estimate[1];
+            self.estimate[1] = self.estimate[2];
+            self.estimate[2] = val;
+
+            if time.saturating_duration_since(self.estimate[0].time) > win {
+                self.estimate[0] = self.estimate[1];
+                self.estimate[1] = self.estimate[2];
+                self.estimate[2] = val;
+            }
+        } else if self.estimate[1].time == self.estimate[0].time &&
+            delta_time > win / 4
+        {
+            // A quarter of the window passed without a better second
+            // sample, take one.
+            self.estimate[2] = val;
+            self.estimate[1] = val;
+        } else if self.estimate[2].time == self.estimate[1].time &&
+            delta_time > win / 2
+        {
+            // Half the window passed without a better third sample, take
+            // one.
+            self.estimate[2] = val;
+        }
+
+        self.estimate[0].value
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const WIN: Duration = Duration::from_secs(10);
+
+    fn secs(s: u64) -> Duration {
+        Duration::from_secs(s)
+    }
+
+    #[test]
+    fn lower_sample_resets() {
+        let now = Instant::now();
+        let mut f = Minmax::new(0);
+
+        assert_eq!(f.reset(now, 50), 50);
+        assert_eq!(f.running_min(WIN, now + secs(1), 60), 50);
+        assert_eq!(f.running_min(WIN, now + secs(2), 40), 40);
+        assert_eq!(f.running_min(WIN, now + secs(3), 45), 40);
+    }
+
+    #[test]
+    fn minimum_expires() {
+        let now = Instant::now();
+        let mut f = Minmax::new(0);
+
+        f.reset(now, 50);
+
+        // The second and third best are taken as the window goes by.
+        assert_eq!(f.running_min(WIN, now + secs(3), 70), 50);
+        assert_eq!(f.running_min(WIN, now + secs(6), 80), 50);
+
+        // Once the best one is out of the window, the second best is.
+        assert_eq!(f.running_min(WIN, now + secs(11), 90), 70);
+        assert_eq!(f.running_min(WIN, now + secs(14), 95), 80);
+    }
+
+    #[test]
+    fn empty_window_resets() {
+        let now = Instant::now();
+        let mut f = Minmax::new(Duration::ZERO);
+
+        f.reset(now, Duration::from_millis(10));
+
+        let rtt = Duration::from_millis(30);
+        assert_eq!(f.running_min(WIN, now + secs(30), rtt), rtt);
+    }
+}
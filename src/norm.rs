@@ -0,0 +1,263 @@
+// Per-block squared L2 norms used to assign data priorities.
+//
+// Every block of application data is a block of native-endian f32 values,
+// whose size is negotiated with the peer when the connection starts. Its
+// priority is derived from the squared L2 norm of the block, so the norms of
+// a whole iteration have to be computed before the first packet is sent.
+// The kernels below run at memory bandwidth on x86 and pick the widest
+// instruction set available at runtime.
+
+/// Number of independent accumulators used by the scalar kernel, so that the
+/// compiler is free to vectorize it.
+const LANES: usize = 8;
+
+/// Appends the squared L2 norm of every `block_size` bytes of `data` to `out`.
+///
+/// `data` is interpreted as native-endian f32 values. The last block may be
+/// shorter than `block_size`, trailing bytes that do not form a whole f32 are
+/// ignored. `block_size` must be a non-zero multiple of 4.
+pub fn block_norm2(data: &[u8], block_size: usize, out: &mut Vec<f32>) {
+    assert!(
+        block_size > 0 && block_size % 4 == 0,
+        "block size (is {}) should be a non-zero multiple of 4",
+        block_size
+    );
+
+    out.reserve((data.len() + block_size - 1) / block_size);
+
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+    {
+        #[cfg(feature = "avx512")]
+        if is_x86_feature_detected!("avx512f") {
+            return unsafe { x86::block_norm2_avx512(data, block_size, out) };
+        }
+
+        if is_x86_feature_detected!("avx2") {
+            return unsafe { x86::block_norm2_avx2(data, block_size, out) };
+        }
+
+        if is_x86_feature_detected!("sse") {
+            return unsafe { x86::block_norm2_sse(data, block_size, out) };
+        }
+    }
+
+    block_norm2_scalar(data, block_size, out);
+}
+
+/// Portable fallback of `block_norm2()`.
+fn block_norm2_scalar(data: &[u8], block_size: usize, out: &mut Vec<f32>) {
+    for block in data.chunks(block_size) {
+        out.push(norm2_scalar(block));
+    }
+}
+
+/// Returns the squared L2 norm of the f32 values in `block`.
+#[inline(always)]
+fn norm2_scalar(block: &[u8]) -> f32 {
+    let mut acc = [0.0f32; LANES];
+
+    let mut chunks = block.chunks_exact(4 * LANES);
+    for chunk in &mut chunks {
+        for (i, v) in chunk.chunks_exact(4).enumerate() {
+            let v = f32::from_ne_bytes(v.try_into().unwrap());
+            acc[i] += v * v;
+        }
+    }
+
+    let mut norm2: f32 = acc.iter().sum();
+    for v in chunks.remainder().chunks_exact(4) {
+        let v = f32::from_ne_bytes(v.try_into().unwrap());
+        norm2 += v * v;
+    }
+
+    norm2
+}
+
+#[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+mod x86 {
+    #[cfg(target_arch = "x86")]
+    use std::arch::x86::*;
+    #[cfg(target_arch = "x86_64")]
+    use std::arch::x86_64::*;
+
+    use super::norm2_scalar;
+
+    /// SSE version of `block_norm2()`, 16 floats per iteration.
+    #[target_feature(enable = "sse")]
+    pub unsafe fn block_norm2_sse(
+        data: &[u8], block_size: usize, out: &mut Vec<f32>,
+    ) {
+        for block in data.chunks(block_size) {
+            let mut acc = [_mm_setzero_ps(); 4];
+
+            let mut chunks = block.chunks_exact(64);
+            for chunk in &mut chunks {
+                let p = chunk.as_ptr() as *const f32;
+                for (i, a) in acc.iter_mut().enumerate() {
+                    let v = _mm_loadu_ps(p.add(4 * i));
+                    *a = _mm_add_ps(*a, _mm_mul_ps(v, v));
+                }
+            }
+
+            let sum = _mm_add_ps(
+                _mm_add_ps(acc[0], acc[1]),
+                _mm_add_ps(acc[2], acc[3]),
+            );
+
+            out.push(hsum_sse(sum) + norm2_scalar(chunks.remainder()));
+        }
+    }
+
+    /// AVX2 version of `block_norm2()`, 32 floats per iteration.
+    #[target_feature(enable = "avx2")]
+    pub unsafe fn block_norm2_avx2(
+        data: &[u8], block_size: usize, out: &mut Vec<f32>,
+    ) {
+        for block in data.chunks(block_size) {
+            let mut acc = [_mm256_setzero_ps(); 4];
+
+            let mut chunks = block.chunks_exact(128);
+            for chunk in &mut chunks {
+                let p = chunk.as_ptr() as *const f32;
+                for (i, a) in acc.iter_mut().enumerate() {
+                    let v = _mm256_loadu_ps(p.add(8 * i));
+                    *a = _mm256_add_ps(*a, _mm256_mul_ps(v, v));
+                }
+            }
+
+            let sum = _mm256_add_ps(
+                _mm256_add_ps(acc[0], acc[1]),
+                _mm256_add_ps(acc[2], acc[3]),
+            );
+            let sum = _mm_add_ps(
+                _mm256_castps256_ps128(sum),
+                _mm256_extractf128_ps(sum, 1),
+            );
+
+            out.push(hsum_sse(sum) + norm2_scalar(chunks.remainder()));
+        }
+    }
+
+    /// AVX-512 version of `block_norm2()`, 64 floats per iteration. Only
+    /// built with the `avx512` feature, as it needs Rust 1.89.
+    #[cfg(feature = "avx512")]
+    #[target_feature(enable = "avx512f")]
+    pub unsafe fn block_norm2_avx512(
+        data: &[u8], block_size: usize, out: &mut Vec<f32>,
+    ) {
+        for block in data.chunks(block_size) {
+            let mut acc = [_mm512_setzero_ps(); 4];
+
+            let mut chunks = block.chunks_exact(256);
+            for chunk in &mut chunks {
+                let p = chunk.as_ptr() as *const f32;
+                for (i, a) in acc.iter_mut().enumerate() {
+                    let v = _mm512_loadu_ps(p.add(16 * i));
+                    *a = _mm512_add_ps(*a, _mm512_mul_ps(v, v));
+                }
+            }
+
+            let sum = _mm512_add_ps(
+                _mm512_add_ps(acc[0], acc[1]),
+                _mm512_add_ps(acc[2], acc[3]),
+            );
+
+            out.push(_mm512_reduce_add_ps(sum) + norm2_scalar(chunks.remainder()));
+        }
+    }
+
+    /// Returns the sum of the four lanes of `v`.
+    #[inline(always)]
+    unsafe fn hsum_sse(v: __m128) -> f32 {
+        let hi = _mm_movehl_ps(v, v);
+        let sum = _mm_add_ps(v, hi);
+        let hi = _mm_shuffle_ps(sum, sum, 0x1);
+        _mm_cvtss_f32(_mm_add_ss(sum, hi))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Returns `floats` values in [-8, 8) as native-endian bytes.
+    fn data(floats: usize) -> Vec<u8> {
+        let mut x: u32 = 0x9e37_79b9;
+
+        (0..floats)
+            .flat_map(|_| {
+                x ^= x << 13;
+                x ^= x >> 17;
+                x ^= x << 5;
+                ((x % 16_000) as f32 / 1000.0 - 8.0).to_ne_bytes()
+            })
+            .collect()
+    }
+
+    fn assert_close(a: &[f32], b: &[f32]) {
+        assert_eq!(a.len(), b.len());
+
+        for (a, b) in a.iter().zip(b) {
+            assert!((a - b).abs() <= 1e-5 * b.abs().max(1.0), "{} != {}", a, b);
+        }
+    }
+
+    #[test]
+    fn dispatch_matches_scalar() {
+        // Whole blocks, a short last block and a trailing partial f32.
+        let mut v = data(10_000);
+        v.extend_from_slice(&[1, 2]);
+
+        for block_size in [1024, 4096, 8192, 1000, 4] {
+            let mut expected = Vec::new();
+            block_norm2_scalar(&v, block_size, &mut expected);
+
+            let mut out = Vec::new();
+            block_norm2(&v, block_size, &mut out);
+
+            assert_eq!(expected.len(), (v.len() + block_size - 1) / block_size);
+            assert_close(&out, &expected);
+        }
+    }
+
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+    #[test]
+    fn x86_kernels_match_scalar() {
+        let v = data(10_000);
+
+        for block_size in [1024, 8192, 1000] {
+            let mut expected = Vec::new();
+            block_norm2_scalar(&v, block_size, &mut expected);
+
+            if is_x86_feature_detected!("sse") {
+                let mut out = Vec::new();
+                unsafe { x86::block_norm2_sse(&v, block_size, &mut out) };
+                assert_close(&out, &expected);
+            }
+
+            if is_x86_feature_detected!("avx2") {
+                let mut out = Vec::new();
+                unsafe { x86::block_norm2_avx2(&v, block_size, &mut out) };
+                assert_close(&out, &expected);
+            }
+
+            #[cfg(feature = "avx512")]
+            if is_x86_feature_detected!("avx512f") {
+                let mut out = Vec::new();
+                unsafe { x86::block_norm2_avx512(&v, block_size, &mut out) };
+                assert_close(&out, &expected);
+            }
+        }
+    }
+
+    #[test]
+    fn scalar_is_exact_on_small_integers() {
+        let v: Vec<u8> = (0..256u32).flat_map(|x| (x as f32).to_ne_bytes()).collect();
+
+        let mut out = Vec::new();
+        block_norm2(&v, 1024, &mut out);
+
+        let expected: u32 = (0..256u32).map(|x| x * x).sum();
+        assert_eq!(out, vec![expected as f32]);
+    }
+}
@@ -1,3 +1,7 @@
+use std::cmp;
+
+use crate::block;
+use crate::Error;
 use crate::Result;
 
 // const FORM_BIT: u8 = 0x03;
@@ -40,9 +44,67 @@ pub enum Type {
 
     // StartACK
     StartAck = 0x08,
+
+    /// Parity of a stripe of data blocks.
+    Fec = 0x09,
 }
 
 
+/// The header format version, in the two top bits of the first byte.
+/// Legacy headers start with the packet type, so these bits are clear.
+const VERSION_MASK: u8 = 0xc0;
+
+/// Compact header format version.
+///
+/// The first byte holds the version, the priority in bits 4-5 and the packet
+/// type in the low nibble. It is followed by the packet number and the block
+/// index of the payload as varints. The payload length is not sent, the
+/// payload runs to the end of the datagram.
+const COMPACT_HEADER_VERSION: u8 = 0x40;
+
+const PRIORITY_MASK: u8 = 0x30;
+
+const PRIORITY_SHIFT: u8 = 4;
+
+const TYPE_MASK: u8 = 0x0f;
+
+/// Packet types of the compact header, indexed by the low nibble of the
+/// first byte.
+const COMPACT_TYPES: [Type; 16] = [
+    Type::StartAck,
+    Type::Retry,
+    Type::Handshake,
+    Type::Application,
+    Type::ElictAck,
+    Type::ACK,
+    Type::Stop,
+    Type::Fin,
+    Type::StartAck,
+    Type::Fec,
+    Type::StartAck,
+    Type::StartAck,
+    Type::StartAck,
+    Type::StartAck,
+    Type::StartAck,
+    Type::StartAck,
+];
+
+/// Returns the number of bytes the packet number takes in a compact header.
+///
+/// Packet numbers are written on at least 4 bytes, so that consecutive data
+/// packets have the same length and can be sent with GSO.
+#[inline]
+fn pkt_num_len(pkt_num: u64) -> usize {
+    cmp::max(octets::varint_len(pkt_num), 4)
+}
+
+/// Returns the length of a compact header, with the block index written on
+/// `index_len` bytes.
+#[inline]
+pub fn compact_header_len(pkt_num: u64, index_len: usize) -> usize {
+    1 + pkt_num_len(pkt_num) + index_len
+}
+
 /// A QUIC packet's header.
 #[derive(Clone, PartialEq, Eq)]
 pub struct Header {
@@ -63,32 +125,40 @@ pub struct Header {
 impl<'a> Header {
     /// Parses a QUIC packet header from the given buffer.
     ///
-    /// The `dcid_len` parameter is the length of the destination connection ID,
-    /// required to parse short header packets.
+    /// The `block_size` parameter is the block size of the connection, see
+    /// [`Connection::block_size()`], required to compute the offset of
+    /// compact headers.
     ///
     /// ## Examples:
     ///
     /// ```no_run
-    /// # const LOCAL_CONN_ID_LEN: usize = 16;
     /// # let mut buf = [0; 512];
-    /// # let mut out = [0; 512];
     /// # let socket = std::net::UdpSocket::bind("127.0.0.1:0").unwrap();
+    /// # let conn: dmludp::Connection = unimplemented!();
     /// let (len, src) = socket.recv_from(&mut buf).unwrap();
     ///
-    /// let hdr = quiche::Header::from_slice(&mut buf[..len], LOCAL_CONN_ID_LEN)?;
-    /// # Ok::<(), quiche::Error>(())
+    /// let hdr = dmludp::Header::from_slice(&mut buf[..len], conn.block_size())?;
+    /// # Ok::<(), dmludp::Error>(())
     /// ```
+    ///
+    /// [`Connection::block_size()`]: struct.Connection.html#method.block_size
     #[inline]
     pub fn from_slice<'b>(
-        buf: &'b mut [u8], 
+        buf: &'b mut [u8], block_size: usize,
     ) -> Result<Header> {
         let mut b = octets::OctetsMut::with_slice(buf);
-        Header::from_bytes(&mut b)
+        Header::from_bytes(&mut b, block_size)
     }
 
+    /// Parses a header. The offset of a compact header is computed from the
+    /// block index with `block_size`.
     pub(crate) fn from_bytes<'b>(
-        b: &'b mut octets::OctetsMut, 
+        b: &'b mut octets::OctetsMut, block_size: usize,
     ) -> Result<Header> {
+        if b.peek_u8()? & VERSION_MASK == COMPACT_HEADER_VERSION {
+            return Header::from_bytes_compact(b, block_size);
+        }
+
         let first = b.get_u8()?;
 
         let ty = if first == 0x01{
@@ -105,6 +175,8 @@ impl<'a> Header {
             Type::Stop
         }else if first == 0x07{
             Type::Fin
+        }else if first == 0x09{
+            Type::Fec
         }else{
             Type::StartAck
         };
@@ -124,6 +196,60 @@ impl<'a> Header {
         })
     }
 
+    /// Parses a compact header. The payload length is what is left of the
+    /// buffer.
+    fn from_bytes_compact(
+        b: &mut octets::OctetsMut, block_size: usize,
+    ) -> Result<Header> {
+        let first = b.get_u8()?;
+        let pkt_num = b.get_varint()?;
+        let index = b.get_varint()?;
+
+        if index >= block::MAX_BLOCKS {
+            return Err(Error::InvalidPacket);
+        }
+
+        let offset = index
+            .checked_mul(block_size as u64)
+            .ok_or(Error::InvalidPacket)?;
+
+        Ok(Header {
+            ty: COMPACT_TYPES[(first & TYPE_MASK) as usize],
+            pkt_num,
+            priority: (first & PRIORITY_MASK) >> PRIORITY_SHIFT,
+            offset,
+            pkt_length: b.cap() as u64,
+        })
+    }
+
+    /// Writes a compact header, with the block index written on `index_len`
+    /// bytes, so that its length is known before the payload is.
+    ///
+    /// The offset must be a multiple of `block_size`, its block index must
+    /// fit in `index_len` bytes, and the priority must fit in two bits.
+    pub(crate) fn to_bytes_compact(
+        &self, out: &mut octets::OctetsMut, index_len: usize, block_size: usize,
+    ) -> Result<()> {
+        let index = self.offset / block_size as u64;
+
+        if self.priority > PRIORITY_MASK >> PRIORITY_SHIFT ||
+            self.offset % block_size as u64 != 0 ||
+            octets::varint_len(index) > index_len
+        {
+            return Err(Error::InvalidPacket);
+        }
+
+        let first = COMPACT_HEADER_VERSION |
+            (self.priority << PRIORITY_SHIFT) |
+            self.ty as u8;
+
+        out.put_u8(first)?;
+        out.put_varint_with_len(self.pkt_num, pkt_num_len(self.pkt_num))?;
+        out.put_varint_with_len(index, index_len)?;
+
+        Ok(())
+    }
+
     pub(crate) fn to_bytes(&self, out: &mut octets::OctetsMut) -> Result<()> {
         
         let first:u8 = if self.ty == Type::Retry{
@@ -138,6 +264,8 @@ impl<'a> Header {
             0x05 as u8
         }else if self.ty == Type::Stop{
             0x06 as u8
+        }else if self.ty == Type::Fec{
+            0x09 as u8
         }else{
             0x07 as u8
         };
@@ -152,9 +280,9 @@ impl<'a> Header {
         Ok(())
     }
 
-    /// Returns true if the packet has a long header.
-    ///
-    /// The `b` parameter represents the first byte of the QUIC header.
+    // Returns true if the packet has a long header.
+    //
+    // The `b` parameter represents the first byte of the QUIC header.
     // fn is_application(b: u8) -> bool {
     //     b & FORM_BIT != FORM_BIT
     // }
@@ -162,175 +290,402 @@ impl<'a> Header {
     // fn is_retry(b: u8) -> bool {
     //     b & FORM_RETRY != FORM_RETRY
     // }
+}
+
+/// Handshake flag, carried in the `priority` field of Handshake packets,
+/// advertising support for compact ACK and ElictAck payloads.
+pub const HANDSHAKE_COMPACT_ACK: u8 = 0x01;
+
+/// Handshake flag advertising support for compact packet headers. Handshake
+/// packets themselves always use the legacy header.
+pub const HANDSHAKE_COMPACT_HEADER: u8 = 0x02;
+
+/// Handshake flag advertising support for Fec packets.
+pub const HANDSHAKE_FEC: u8 = 0x04;
+
+/// Writes a list of block indices as run-length ranges.
+///
+/// `blocks` must be sorted and free of duplicates. The ranges are written
+/// as a varint range count followed by a `(gap, length)` varint pair per
+/// range of consecutive blocks, the gap being counted from the end of the
+/// previous range. A window of contiguous blocks thus takes a few bytes no
+/// matter how many blocks it holds.
+pub fn encode_block_ranges(
+    b: &mut octets::OctetsMut, blocks: &[u64],
+) -> Result<()> {
+    let ranges = blocks.windows(2).filter(|w| w[1] != w[0] + 1).count() +
+        usize::from(!blocks.is_empty());
+
+    b.put_varint(ranges as u64)?;
+
+    let mut end = 0;
+    let mut i = 0;
+
+    while i < blocks.len() {
+        let start = blocks[i];
+
+        let mut j = i + 1;
+        while j < blocks.len() && blocks[j] == blocks[j - 1] + 1 {
+            j += 1;
+        }
 
-    //Returning the length of the header
-    pub fn len(&self)-> usize{
-        26
+        b.put_varint(start - end)?;
+        b.put_varint((j - i) as u64)?;
+
+        end = start + (j - i) as u64;
+        i = j;
     }
+
+    Ok(())
+}
+
+/// Parses ranges written by `encode_block_ranges()`, appending the block
+/// indices to `blocks` in increasing order.
+///
+/// At most `max_blocks` blocks are accepted, so that a bogus length can't
+/// make the receiver spin.
+pub fn decode_block_ranges(
+    b: &mut octets::OctetsMut, max_blocks: u64, blocks: &mut Vec<u64>,
+) -> Result<()> {
+    let ranges = b.get_varint()?;
+
+    let mut end: u64 = 0;
+    let mut count: u64 = 0;
+
+    for _ in 0..ranges {
+        let gap = b.get_varint()?;
+        let len = b.get_varint()?;
+
+        count = count.saturating_add(len);
+        if count > max_blocks {
+            return Err(Error::InvalidPacket);
+        }
+
+        let start = end.checked_add(gap).ok_or(Error::InvalidPacket)?;
+        end = start.checked_add(len).ok_or(Error::InvalidPacket)?;
+
+        blocks.extend(start..end);
+    }
+
+    Ok(())
 }
 #[derive(Clone)]
 pub struct PktNumSpace {
 
     pub next_pkt_num: u64,
-
-    pub recv_pkt_num: PktNumWindow,
-
 }
 
 impl PktNumSpace {
     pub fn new() -> PktNumSpace {
         PktNumSpace {
             next_pkt_num: 0,
-
-            recv_pkt_num: PktNumWindow::default(),
-
         }
     }
 
 
 }
-// #[derive(Clone, Default)]
-// // #[derive(Clone, Copy, Default)]
-// pub struct PktNumWindow {
- 
-//     pub record:std::collections::HashMap<u64,[u64;4]>,
-// }
-
-// impl PktNumWindow {
-//     pub fn additem(&mut self, offset: u64, priority:usize, pkt_length:usize) {
-//         let recived:usize = 1;
-//         let retrans:usize = priority;
-//         let record_pair:[u64;4] = [priority as u64,pkt_length as u64,retrans as u64 ,recived as u64];
-//         self.record.insert(offset,record_pair);
-//     }
-
-//     pub fn insert_not(&mut self,offset:u64){
-//         let recived:usize = 0;
-//         let record_pair:[u64;4] = [3,0,2,recived as u64];
-//         self.record.insert(offset,record_pair);
-//     }
-
-//     pub fn update_recived(&mut self, offset: u64){
-//         let [pri, plength, mut retrans,_recived]= self.record[&offset];
-//         if retrans > 0{
-//             retrans -=1;
-//         }
-
-//         *self.record.get_mut(&offset).unwrap()  = [pri, plength, retrans,1];
-//     }
-
-//     fn get_length(&mut self, offset:&u64) -> u64 {
-//         let [_pri, plength, mut _retrans,_recived]= self.record[&offset];
-//         plength
-//     }
-// }
-#[derive(Clone, Default)]
-// #[derive(Clone, Copy, Default)]
-pub struct PktNumWindow {
-    pub priority_record:std::collections::HashMap<u64,u64>,
-    pub record:std::collections::HashMap<u64,[u64;2]>,
-}
-impl PktNumWindow {
-    //add item pair(offset, priority)
-    pub fn additem(&mut self, offset: u64, priority:usize) {
-        if offset%1024 == 0{
-            self.priority_record.insert(offset,priority as u64);
-        }   
-        self.update_retrans(offset, priority.try_into().unwrap(), 1);
-    }
 
-    //
-    // pub fn exist_or_not(&mut self, offset: u64, priority:usize){
+#[cfg(test)]
+mod tests {
+    use super::*;
 
-    // }
+    const BLOCK_SIZE: usize = 1024;
 
-    pub fn get_priority(&self, offset:u64)->u64{
-        if self.priority_record.contains_key(&offset){
-            *self.priority_record.get(&offset).unwrap()
-        }else {
-            0 as u64
+    fn header(ty: Type, pkt_num: u64, priority: u8, offset: u64) -> Header {
+        Header {
+            ty,
+            pkt_num,
+            priority,
+            offset,
+            pkt_length: 0,
         }
     }
 
-    //check the received or not and update the retranmission times
-    pub fn check_received(&mut self, offset: u64, sent: bool)->bool{
-        if sent == false{
-            if self.record.contains_key(&offset){
-                let condition = self.record.get(&offset).unwrap();
-                let received = condition[1];
-                let retrans = condition[0];
-                if received == 1{
-                    return true
-                }else {
-                    if retrans > 0{
-                        self.update_retrans(offset, retrans-1, received);
-                    }else {
-                        self.update_retrans(offset, 0, 1);
+    /// Writes `hdr` in the compact format followed by `payload` bytes, and
+    /// parses it back.
+    fn compact_round_trip(
+        hdr: &Header, index_len: usize, payload: usize,
+    ) -> Result<(Header, usize)> {
+        let mut buf = [0; 256];
+
+        let len = {
+            let mut b = octets::OctetsMut::with_slice(&mut buf);
+            hdr.to_bytes_compact(&mut b, index_len, BLOCK_SIZE)?;
+            b.off()
+        };
+
+        let mut b = octets::OctetsMut::with_slice(&mut buf[..len + payload]);
+        Ok((Header::from_bytes(&mut b, BLOCK_SIZE)?, len))
+    }
+
+    #[test]
+    fn compact_header_round_trip() {
+        let types = [
+            Type::Retry,
+            Type::Handshake,
+            Type::Application,
+            Type::ElictAck,
+            Type::ACK,
+            Type::Stop,
+            Type::Fin,
+            Type::Fec,
+        ];
+
+        let index_len = octets::varint_len(block::MAX_BLOCKS);
+
+        for ty in types.iter() {
+            for pkt_num in [0, 63, 64, 1 << 30, (1 << 62) - 1] {
+                for priority in 0..=3 {
+                    for index in [0, 1, 63, 16383, block::MAX_BLOCKS - 1] {
+                        let offset = index * BLOCK_SIZE as u64;
+                        let hdr = header(*ty, pkt_num, priority, offset);
+
+                        let (parsed, len) =
+                            compact_round_trip(&hdr, index_len, 100).unwrap();
+
+                        assert_eq!(len, compact_header_len(pkt_num, index_len));
+                        assert_eq!(parsed.ty, *ty);
+                        assert_eq!(parsed.pkt_num, pkt_num);
+                        assert_eq!(parsed.priority, priority);
+                        assert_eq!(parsed.offset, offset);
+                        assert_eq!(parsed.pkt_length, 100);
                     }
-                    return false
-                }
-            }else {
-                //
-                let priority = self.get_priority(offset - offset%1024);
-                if priority == 0{
-                    self.additem(offset - offset%1024, 3);
-                    self.update_retrans(offset, 2, 0);
-                }else {
-                    self.update_retrans(offset, priority-1, 0);
-                }
-                return false
-            }
-        }else{
-            if self.record.contains_key(&offset){
-                let condition = self.record.get(&offset).unwrap();
-                let received = condition[1];
-                let _retrans = condition[0];
-                if received == 1{
-                    return true
-                }else {
-                    return false
                 }
-            }else {
-                return false
             }
         }
-        
     }
 
-    pub fn get_retrans_times(& self, offset: u64)->u64{
-        if self.record.contains_key(&offset){
-            let retrans = self.record.get(&offset).unwrap()[0];
-            let recv = self.record.get(&offset).unwrap()[1];
-            if recv == 1{
-                return 0
-            }else {
-                return retrans+1
-            }
-        }else {
-            return 0
+    #[test]
+    fn compact_header_fixed_length() {
+        // Data packets of a window have the same header length, whatever
+        // their packet number and block index.
+        for pkt_num in [0, 1, 63, 64, 16383, 16384, (1 << 30) - 1] {
+            assert_eq!(compact_header_len(pkt_num, 4), 9);
         }
+
+        let hdr = header(Type::Application, 1, 3, 5 * BLOCK_SIZE as u64);
+        let (_, len) = compact_round_trip(&hdr, 4, 0).unwrap();
+        assert_eq!(len, 9);
     }
 
-    pub fn update_item(& mut self, offset: u64, priority:usize){
-        if offset%1024 == 0{
-            self.priority_record.insert(offset,priority as u64);
-        }   
-        self.update_retrans(offset, priority.try_into().unwrap(), 1);
+    #[test]
+    fn compact_header_invalid() {
+        let mut buf = [0; 64];
+        let mut b = octets::OctetsMut::with_slice(&mut buf);
+
+        // The priority takes two bits.
+        let hdr = header(Type::Application, 0, 4, 0);
+        assert_eq!(
+            hdr.to_bytes_compact(&mut b, 4, BLOCK_SIZE),
+            Err(Error::InvalidPacket)
+        );
+
+        // The offset must be on a block boundary.
+        let hdr = header(Type::Application, 0, 1, BLOCK_SIZE as u64 + 1);
+        assert_eq!(
+            hdr.to_bytes_compact(&mut b, 4, BLOCK_SIZE),
+            Err(Error::InvalidPacket)
+        );
+
+        // The block index must fit in its length.
+        let hdr = header(Type::Application, 0, 1, 64 * BLOCK_SIZE as u64);
+        assert_eq!(
+            hdr.to_bytes_compact(&mut b, 1, BLOCK_SIZE),
+            Err(Error::InvalidPacket)
+        );
+
+        // A block index past the last block of the block table is
+        // rejected.
+        let hdr = header(
+            Type::Application,
+            0,
+            1,
+            block::MAX_BLOCKS * BLOCK_SIZE as u64,
+        );
+        assert_eq!(
+            compact_round_trip(&hdr, 8, 0).map(|_| ()),
+            Err(Error::InvalidPacket)
+        );
+
+        // So is one whose offset overflows.
+        let mut buf = [0; 64];
+        let len = {
+            let mut b = octets::OctetsMut::with_slice(&mut buf);
+            b.put_u8(COMPACT_HEADER_VERSION | Type::Application as u8)
+                .unwrap();
+            b.put_varint(0).unwrap();
+            b.put_varint(block::MAX_BLOCKS - 1).unwrap();
+            b.off()
+        };
+
+        let mut b = octets::OctetsMut::with_slice(&mut buf[..len]);
+        assert_eq!(
+            Header::from_bytes(&mut b, usize::MAX).map(|_| ()),
+            Err(Error::InvalidPacket)
+        );
     }
 
-    pub fn update_retrans(&mut self, offset: u64, retrans: u64, received: u64){
-        let new_condition:[u64;2] = [retrans, received];
-        self.record.insert(offset, new_condition);
+    #[test]
+    fn compact_header_truncated() {
+        let hdr = header(Type::Application, 1 << 20, 2, 77 * BLOCK_SIZE as u64);
+
+        let mut buf = [0; 64];
+        let len = {
+            let mut b = octets::OctetsMut::with_slice(&mut buf);
+            hdr.to_bytes_compact(&mut b, 4, BLOCK_SIZE).unwrap();
+            b.off()
+        };
+
+        for cut in 0..len {
+            let mut b = octets::OctetsMut::with_slice(&mut buf[..cut]);
+            assert_eq!(
+                Header::from_bytes(&mut b, BLOCK_SIZE).map(|_| ()),
+                Err(Error::BufferTooShort)
+            );
+        }
+
+        let mut b = octets::OctetsMut::with_slice(&mut buf[..len]);
+        let parsed = Header::from_bytes(&mut b, BLOCK_SIZE).unwrap();
+        assert_eq!(parsed.offset, hdr.offset);
+        assert_eq!(parsed.pkt_length, 0);
+
+        // Writing into a buffer too short for the header fails.
+        for cut in 0..len {
+            let mut b = octets::OctetsMut::with_slice(&mut buf[..cut]);
+            assert_eq!(
+                hdr.to_bytes_compact(&mut b, 4, BLOCK_SIZE),
+                Err(Error::BufferTooShort)
+            );
+        }
     }
 
-    // pub fn update_recived(& mut self, offset: u64){
-    //     if self.record.contains_key(&offset){
-    //         self.record.insert(offset, [self.record.get(&offset).unwrap()[0],1]);
-    //     }
-    // }
+    #[test]
+    fn legacy_header_round_trip() {
+        let mut hdr = header(Type::Fec, 12345, 2, 77 * BLOCK_SIZE as u64 + 3);
+        hdr.pkt_length = 1000;
+
+        let mut buf = [0; 64];
+        let len = {
+            let mut b = octets::OctetsMut::with_slice(&mut buf);
+            hdr.to_bytes(&mut b).unwrap();
+            b.off()
+        };
+
+        assert_eq!(len, crate::HEADER_LENGTH);
+
+        let mut b = octets::OctetsMut::with_slice(&mut buf[..len]);
+        assert!(Header::from_bytes(&mut b, BLOCK_SIZE).unwrap() == hdr);
+
+        let mut b = octets::OctetsMut::with_slice(&mut buf[..len - 1]);
+        assert_eq!(
+            Header::from_bytes(&mut b, BLOCK_SIZE).map(|_| ()),
+            Err(Error::BufferTooShort)
+        );
+    }
 
-    pub fn clear_record(& mut self){
-        self.record.clear();
+    /// Encodes `blocks` as ranges and decodes them back, returning the
+    /// encoded length.
+    fn ranges_round_trip(blocks: &[u64]) -> usize {
+        let mut buf = vec![0; 16 + blocks.len() * 16];
+
+        let len = {
+            let mut b = octets::OctetsMut::with_slice(&mut buf);
+            encode_block_ranges(&mut b, blocks).unwrap();
+            b.off()
+        };
+
+        let mut decoded = Vec::new();
+        let mut b = octets::OctetsMut::with_slice(&mut buf[..len]);
+        decode_block_ranges(&mut b, block::MAX_BLOCKS, &mut decoded).unwrap();
+
+        assert_eq!(decoded, blocks);
+        assert_eq!(b.cap(), 0);
+
+        len
     }
 
+    #[test]
+    fn block_ranges_round_trip() {
+        assert_eq!(ranges_round_trip(&[]), 1);
+        assert_eq!(ranges_round_trip(&[0]), 3);
+
+        // A contiguous window takes a few bytes, whatever its length.
+        let window: Vec<u64> = (1000..2024).collect();
+        assert_eq!(ranges_round_trip(&window), 5);
+
+        let holes: Vec<u64> = (1000..2024).filter(|b| b % 64 != 0).collect();
+        ranges_round_trip(&holes);
+
+        let alternate: Vec<u64> = (0..1024).filter(|b| b % 2 == 0).collect();
+        ranges_round_trip(&alternate);
+
+        ranges_round_trip(&[0, 1, 2, 10, 11, 1 << 40, (1 << 40) + 1]);
+    }
+
+    #[test]
+    fn block_ranges_truncated() {
+        let blocks = [3, 4, 5, 100, 200, 201];
+
+        let mut buf = [0; 64];
+        let len = {
+            let mut b = octets::OctetsMut::with_slice(&mut buf);
+            encode_block_ranges(&mut b, &blocks).unwrap();
+            b.off()
+        };
+
+        for cut in 0..len {
+            let mut decoded = Vec::new();
+            let mut b = octets::OctetsMut::with_slice(&mut buf[..cut]);
+            assert_eq!(
+                decode_block_ranges(&mut b, block::MAX_BLOCKS, &mut decoded),
+                Err(Error::BufferTooShort)
+            );
+        }
+
+        // Encoding into a buffer too short fails.
+        for cut in 0..len {
+            let mut b = octets::OctetsMut::with_slice(&mut buf[..cut]);
+            assert_eq!(
+                encode_block_ranges(&mut b, &blocks),
+                Err(Error::BufferTooShort)
+            );
+        }
+    }
+
+    #[test]
+    fn block_ranges_invalid() {
+        // More blocks than allowed.
+        let mut buf = [0; 64];
+        let len = {
+            let mut b = octets::OctetsMut::with_slice(&mut buf);
+            encode_block_ranges(&mut b, &[0, 1, 2, 3, 10]).unwrap();
+            b.off()
+        };
+
+        let mut decoded = Vec::new();
+        let mut b = octets::OctetsMut::with_slice(&mut buf[..len]);
+        assert_eq!(
+            decode_block_ranges(&mut b, 4, &mut decoded),
+            Err(Error::InvalidPacket)
+        );
+
+        // A range past the end of the index space.
+        let mut buf = [0; 64];
+        let len = {
+            let mut b = octets::OctetsMut::with_slice(&mut buf);
+            b.put_varint(5).unwrap();
+            for _ in 0..5 {
+                b.put_varint((1 << 62) - 1).unwrap();
+                b.put_varint(1).unwrap();
+            }
+            b.off()
+        };
+
+        let mut decoded = Vec::new();
+        let mut b = octets::OctetsMut::with_slice(&mut buf[..len]);
+        assert_eq!(
+            decode_block_ranges(&mut b, block::MAX_BLOCKS, &mut decoded),
+            Err(Error::InvalidPacket)
+        );
+    }
 }
@@ -0,0 +1,114 @@
+// Fixed-size buffer pool.
+//
+// Data packets carry at most one block, so buffered payloads are kept in
+// block-sized buffers taken from a free list, and handed back to it once
+// the application has read them. In steady state no payload buffer is
+// allocated nor freed. Every connection has its own pool, so no locking is
+// involved.
+
+/// The maximum number of free buffers kept by a pool.
+pub const POOL_MAX_FREE: usize = 1024;
+
+/// A free list of buffers of `block_size` bytes.
+#[derive(Debug)]
+pub struct BlockPool {
+    free: Vec<Vec<u8>>,
+
+    block_size: usize,
+
+    max_free: usize,
+}
+
+impl BlockPool {
+    pub fn new(block_size: usize, max_free: usize) -> BlockPool {
+        BlockPool {
+            free: Vec::new(),
+            block_size,
+            max_free,
+        }
+    }
+
+    /// Returns a buffer holding a copy of `data`.
+    ///
+    /// Data larger than a block gets a buffer of its own, which is not
+    /// recycled.
+    pub fn get(&mut self, data: &[u8]) -> Vec<u8> {
+        if data.len() > self.block_size {
+            return Vec::from(data);
+        }
+
+        let mut buf = self
+            .free
+            .pop()
+            .unwrap_or_else(|| Vec::with_capacity(self.block_size));
+
+        buf.extend_from_slice(data);
+        buf
+    }
+
+    /// Hands a buffer back to the pool.
+    pub fn put(&mut self, mut buf: Vec<u8>) {
+        if buf.capacity() != self.block_size || self.free.len() >= self.max_free
+        {
+            return;
+        }
+
+        buf.clear();
+        self.free.push(buf);
+    }
+}
+
+impl Default for BlockPool {
+    fn default() -> BlockPool {
+        BlockPool::new(crate::SEND_BUFFER_SIZE, POOL_MAX_FREE)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn buffers_are_reused() {
+        let mut pool = BlockPool::new(64, 4);
+
+        let buf = pool.get(&[1, 2, 3]);
+        assert_eq!(buf, [1, 2, 3]);
+        assert_eq!(buf.capacity(), 64);
+
+        let ptr = buf.as_ptr();
+        pool.put(buf);
+
+        // The same buffer comes back, cleared.
+        let buf = pool.get(&[4]);
+        assert_eq!(buf.as_ptr(), ptr);
+        assert_eq!(buf, [4]);
+    }
+
+    #[test]
+    fn large_data_not_recycled() {
+        let mut pool = BlockPool::new(64, 4);
+
+        let buf = pool.get(&[7; 65]);
+        assert_eq!(buf.len(), 65);
+
+        pool.put(buf);
+        assert!(pool.free.is_empty());
+
+        // Neither are buffers not taken from the pool.
+        pool.put(Vec::with_capacity(32));
+        assert!(pool.free.is_empty());
+    }
+
+    #[test]
+    fn free_list_bounded() {
+        let mut pool = BlockPool::new(64, 2);
+
+        let bufs: Vec<_> = (0..3).map(|i| pool.get(&[i])).collect();
+        for buf in bufs {
+            pool.put(buf);
+        }
+
+        assert_eq!(pool.free.len(), 2);
+    }
+}
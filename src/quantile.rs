@@ -0,0 +1,346 @@
+// Quantile estimation for the priority split points.
+//
+// Block priorities are assigned by comparing each block norm against the 30th
+// and 70th percentile of all norms in the iteration. The percentiles are
+// either selected exactly in linear time, or estimated with a streaming
+// sketch that can be fed while the data is still being produced.
+
+use std::str::FromStr;
+
+/// The default relative accuracy of `Sketch`.
+pub const DEFAULT_RELATIVE_ACCURACY: f64 = 0.01;
+
+/// Available algorithms to compute the priority split points.
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+#[repr(C)]
+pub enum QuantileAlgorithm {
+    /// Exact linear-time selection (default). `select` in a string form.
+    SELECT = 0,
+
+    /// Streaming sketch with bounded relative error. `sketch` in a string
+    /// form.
+    SKETCH = 1,
+}
+
+impl FromStr for QuantileAlgorithm {
+    type Err = crate::Error;
+
+    /// Converts a string to `QuantileAlgorithm`.
+    ///
+    /// If `name` is not valid, `Error::InvalidState` is returned.
+    fn from_str(name: &str) -> std::result::Result<Self, Self::Err> {
+        match name {
+            "select" => Ok(QuantileAlgorithm::SELECT),
+            "sketch" => Ok(QuantileAlgorithm::SKETCH),
+            _ => Err(crate::Error::InvalidState),
+        }
+    }
+}
+
+/// Returns the values at `len * num / 10` for the given `nums` (which must be
+/// ascending) as if `v` was sorted, reordering `v` in the process.
+///
+/// This runs in O(n) and, unlike sorting with `partial_cmp()`, does not panic
+/// on NaN values, which are ordered after every other value.
+pub fn select_deciles<const N: usize>(
+    v: &mut [f32], nums: [usize; N],
+) -> [f32; N] {
+    let mut out = [0.0; N];
+
+    if v.is_empty() {
+        return out;
+    }
+
+    // Every selection partitions the slice, so the next (larger) rank only
+    // has to be searched above the previous one.
+    let mut lo = 0;
+    for (i, num) in nums.iter().enumerate() {
+        let k = decile_rank(v.len(), *num);
+        let (_, nth, _) =
+            v[lo..].select_nth_unstable_by(k - lo, |a, b| a.total_cmp(b));
+        out[i] = *nth;
+        lo = k;
+    }
+
+    out
+}
+
+fn decile_rank(len: usize, num: usize) -> usize {
+    std::cmp::min(len * num / 10, len - 1)
+}
+
+/// Mergeable streaming quantile sketch.
+///
+/// Values are counted in logarithmically sized buckets, so that any quantile
+/// is returned with a relative error of at most the configured accuracy,
+/// independently of the number of values inserted. Two sketches with the same
+/// accuracy can be merged, e.g. to combine per-chunk sketches.
+#[derive(Clone, Debug)]
+pub struct Sketch {
+    /// Logarithm of the bucket growth factor.
+    ln_gamma: f64,
+
+    /// Number of values per bucket, starting at bucket index `offset`.
+    buckets: Vec<u64>,
+
+    /// Index of the first bucket in `buckets`.
+    offset: i32,
+
+    /// Number of zero (or negative) values.
+    zero_count: u64,
+
+    /// Total number of values.
+    count: u64,
+}
+
+impl Sketch {
+    /// Creates an empty sketch with the given relative accuracy.
+    pub fn new(relative_accuracy: f64) -> Sketch {
+        assert!(relative_accuracy > 0.0 && relative_accuracy < 1.0);
+
+        let gamma = (1.0 + relative_accuracy) / (1.0 - relative_accuracy);
+
+        Sketch {
+            ln_gamma: gamma.ln(),
+            buckets: Vec::new(),
+            offset: 0,
+            zero_count: 0,
+            count: 0,
+        }
+    }
+
+    /// Adds `v` to the sketch. NaN values are ignored.
+    pub fn insert(&mut self, v: f32) {
+        if v.is_nan() {
+            return;
+        }
+
+        if v <= 0.0 {
+            self.zero_count += 1;
+        } else {
+            let idx = ((v as f64).ln() / self.ln_gamma).ceil() as i32;
+            *self.bucket_mut(idx) += 1;
+        }
+
+        self.count += 1;
+    }
+
+    /// Adds all values of `other` to `self`.
+    pub fn merge(&mut self, other: &Sketch) {
+        assert!(
+            self.ln_gamma == other.ln_gamma,
+            "only sketches with the same accuracy can be merged"
+        );
+
+        for (i, n) in other.buckets.iter().enumerate() {
+            if *n > 0 {
+                *self.bucket_mut(other.offset + i as i32) += n;
+            }
+        }
+
+        self.zero_count += other.zero_count;
+        self.count += other.count;
+    }
+
+    /// Returns the estimated value at quantile `q` (between 0 and 1), or
+    /// `None` if the sketch is empty.
+    pub fn quantile(&self, q: f64) -> Option<f32> {
+        if self.count == 0 {
+            return None;
+        }
+
+        let rank = (q.clamp(0.0, 1.0) * (self.count - 1) as f64) as u64;
+
+        if rank < self.zero_count {
+            return Some(0.0);
+        }
+
+        let mut seen = self.zero_count;
+        for (i, n) in self.buckets.iter().enumerate() {
+            seen += n;
+
+            if rank < seen {
+                // Return the point with equal relative distance to both
+                // bucket bounds.
+                let idx = self.offset + i as i32;
+                let gamma = self.ln_gamma.exp();
+                let v = 2.0 * (idx as f64 * self.ln_gamma).exp() / (1.0 + gamma);
+                return Some(v as f32);
+            }
+        }
+
+        None
+    }
+
+    /// Returns the counter of bucket `idx`, growing `buckets` as needed.
+    fn bucket_mut(&mut self, idx: i32) -> &mut u64 {
+        if self.buckets.is_empty() {
+            self.offset = idx;
+        }
+
+        if idx < self.offset {
+            let grow = (self.offset - idx) as usize;
+            self.buckets.splice(0..0, std::iter::repeat(0).take(grow));
+            self.offset = idx;
+        }
+
+        let i = (idx - self.offset) as usize;
+        if i >= self.buckets.len() {
+            self.buckets.resize(i + 1, 0);
+        }
+
+        &mut self.buckets[i]
+    }
+
+    /// Returns the number of values in the sketch.
+    pub fn count(&self) -> u64 {
+        self.count
+    }
+
+    /// Removes all values from the sketch.
+    pub fn clear(&mut self) {
+        self.buckets.clear();
+        self.zero_count = 0;
+        self.count = 0;
+    }
+}
+
+impl Default for Sketch {
+    fn default() -> Sketch {
+        Sketch::new(DEFAULT_RELATIVE_ACCURACY)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Returns `len` pseudo-random positive values spanning several orders
+    /// of magnitude.
+    fn values(len: usize, seed: u32) -> Vec<f32> {
+        let mut x = seed | 1;
+
+        (0..len)
+            .map(|_| {
+                x ^= x << 13;
+                x ^= x >> 17;
+                x ^= x << 5;
+                (x % 1_000_000) as f32 / 100.0 + 0.001
+            })
+            .collect()
+    }
+
+    fn sorted(v: &[f32]) -> Vec<f32> {
+        let mut v = v.to_vec();
+        v.sort_by(|a, b| a.partial_cmp(b).unwrap());
+        v
+    }
+
+    #[test]
+    fn select_deciles_matches_sort() {
+        for len in [1, 2, 3, 9, 10, 11, 100, 1023, 10_000] {
+            let v = values(len, len as u32);
+            let s = sorted(&v);
+
+            let mut tmp = v.clone();
+            let [low, high] = select_deciles(&mut tmp, [3, 7]);
+
+            assert_eq!(low, s[decile_rank(len, 3)]);
+            assert_eq!(high, s[decile_rank(len, 7)]);
+
+            let mut tmp = v.clone();
+            let all = select_deciles(&mut tmp, [0, 1, 5, 9, 10]);
+            assert_eq!(all, [0, 1, 5, 9, 10].map(|n| s[decile_rank(len, n)]));
+        }
+    }
+
+    #[test]
+    fn select_deciles_duplicates_and_nan() {
+        let mut v = vec![2.0; 50];
+        v.extend(vec![1.0; 50]);
+        assert_eq!(select_deciles(&mut v, [3, 7]), [1.0, 2.0]);
+
+        // NaN values are ordered last and don't panic.
+        let mut v = values(100, 7);
+        v[10] = f32::NAN;
+        v[20] = f32::NAN;
+        let s = sorted(&v.iter().copied().filter(|x| !x.is_nan()).collect::<Vec<_>>());
+
+        let [low] = select_deciles(&mut v, [3]);
+        assert_eq!(low, s[30]);
+
+        assert_eq!(select_deciles(&mut [], [3, 7]), [0.0, 0.0]);
+    }
+
+    /// Checks that every decile of `sketch` is within `alpha` of the exact
+    /// value, relatively.
+    fn assert_within(sketch: &Sketch, s: &[f32], alpha: f64) {
+        assert_eq!(sketch.count(), s.len() as u64);
+
+        for q in [0.0, 0.1, 0.3, 0.5, 0.7, 0.9, 1.0] {
+            let exact = s[(q * (s.len() - 1) as f64) as usize] as f64;
+            let est = sketch.quantile(q).unwrap() as f64;
+
+            // A little slack for the f32 rounding of the estimate.
+            assert!(
+                (est - exact).abs() <= (alpha + 1e-6) * exact,
+                "q {} estimate {} exact {}",
+                q,
+                est,
+                exact
+            );
+        }
+    }
+
+    #[test]
+    fn sketch_error_bound() {
+        for alpha in [0.01, 0.05] {
+            let v = values(50_000, 3);
+            let mut sketch = Sketch::new(alpha);
+            for x in v.iter() {
+                sketch.insert(*x);
+            }
+
+            assert_within(&sketch, &sorted(&v), alpha);
+        }
+    }
+
+    #[test]
+    fn sketch_merge_error_bound() {
+        let a = values(20_000, 11);
+        let b: Vec<f32> = values(30_000, 13).iter().map(|x| x * 1000.0).collect();
+
+        let mut sa = Sketch::default();
+        a.iter().for_each(|x| sa.insert(*x));
+
+        let mut sb = Sketch::default();
+        b.iter().for_each(|x| sb.insert(*x));
+
+        // Merging a sketch whose buckets start below the ones of `self`.
+        sb.merge(&sa);
+
+        let all: Vec<f32> = a.iter().chain(b.iter()).copied().collect();
+        assert_within(&sb, &sorted(&all), DEFAULT_RELATIVE_ACCURACY);
+    }
+
+    #[test]
+    fn sketch_zeros_and_nan() {
+        let mut sketch = Sketch::default();
+        assert_eq!(sketch.quantile(0.5), None);
+
+        sketch.insert(f32::NAN);
+        assert_eq!(sketch.count(), 0);
+
+        for _ in 0..10 {
+            sketch.insert(0.0);
+        }
+        sketch.insert(5.0);
+
+        assert_eq!(sketch.quantile(0.5), Some(0.0));
+        assert!((sketch.quantile(1.0).unwrap() - 5.0).abs() <= 0.05);
+
+        sketch.clear();
+        assert_eq!(sketch.count(), 0);
+        assert_eq!(sketch.quantile(0.5), None);
+    }
+}
@@ -1,7 +1,12 @@
 // use std::time::Instant;
 
+use std::cmp;
+
+use std::collections::BTreeSet;
+
 use crate::recovery;
 
+use crate::recovery::Acked;
 use crate::recovery::CongestionControlOps;
 use crate::recovery::Recovery;
 
@@ -14,6 +19,8 @@ use crate::recovery::Recovery;
 pub static NEWCUBIC: CongestionControlOps = CongestionControlOps {
     on_init,
     reset,
+    on_ack,
+    next_window,
     // on_packet_sent,
     // on_packets_acked,
     // congestion_event,
@@ -44,12 +51,27 @@ pub static NEWCUBIC: CongestionControlOps = CongestionControlOps {
 ///
 /// We need to keep those variables across the connection.
 /// k, w_max, w_est are described in the RFC.
-#[derive(Debug, Default,Clone, Copy)]
+#[derive(Debug, Default, Clone)]
 pub struct State {
     k: f64,
 
     w_max: f64,
 
+    /// The window increments of the ACKs of the current window.
+    incre_win: usize,
+
+    /// The window decrements of the ACKs of the current window.
+    decre_win: usize,
+
+    /// The windows computed without a rollback, the largest is restored by
+    /// the next rollback.
+    former_windows: BTreeSet<usize>,
+
+    /// Whether an ACK of the current window didn't grow it by the blocks it
+    /// acknowledged, i.e. reported losses. Such a window isn't restored by a
+    /// rollback.
+    roll_back_flag: bool,
+
     // Used in CUBIC fix (see on_packet_sent())
     // last_sent_time: Option<Instant>,
 
@@ -120,6 +142,51 @@ fn reset(r: &mut Recovery) {
     r.cubic_state = State::default();
 }
 
+// cwnd = C(-(P - K))^3/k^3 + Wmax
+//x = [0:0.1:3.6];
+//y = -8*(x-1.8).^3/1.8^3;
+fn on_ack(r: &mut Recovery, acked: &Acked) {
+    let weights = acked.weights as f64;
+    let num = acked.blocks as f64;
+
+    let winadd = if weights < 0.2 || weights > 1.8 {
+        (-22.94 * weights.powi(3) + 65.83 * weights.powi(2) - 51.89 * weights + 8.0) *
+            r.max_datagram_size as f64
+    } else {
+        (-0.1587 * weights.powi(3) - 0.4658 * weights.powi(2) - 0.4538 * weights + 0.1535) *
+            r.max_datagram_size as f64
+    };
+
+    let cubic = &mut r.cubic_state;
+    if winadd != num * r.max_datagram_size as f64 {
+        cubic.roll_back_flag = true;
+    }
+
+    if winadd > 0.0 {
+        cubic.incre_win += winadd as usize;
+    } else {
+        cubic.decre_win += (-winadd) as usize;
+    }
+}
+
+/// Sums the window changes of the ACKs of the last window, never going
+/// below the initial window.
+fn next_window(r: &mut Recovery) {
+    let cubic = &mut r.cubic_state;
+
+    let win = (2 * cubic.incre_win).saturating_sub(cubic.decre_win);
+    if !cubic.roll_back_flag {
+        cubic.former_windows.insert(win);
+    }
+
+    cubic.roll_back_flag = false;
+    cubic.incre_win = 0;
+    cubic.decre_win = 0;
+
+    r.congestion_window =
+        cmp::max(win, r.max_datagram_size * recovery::INITIAL_WINDOW_PACKETS);
+}
+
 
 // pub fn on_packet_acked(
 //     r: &mut Recovery, priority_loss: f64, 
@@ -179,13 +246,18 @@ fn checkpoint(r: &mut Recovery) {
     r.cubic_state.prior.lost_count = r.lost_count;
 }
 
-///may be discarded later
+/// Restores the largest window computed so far. It takes the place of
+/// `next_window()`, so the window changes of the last window are dropped.
 fn rollback(r: &mut Recovery) -> bool {
-
-    r.congestion_window = r.cubic_state.prior.congestion_window;
-    r.cubic_state.w_max = r.cubic_state.prior.w_max;
-    r.cubic_state.k = r.cubic_state.prior.k;
-    // r.congestion_recovery_start_time = r.cubic_state.prior.epoch_start;
+    r.cubic_state.roll_back_flag = false;
+    r.cubic_state.incre_win = 0;
+    r.cubic_state.decre_win = 0;
+
+    r.congestion_window = r
+        .cubic_state
+        .former_windows
+        .pop_last()
+        .unwrap_or(r.max_datagram_size * recovery::INITIAL_WINDOW_PACKETS);
 
     true
 }
@@ -0,0 +1,387 @@
+// Model-based congestion control.
+//
+// A BBR-style controller: the window of the next round is the bandwidth-
+// delay product of a model of the path, the largest delivery rate of the
+// last rounds times the minimum RTT, scaled by a gain that probes for more
+// bandwidth now and then and drains the queue it built right after. Losses
+// don't shrink the window as long as the model holds, so cross traffic
+// doesn't make it collapse, while the queue it keeps stays short.
+//
+// A round is a window of data. Its delivery rate is sampled from the ACKs
+// it got, as the bytes they report received over the time between the
+// first and the last one, so that neither the RTT before the first ACK nor
+// the time the application takes between two windows lower it.
+
+use std::cmp;
+
+use std::time::Instant;
+
+use crate::recovery::Acked;
+use crate::recovery::CongestionControlOps;
+use crate::recovery::Recovery;
+
+pub static BBR: CongestionControlOps = CongestionControlOps {
+    on_init,
+    reset,
+    on_ack,
+    next_window,
+    collapse_cwnd,
+    checkpoint,
+    rollback,
+    has_custom_pacing,
+    debug_fmt,
+};
+
+/// The gain of the startup phase, 2/ln(2), which doubles the delivery rate
+/// every round.
+const STARTUP_GAIN: f64 = 2.885;
+
+/// The gains of the probing phase, one per round. The first round probes
+/// for more bandwidth, the second drains the queue it built.
+const PROBE_GAINS: [f64; 8] = [1.25, 0.75, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0];
+
+/// The number of rounds the delivery rate is the largest of.
+const BW_WINDOW_ROUNDS: usize = 10;
+
+/// The startup phase ends once the delivery rate grew less than this much
+/// for `FULL_BW_ROUNDS` rounds.
+const FULL_BW_GROWTH: f64 = 1.25;
+
+const FULL_BW_ROUNDS: usize = 3;
+
+/// The smallest window, in packets.
+const MIN_WINDOW_PACKETS: usize = 4;
+
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+enum Mode {
+    /// Doubling the delivery rate every round until it stops growing.
+    #[default]
+    Startup,
+
+    /// Draining the queue built during startup, for one round.
+    Drain,
+
+    /// Cycling through `PROBE_GAINS`.
+    ProbeBw,
+}
+
+/// BBR State Variables.
+#[derive(Debug, Default, Clone)]
+pub struct State {
+    mode: Mode,
+
+    /// The delivery rate samples of the last rounds, in bytes per second.
+    bw_samples: [u64; BW_WINDOW_ROUNDS],
+
+    /// The largest of `bw_samples`.
+    btl_bw: u64,
+
+    round_count: usize,
+
+    /// The time of the first and the last ACK of the current round.
+    first_ack: Option<Instant>,
+
+    last_ack: Option<Instant>,
+
+    /// The bytes reported received by the ACKs of the current round, but
+    /// the first one.
+    delivered: usize,
+
+    /// The delivery rate the startup phase last grew to.
+    full_bw: u64,
+
+    /// The number of rounds the delivery rate didn't grow during startup.
+    full_bw_count: usize,
+
+    cycle_index: usize,
+
+    pacing_gain: f64,
+}
+
+impl State {
+    /// Returns the bandwidth-delay product of the model, if the model has
+    /// a delivery rate and an RTT.
+    fn bdp(&self, r: &Recovery) -> Option<usize> {
+        if self.btl_bw == 0 || r.min_rtt.is_zero() {
+            return None;
+        }
+
+        Some((self.btl_bw as f64 * r.min_rtt.as_secs_f64()) as usize)
+    }
+}
+
+fn on_init(r: &mut Recovery) {
+    reset(r);
+}
+
+fn reset(r: &mut Recovery) {
+    r.bbr_state = State {
+        pacing_gain: STARTUP_GAIN,
+        ..State::default()
+    };
+}
+
+fn on_ack(r: &mut Recovery, acked: &Acked) {
+    let bbr = &mut r.bbr_state;
+
+    if bbr.first_ack.is_none() {
+        bbr.first_ack = Some(acked.time);
+        return;
+    }
+
+    bbr.delivered += acked.delivered;
+    bbr.last_ack = Some(acked.time);
+}
+
+/// Ends the current round: samples its delivery rate, moves through the
+/// phases and sizes the window and the pacing rate after the model.
+fn next_window(r: &mut Recovery) {
+    let bbr = &mut r.bbr_state;
+
+    if let (Some(first), Some(last)) = (bbr.first_ack, bbr.last_ack) {
+        let interval = last.saturating_duration_since(first).as_secs_f64();
+
+        if bbr.delivered > 0 && interval > 0.0 {
+            let sample = (bbr.delivered as f64 / interval) as u64;
+
+            bbr.bw_samples[bbr.round_count % BW_WINDOW_ROUNDS] = sample;
+            bbr.btl_bw = bbr.bw_samples.iter().copied().max().unwrap_or(0);
+            bbr.round_count += 1;
+        }
+    }
+
+    bbr.first_ack = None;
+    bbr.last_ack = None;
+    bbr.delivered = 0;
+
+    match bbr.mode {
+        Mode::Startup => {
+            if bbr.btl_bw as f64 >= bbr.full_bw as f64 * FULL_BW_GROWTH {
+                bbr.full_bw = bbr.btl_bw;
+                bbr.full_bw_count = 0;
+            } else {
+                bbr.full_bw_count += 1;
+            }
+
+            if bbr.full_bw_count >= FULL_BW_ROUNDS {
+                enter_drain(bbr);
+            }
+        },
+
+        Mode::Drain => {
+            bbr.mode = Mode::ProbeBw;
+            bbr.cycle_index = 0;
+            bbr.pacing_gain = PROBE_GAINS[0];
+        },
+
+        Mode::ProbeBw => {
+            bbr.cycle_index = (bbr.cycle_index + 1) % PROBE_GAINS.len();
+            bbr.pacing_gain = PROBE_GAINS[bbr.cycle_index];
+        },
+    }
+
+    set_window(r, r.bbr_state.pacing_gain);
+}
+
+fn enter_drain(bbr: &mut State) {
+    bbr.mode = Mode::Drain;
+    bbr.pacing_gain = 1.0 / STARTUP_GAIN;
+}
+
+/// Sizes the window to `gain` times the bandwidth-delay product, and the
+/// pacing rate to `gain` times the delivery rate. Until the model has a
+/// delivery rate, the window grows by `gain` every round.
+fn set_window(r: &mut Recovery, gain: f64) {
+    let min_window = r.max_datagram_size * MIN_WINDOW_PACKETS;
+
+    let window = match r.bbr_state.bdp(r) {
+        Some(bdp) => (bdp as f64 * gain) as usize,
+
+        None => (r.congestion_window as f64 * gain) as usize,
+    };
+
+    r.congestion_window = cmp::max(window, min_window);
+
+    let rate = if r.bbr_state.btl_bw != 0 {
+        (r.bbr_state.btl_bw as f64 * gain) as u64
+    } else if !r.min_rtt.is_zero() {
+        (r.congestion_window as f64 / r.min_rtt.as_secs_f64()) as u64
+    } else {
+        0
+    };
+
+    r.pacer.update(rate);
+}
+
+fn collapse_cwnd(r: &mut Recovery) {
+    r.congestion_window = r.max_datagram_size * MIN_WINDOW_PACKETS;
+}
+
+fn checkpoint(_r: &mut Recovery) {}
+
+/// Too many high priority blocks were lost: the pipe is full. Startup
+/// ends, and the next round sends no more than the bandwidth-delay
+/// product.
+///
+/// This takes the place of `next_window()` for the round, but only changes
+/// the mode and the gain: the ACKs of the round are dropped rather than
+/// sampled, and the probing cycle doesn't move.
+fn rollback(r: &mut Recovery) -> bool {
+    let bbr = &mut r.bbr_state;
+
+    bbr.first_ack = None;
+    bbr.last_ack = None;
+    bbr.delivered = 0;
+
+    if bbr.mode == Mode::Startup {
+        enter_drain(bbr);
+    }
+
+    let gain = bbr.pacing_gain.min(1.0);
+    set_window(r, gain);
+
+    true
+}
+
+fn has_custom_pacing() -> bool {
+    true
+}
+
+fn debug_fmt(r: &Recovery, f: &mut std::fmt::Formatter) -> std::fmt::Result {
+    let bbr = &r.bbr_state;
+
+    write!(
+        f,
+        "bbr={{ mode={:?} btl_bw={} pacing_gain={} round_count={} }} ",
+        bbr.mode, bbr.btl_bw, bbr.pacing_gain, bbr.round_count
+    )
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    use std::time::Duration;
+
+    use crate::recovery::CongestionControlAlgorithm;
+
+    const RTT: Duration = Duration::from_millis(10);
+
+    /// The bytes delivered per round, over `RTT`: a bandwidth-delay product
+    /// of 100 kB at 10 MB/s.
+    const BDP: usize = 100_000;
+
+    fn recovery() -> Recovery {
+        let mut cfg = crate::Config::new().unwrap();
+        cfg.set_cc_algorithm(CongestionControlAlgorithm::BBR);
+
+        let mut r = Recovery::new(&cfg);
+        r.on_init();
+        r
+    }
+
+    fn acked(delivered: usize, time: Instant) -> Acked {
+        Acked {
+            weights: 0.0,
+            blocks: 1,
+            delivered,
+            lost: 0,
+            time,
+        }
+    }
+
+    /// Runs a round whose ACKs report `delivered` bytes over `RTT`, and
+    /// returns the new window.
+    fn round(r: &mut Recovery, delivered: usize) -> usize {
+        let now = Instant::now();
+        r.update_rtt(RTT, now);
+
+        on_ack(r, &acked(1000, now));
+        on_ack(r, &acked(delivered, now + RTT));
+
+        r.cwnd()
+    }
+
+    fn assert_near(a: usize, b: f64) {
+        assert!((a as f64 - b).abs() <= 1.0, "{} != {}", a, b);
+    }
+
+    #[test]
+    fn startup_without_samples() {
+        let mut r = recovery();
+        let initial = r.congestion_window();
+
+        // No ACK, the window grows by the startup gain.
+        assert_near(r.cwnd(), initial as f64 * STARTUP_GAIN);
+        assert_eq!(r.bbr_state.mode, Mode::Startup);
+        assert_eq!(r.bbr_state.round_count, 0);
+    }
+
+    #[test]
+    fn phases() {
+        let mut r = recovery();
+
+        assert_near(round(&mut r, BDP), BDP as f64 * STARTUP_GAIN);
+        assert_eq!(r.bbr_state.btl_bw, 10_000_000);
+
+        // The delivery rate stops growing, startup ends after 3 rounds.
+        for _ in 0..FULL_BW_ROUNDS - 1 {
+            round(&mut r, BDP);
+            assert_eq!(r.bbr_state.mode, Mode::Startup);
+        }
+
+        assert_near(round(&mut r, BDP), BDP as f64 / STARTUP_GAIN);
+        assert_eq!(r.bbr_state.mode, Mode::Drain);
+
+        for gain in PROBE_GAINS.iter().chain(PROBE_GAINS[..2].iter()) {
+            assert_near(round(&mut r, BDP), BDP as f64 * gain);
+            assert_eq!(r.bbr_state.mode, Mode::ProbeBw);
+            assert_eq!(r.pacer.rate(), (10_000_000.0 * gain) as u64);
+        }
+    }
+
+    #[test]
+    fn bandwidth_window() {
+        let mut r = recovery();
+
+        round(&mut r, 2 * BDP);
+
+        // The largest rate of the last rounds is kept.
+        for _ in 1..BW_WINDOW_ROUNDS {
+            round(&mut r, BDP);
+            assert_eq!(r.bbr_state.btl_bw, 20_000_000);
+        }
+
+        round(&mut r, BDP);
+        assert_eq!(r.bbr_state.btl_bw, 10_000_000);
+    }
+
+    #[test]
+    fn rollback_ends_startup() {
+        let mut r = recovery();
+
+        round(&mut r, BDP);
+
+        // The ACKs of the round are dropped.
+        on_ack(&mut r, &acked(1000, Instant::now()));
+        assert!(rollback(&mut r));
+
+        assert_eq!(r.bbr_state.mode, Mode::Drain);
+        assert_eq!(r.bbr_state.round_count, 1);
+        assert!(r.bbr_state.first_ack.is_none());
+        assert_near(r.congestion_window(), BDP as f64 / STARTUP_GAIN);
+    }
+
+    #[test]
+    fn minimum_window() {
+        let mut r = recovery();
+        let min_window = r.max_datagram_size * MIN_WINDOW_PACKETS;
+
+        // 100 bytes per RTT.
+        assert_eq!(round(&mut r, 100), min_window);
+
+        r.congestion_window = BDP;
+        collapse_cwnd(&mut r);
+        assert_eq!(r.congestion_window(), min_window);
+    }
+}
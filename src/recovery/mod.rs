@@ -1,4 +1,4 @@
-// use std::cmp;
+use std::cmp;
 
 use std::str::FromStr;
 
@@ -6,16 +6,11 @@ use std::time::Duration;
 use std::time::Instant;
 
 use crate::Config;
-use std::collections::BTreeSet;
 
 
 // use crate::frame;
 // use crate::packet;
-// use crate::minmax;
-
-
-#[cfg(feature = "qlog")]
-use qlog::events::EventData;
+use crate::minmax;
 
 // use self::NewCubic::State;
 
@@ -24,16 +19,20 @@ use qlog::events::EventData;
 
 // const INITIAL_TIME_THRESHOLD: f64 = 9.0 / 8.0;
 
-// const GRANULARITY: Duration = Duration::from_millis(1);
+const GRANULARITY: Duration = Duration::from_millis(1);
 
 const INITIAL_RTT: Duration = Duration::from_millis(333);
 
 // const PERSISTENT_CONGESTION_THRESHOLD: u32 = 3;
 
-// const RTT_WINDOW: Duration = Duration::from_secs(300);
+/// The window over which the minimum RTT is tracked.
+const RTT_WINDOW: Duration = Duration::from_secs(300);
 
 // const MAX_PTO_PROBES_COUNT: usize = 2;
 
+// The PTO doubles on every consecutive expiration, up to this many times.
+const MAX_PTO_BACKOFF: u32 = 6;
+
 // Congestion Control
 // const INITIAL_WINDOW_PACKETS: usize = 10;
 const INITIAL_WINDOW_PACKETS: usize = 8;
@@ -42,11 +41,12 @@ const ELICT_ACK_CONSTANT: usize = 8;
 
 const MINIMUM_WINDOW_PACKETS: usize = 2;
 
-const INI_WIN: usize = 1200 * 8;
-
 // const LOSS_REDUCTION_FACTOR: f64 = 0.5;
 
-// const PACING_MULTIPLIER: f64 = 1.25;
+const PACING_MULTIPLIER: f64 = 1.25;
+
+// The number of packets that can be sent back to back before pacing kicks in.
+const PACING_BURST_PACKETS: usize = 4;
 
 // How many non ACK eliciting packets we send before including a PING to solicit
 // an ACK.
@@ -54,7 +54,6 @@ const INI_WIN: usize = 1200 * 8;
 
 // const RECORD_LEN:usize = u16::MAX as usize;
 
-const PACKET_SIZE: usize = 1200;
 // #[derive(Copy, Clone)]
 #[derive(Clone)]
 pub struct Recovery {
@@ -73,6 +72,8 @@ pub struct Recovery {
 
     cubic_state: NewCubic::State,
 
+    bbr_state: bbr::State,
+
     latest_rtt: Duration,
 
     smoothed_rtt: Option<Duration>,
@@ -86,7 +87,7 @@ pub struct Recovery {
 
     // largest_sent_pkt: [u64; 3],
   
-    // minmax_filter: minmax::Minmax<Duration>,
+    minmax_filter: minmax::Minmax<Duration>,
 
     min_rtt: Duration,
 
@@ -97,6 +98,9 @@ pub struct Recovery {
 
     pub loss_probes: [usize; 3],
 
+    /// The number of consecutive PTO expirations.
+    pto_count: u32,
+
     in_flight_count: [usize; 3],
 
     app_limited: bool,
@@ -108,30 +112,24 @@ pub struct Recovery {
     bytes_in_flight: usize,
 
     max_datagram_size: usize,
-    k:f64,
-    incre_win: usize,
-
-    decre_win: usize,
-
-    former_win_vecter: BTreeSet<usize>,
 
-    roll_back_flag: bool,
+    pacer: pacer::Pacer,
 }
 
 pub struct RecoveryConfig {
-    max_send_udp_payload_size: usize,
     pub max_ack_delay: Duration,
     cc_ops: &'static CongestionControlOps,
 
+    pacing: bool,
 }
 
 impl RecoveryConfig {
     pub fn from_config(config: &Config) -> Self {
         Self {
-            max_send_udp_payload_size: config.max_send_udp_payload_size,
             max_ack_delay: Duration::ZERO,
             cc_ops: config.cc_algorithm.into(),
 
+            pacing: config.pacing,
         }
     }
 }
@@ -139,7 +137,7 @@ impl RecoveryConfig {
 impl Recovery {
     pub fn new_with_config(recovery_config: &RecoveryConfig) -> Self {
         let initial_congestion_window =
-            recovery_config.max_send_udp_payload_size * INITIAL_WINDOW_PACKETS;
+            crate::SEND_BUFFER_SIZE * INITIAL_WINDOW_PACKETS;
 
         Recovery {
             loss_detection_timer: None,
@@ -158,7 +156,7 @@ impl Recovery {
             // handled by the `rtt()` method instead.
             smoothed_rtt: None,
 
-            // minmax_filter: minmax::Minmax::new(Duration::ZERO),
+            minmax_filter: minmax::Minmax::new(Duration::ZERO),
 
             min_rtt: Duration::ZERO,
 
@@ -170,6 +168,8 @@ impl Recovery {
 
             loss_probes: [0; 3],
 
+            pto_count: 0,
+
             in_flight_count: [0; 3],
 
             congestion_window: initial_congestion_window,
@@ -181,6 +181,8 @@ impl Recovery {
 
             cubic_state: NewCubic::State::default(),
 
+            bbr_state: bbr::State::default(),
+
             app_limited: false,
 
             // min_acked_pkt:0,
@@ -189,17 +191,13 @@ impl Recovery {
             // pkt_priority: [0; RECORD_LEN],
             // priority_record: [0; RECORD_LEN],
 
-            max_datagram_size:PACKET_SIZE,
+            max_datagram_size: crate::SEND_BUFFER_SIZE,
             // ack_pkts: [0;8],
 
-            k: 1.0,
-            incre_win: 0,
-            decre_win: 0,
-
-            former_win_vecter:BTreeSet::<usize>::new(),
-
-            roll_back_flag: false,
-
+            pacer: pacer::Pacer::new(
+                recovery_config.pacing,
+                crate::SEND_BUFFER_SIZE * PACING_BURST_PACKETS,
+            ),
         }
     }
 
@@ -220,35 +218,6 @@ impl Recovery {
 
     }
 
-    // cwnd = C(-(P - K))^3/k^3 + Wmax
-    //x = [0:0.1:3.6];
-    //y = -8*(x-1.8).^3/1.8^3;
-    pub fn update_win(&mut self,weights:f32, num: f64){
-    //    let test1 = (weights as f64- (self.k*num)/8.0).powi(3);
-    //    let test2 = (weights as f64- (self.k*num)/8.0).powi(3)/self.k.powi(3);
-    //    let test3 = -C * (weights as f64- (self.k*num)/8.0).powi(3)/self.k.powi(3);
-    //    println!("weights: {:?}, num: {:?},smallwin: {:?}", weights, num,test3);
-       // let winadd = (-C * (weights as f64- (self.k*num)/8.0).powi(3)/self.k.powi(3)) * self.max_datagram_size as f64;
-        // let winadd = (-num * (weights as f64 - (self.k*num)/8.0).powi(3)/((self.k*num)/8.0).powi(3)) * self.max_datagram_size as f64;
-        let mut winadd = 0.0;
-        if weights < 0.2 || weights > 1.8{
-            winadd = (-22.94 * (weights as f64).powi(3) + 65.83 * (weights as f64).powi(2) - 51.89 * (weights as f64) + 8.0) * self.max_datagram_size as f64;
-        }else {
-            winadd = (-0.1587 * (weights as f64).powi(3) - 0.4658 * (weights as f64).powi(2) - 0.4538 * (weights as f64) + 0.1535) * self.max_datagram_size as f64;
-        }
-        if winadd != num{
-            self.roll_back_flag = true;
-        }
-
-        //self.congestion_window += ((winadd/4.0)*4.0) as usize;
-        if winadd > 0.0{
-            self.incre_win += winadd as usize;
-        }else {
-            self.decre_win += (-winadd) as usize;
-        }
-    }
-
-
     /// Returns whether or not we should elicit an ACK even if we wouldn't
     /// otherwise have constructed an ACK eliciting packet.
     pub fn should_elicit_ack(&self, pkt_num:usize) -> bool {
@@ -264,67 +233,123 @@ impl Recovery {
     pub fn loss_detection_timer(&self) -> Option<Instant> {
         self.loss_detection_timer
     }
-    ///modified
+    /// Computes the congestion window of the next window of data, from
+    /// the ACKs received since the last one.
     pub fn cwnd(&mut self) -> usize {
-        let mut tmp_win:usize=0;
-        if 2*self.incre_win > self.decre_win{
-            tmp_win = 2*self.incre_win - self.decre_win;
-        }else{
-            tmp_win = 0;
-        }
-        if !self.roll_back_flag {
-            self.former_win_vecter.insert(tmp_win);
-        }
-        self.congestion_window = tmp_win;
-        println!("add: {:?}, minus: {:?}, tmp_win: {:?}", self.incre_win, self.decre_win, tmp_win);
-        self.incre_win = 0;
-        self.decre_win = 0;
-        if self.congestion_window >=  PACKET_SIZE*INITIAL_WINDOW_PACKETS{
-            self.congestion_window
-        }else{
-            self.congestion_window = PACKET_SIZE*INITIAL_WINDOW_PACKETS;
-            self.congestion_window
-        }
-        
+        (self.cc_ops.next_window)(self);
+
+        self.congestion_window
     }
+
+    /// Sets the number of data bytes a packet carries, which is the unit of
+    /// the congestion window, and resets the window to its initial size.
+    pub fn set_max_datagram_size(&mut self, size: usize) {
+        self.max_datagram_size = size;
+        self.congestion_window = size * INITIAL_WINDOW_PACKETS;
+        (self.cc_ops.reset)(self);
+        self.pacer.set_capacity(size * PACING_BURST_PACKETS);
+    }
+
+    /// Returns the current congestion window, without computing a new one.
+    pub fn congestion_window(&self) -> usize {
+        self.congestion_window
+    }
+
     //modified
     pub fn cwnd_available(&self) -> usize {
         // Open more space (snd_cnt) for PRR when allowed.
         self.congestion_window.saturating_sub(self.bytes_in_flight)
     }
 
-    // fn update_rtt(
-    //     &mut self, latest_rtt: Duration,  now: Instant,
-    // ) {
-    //     self.latest_rtt = latest_rtt;
+    /// Updates the RTT estimator with a sample taken at `now`.
+    ///
+    /// The smoothed RTT and its variance follow RFC 6298, the minimum RTT is
+    /// the smallest sample of the last `RTT_WINDOW`.
+    pub fn update_rtt(&mut self, latest_rtt: Duration, now: Instant) {
+        self.latest_rtt = latest_rtt;
 
-    //     match self.smoothed_rtt {
-    //         // First RTT sample.
-    //         None => {
-    //             self.min_rtt = self.minmax_filter.reset(now, latest_rtt);
+        match self.smoothed_rtt {
+            // First RTT sample.
+            None => {
+                self.min_rtt = self.minmax_filter.reset(now, latest_rtt);
 
-    //             self.smoothed_rtt = Some(latest_rtt);
+                self.smoothed_rtt = Some(latest_rtt);
 
-    //             self.rttvar = latest_rtt / 2;
-    //         },
+                self.rttvar = latest_rtt / 2;
+            },
 
-    //         Some(srtt) => {
-    //             self.min_rtt =
-    //                 self.minmax_filter.running_min(RTT_WINDOW, now, latest_rtt);
+            Some(srtt) => {
+                self.min_rtt =
+                    self.minmax_filter.running_min(RTT_WINDOW, now, latest_rtt);
 
+                self.rttvar = self.rttvar.mul_f64(3.0 / 4.0) +
+                    sub_abs(srtt, latest_rtt).mul_f64(1.0 / 4.0);
 
-    //             // Adjust for ack delay if plausible.
-    //             let adjusted_rtt = latest_rtt;
+                self.smoothed_rtt = Some(
+                    srtt.mul_f64(7.0 / 8.0) + latest_rtt.mul_f64(1.0 / 8.0),
+                );
+            },
+        }
+    }
 
-    //             self.rttvar = self.rttvar.mul_f64(3.0 / 4.0) +
-    //                 sub_abs(srtt, adjusted_rtt).mul_f64(1.0 / 4.0);
+    /// Returns the smoothed RTT, or the initial RTT until a sample is taken.
+    pub fn rtt(&self) -> Duration {
+        self.smoothed_rtt.unwrap_or(INITIAL_RTT)
+    }
 
-    //             self.smoothed_rtt = Some(
-    //                 srtt.mul_f64(7.0 / 8.0) + adjusted_rtt.mul_f64(1.0 / 8.0),
-    //             );
-    //         },
-    //     }
-    // }
+    /// Returns the minimum RTT over the last `RTT_WINDOW`.
+    pub fn min_rtt(&self) -> Duration {
+        self.min_rtt
+    }
+
+    /// Returns the probe timeout, before backoff.
+    ///
+    /// The receiver answers an ElictAck as soon as it processes it, so no
+    /// ACK delay is accounted for.
+    pub fn pto(&self) -> Duration {
+        self.rtt() + cmp::max(self.rttvar * 4, GRANULARITY)
+    }
+
+    /// Returns the number of consecutive PTO expirations.
+    pub fn pto_count(&self) -> u32 {
+        self.pto_count
+    }
+
+    /// Arms the loss detection timer when a packet asking for an ACK is
+    /// sent at `now`.
+    pub fn on_elicit_sent(&mut self, now: Instant) {
+        self.loss_detection_timer = Some(now + self.pto() * (1 << self.pto_count));
+    }
+
+    /// Feeds the blocks reported by an ACK to the congestion controller,
+    /// and updates the loss detection timer. It is disarmed unless some
+    /// blocks are still waiting for an ACK.
+    pub fn on_ack_received(&mut self, acked: &Acked, outstanding: bool) {
+        (self.cc_ops.on_ack)(self, acked);
+
+        let now = acked.time;
+        self.pto_count = 0;
+
+        self.loss_detection_timer = if outstanding {
+            Some(now + self.pto())
+        } else {
+            None
+        };
+    }
+
+    /// Handles the expiration of the loss detection timer. The timer is
+    /// armed again, with a doubled timeout, by the probe the caller sends.
+    pub fn on_loss_detection_timeout(&mut self) {
+        self.pto_count = cmp::min(self.pto_count + 1, MAX_PTO_BACKOFF);
+        self.loss_probes[0] += 1;
+        self.loss_detection_timer = None;
+    }
+
+    /// Disarms the loss detection timer.
+    pub fn stop_loss_detection_timer(&mut self) {
+        self.pto_count = 0;
+        self.loss_detection_timer = None;
+    }
 
     pub fn collapse_cwnd(&mut self) {
         (self.cc_ops.collapse_cwnd)(self);
@@ -338,15 +363,48 @@ impl Recovery {
         self.app_limited
     }
     
+    /// Computes the congestion window of the next window of data, after
+    /// too many high priority blocks were lost in the last one.
     pub fn rollback(&mut self) -> usize{
-        if self.former_win_vecter.is_empty(){
-            self.congestion_window = INI_WIN;
-        }else{
-            self.congestion_window = self.former_win_vecter.pop_last().unwrap();
-        }
-        
+        (self.cc_ops.rollback)(self);
+
         self.congestion_window
     }
+
+    /// Sets the pacing rate so that a window of `cwnd` bytes is spread over
+    /// `rtt`. Pacing is disabled until the RTT is known.
+    ///
+    /// Controllers with their own pacing rate set it themselves.
+    pub fn update_pacing_rate(&mut self, cwnd: usize, rtt: Duration) {
+        if (self.cc_ops.has_custom_pacing)() {
+            return;
+        }
+
+        let rate = if rtt.is_zero() {
+            0
+        } else {
+            (cwnd as f64 / rtt.as_secs_f64() * PACING_MULTIPLIER) as u64
+        };
+
+        self.pacer.update(rate);
+    }
+
+    /// Returns the pacing rate, in bytes per second.
+    pub fn pacing_rate(&self) -> u64 {
+        self.pacer.rate()
+    }
+
+    /// Records a packet of `size` bytes ready to be sent at `now` with the
+    /// pacer, and returns the time it should be sent at.
+    pub fn on_packet_sent(&mut self, size: usize, now: Instant) -> Instant {
+        self.pacer.send(size, now)
+    }
+
+    /// Returns the earliest time the next packet can be sent.
+    pub fn next_pacing_time(&self) -> Instant {
+        self.pacer.next_time()
+    }
+
     // pub fn delivery_rate_update_app_limited(&mut self, v: bool) {
     //     self.delivery_rate.update_app_limited(v);
     // }
@@ -363,6 +421,10 @@ pub enum CongestionControlAlgorithm {
     /// CUBIC congestion control algorithm (default). `cubic` in a string form.
     NEWCUBIC = 1,
 
+    /// Model-based congestion control algorithm, sizing the window after
+    /// the delivery rate and the minimum RTT. `bbr` in a string form.
+    BBR = 2,
+
 }
 
 impl FromStr for CongestionControlAlgorithm {
@@ -374,17 +436,28 @@ impl FromStr for CongestionControlAlgorithm {
     fn from_str(name: &str) -> std::result::Result<Self, Self::Err> {
         match name {
             "newcubic" => Ok(CongestionControlAlgorithm::NEWCUBIC),
+            "bbr" => Ok(CongestionControlAlgorithm::BBR),
             _ => Err(crate::Error::CongestionControl),
         }
     }
 }
 
 
+/// The hooks of a congestion controller.
+///
+/// The window is computed once per window of data: `on_ack` is called for
+/// every ACK, then `next_window` sets `congestion_window` for the next
+/// window, or `rollback` does instead when too many high priority blocks
+/// were lost.
 pub struct CongestionControlOps {
     pub on_init: fn(r: &mut Recovery),
 
     pub reset: fn(r: &mut Recovery),
 
+    pub on_ack: fn(r: &mut Recovery, acked: &Acked),
+
+    pub next_window: fn(r: &mut Recovery),
+
     pub collapse_cwnd: fn(r: &mut Recovery),
 
     pub checkpoint: fn(r: &mut Recovery),
@@ -401,6 +474,7 @@ impl From<CongestionControlAlgorithm> for &'static CongestionControlOps {
     fn from(algo: CongestionControlAlgorithm) -> Self {
         match algo {
             CongestionControlAlgorithm::NEWCUBIC => &NewCubic::NEWCUBIC,
+            CongestionControlAlgorithm::BBR => &bbr::BBR,
         }
     }
 }
@@ -440,24 +514,37 @@ impl std::fmt::Debug for Recovery {
 }
 
 
+/// The blocks reported by an ACK.
 #[derive(Clone)]
 pub struct Acked {
-    pub pkt_num: [u64;8],
+    /// The sum of the loss weights of the blocks, see
+    /// `Connection::on_block_status()`.
+    pub weights: f32,
+
+    /// The number of blocks reported.
+    pub blocks: usize,
+
+    /// The number of bytes reported received.
+    pub delivered: usize,
 
-    pub time_recived: Instant,
+    /// The number of bytes reported lost.
+    pub lost: usize,
 
-    pub priority_loss: usize,
+    /// The time the ACK was received.
+    pub time: Instant,
 }
 
 
 
-// fn sub_abs(lhs: Duration, rhs: Duration) -> Duration {
-//     if lhs > rhs {
-//         lhs - rhs
-//     } else {
-//         rhs - lhs
-//     }
-// }
+fn sub_abs(lhs: Duration, rhs: Duration) -> Duration {
+    if lhs > rhs {
+        lhs - rhs
+    } else {
+        rhs - lhs
+    }
+}
 
 mod NewCubic;
+mod bbr;
+mod pacer;
 
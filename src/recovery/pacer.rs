@@ -0,0 +1,172 @@
+// Packet pacer.
+//
+// Spreads the packets of a congestion window over the round-trip time
+// instead of sending them back to back. The pacer does not delay anything
+// itself, it returns the time at which each packet should leave the host,
+// which the application can honour with a timer or hand to the kernel with
+// SO_TXTIME.
+
+use std::cmp;
+
+use std::time::Duration;
+use std::time::Instant;
+
+/// Token bucket pacer, implemented as a generic cell rate algorithm.
+///
+/// Up to `capacity` bytes can be sent back to back, after which packets are
+/// spaced at `rate` bytes per second. A packet is sent once the bucket has
+/// room for all of its bytes.
+#[derive(Clone, Debug)]
+pub struct Pacer {
+    /// Whether pacing is enabled.
+    enabled: bool,
+
+    /// The maximum burst size, in bytes.
+    capacity: usize,
+
+    /// The pacing rate, in bytes per second. No pacing is done until it is
+    /// known.
+    rate: u64,
+
+    /// The time at which the bucket would be empty if every packet sent so
+    /// far had been sent exactly at the pacing rate.
+    tat: Instant,
+
+    /// The size of the last packet, which the next one is expected to
+    /// match.
+    last_size: usize,
+}
+
+impl Pacer {
+    pub fn new(enabled: bool, capacity: usize) -> Pacer {
+        Pacer {
+            enabled,
+            capacity,
+            rate: 0,
+            tat: Instant::now(),
+            last_size: 0,
+        }
+    }
+
+    /// Sets the maximum burst size, in bytes.
+    pub fn set_capacity(&mut self, capacity: usize) {
+        self.capacity = capacity;
+    }
+
+    /// Updates the pacing rate, in bytes per second.
+    pub fn update(&mut self, rate: u64) {
+        self.rate = rate;
+    }
+
+    /// Returns the pacing rate, in bytes per second.
+    pub fn rate(&self) -> u64 {
+        self.rate
+    }
+
+    /// Records a packet of `size` bytes that is ready to be sent at `now`,
+    /// and returns the time at which it should be sent.
+    pub fn send(&mut self, size: usize, now: Instant) -> Instant {
+        if !self.enabled || self.rate == 0 {
+            self.tat = now;
+            return now;
+        }
+
+        let at = cmp::max(now, self.conform_time(size));
+
+        self.tat = cmp::max(self.tat, at) + self.interval(size);
+        self.last_size = size;
+
+        at
+    }
+
+    /// Returns the earliest time the next packet can be sent, if it is as
+    /// large as the last one.
+    pub fn next_time(&self) -> Instant {
+        if !self.enabled || self.rate == 0 {
+            return self.tat;
+        }
+
+        self.conform_time(self.last_size)
+    }
+
+    /// Returns the earliest time a packet of `size` bytes fits in the
+    /// bucket, whose `capacity` bytes include the packet.
+    fn conform_time(&self, size: usize) -> Instant {
+        let tolerance = self.interval(self.capacity.saturating_sub(size));
+
+        self.tat.checked_sub(tolerance).unwrap_or(self.tat)
+    }
+
+    /// Returns the time `size` bytes take at the pacing rate.
+    fn interval(&self, size: usize) -> Duration {
+        Duration::from_secs_f64(size as f64 / self.rate as f64)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const MS: Duration = Duration::from_millis(1);
+
+    #[test]
+    fn burst_then_spacing() {
+        // 1000 byte packets leave every millisecond, after a burst of 2.
+        let mut p = Pacer::new(true, 2000);
+        p.update(1_000_000);
+
+        let now = Instant::now();
+
+        assert_eq!(p.send(1000, now), now);
+        assert_eq!(p.send(1000, now), now);
+        assert_eq!(p.send(1000, now), now + MS);
+        assert_eq!(p.send(1000, now), now + 2 * MS);
+        assert_eq!(p.next_time(), now + 3 * MS);
+
+        // An idle sender gets its burst back, but no more.
+        let later = now + 100 * MS;
+        assert_eq!(p.send(1000, later), later);
+        assert_eq!(p.send(1000, later), later);
+        assert_eq!(p.send(1000, later), later + MS);
+
+        // A packet larger than the bucket goes once it is empty.
+        assert_eq!(p.send(3000, later), later + 3 * MS);
+        assert_eq!(p.send(1000, later), later + 5 * MS);
+    }
+
+    #[test]
+    fn rate_change() {
+        let mut p = Pacer::new(true, 0);
+        p.update(1_000_000);
+
+        let now = Instant::now();
+
+        assert_eq!(p.send(1000, now), now);
+        assert_eq!(p.send(1000, now), now + MS);
+
+        // Half the rate, twice the interval.
+        p.update(500_000);
+        assert_eq!(p.send(1000, now), now + 2 * MS);
+        assert_eq!(p.send(1000, now), now + 4 * MS);
+        assert_eq!(p.rate(), 500_000);
+    }
+
+    #[test]
+    fn no_pacing() {
+        let now = Instant::now();
+
+        // Disabled.
+        let mut p = Pacer::new(false, 0);
+        p.update(1_000_000);
+        for _ in 0..10 {
+            assert_eq!(p.send(1000, now), now);
+        }
+
+        // Rate not known yet.
+        let mut p = Pacer::new(true, 0);
+        for _ in 0..10 {
+            assert_eq!(p.send(1000, now), now);
+        }
+        assert_eq!(p.next_time(), now);
+    }
+}
@@ -0,0 +1,191 @@
+// Transmission order of the blocks of a window.
+//
+// At the start of every congestion window, the blocks to send, the ones not
+// acknowledged yet followed by new data, are put in the order they leave
+// in, so that a window cut short drops the least valuable blocks rather than
+// the last ones of the buffer. Blocks are ranked in a handful of classes, by
+// priority and by whether they were sent before, and a stable counting sort
+// keeps the offset order within a class, in linear time.
+
+use std::str::FromStr;
+
+/// The number of classes blocks are ranked in: three priorities, each split
+/// into retransmissions and new data.
+const CLASSES: usize = 6;
+
+/// Available policies to order the blocks of a window.
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+#[repr(C)]
+pub enum SchedulingPolicy {
+    /// Blocks are sent in offset order. `offset` in a string form.
+    OFFSET = 0,
+
+    /// Blocks are sent by priority, highest first, and within a priority,
+    /// retransmissions go ahead of new data (default). `priority` in a
+    /// string form.
+    PRIORITY = 1,
+
+    /// Retransmissions go ahead of all new data, both by priority.
+    /// `retransmit` in a string form.
+    RETRANSMIT = 2,
+}
+
+impl FromStr for SchedulingPolicy {
+    type Err = crate::Error;
+
+    /// Converts a string to `SchedulingPolicy`.
+    ///
+    /// If `name` is not valid, `Error::InvalidState` is returned.
+    fn from_str(name: &str) -> std::result::Result<Self, Self::Err> {
+        match name {
+            "offset" => Ok(SchedulingPolicy::OFFSET),
+            "priority" => Ok(SchedulingPolicy::PRIORITY),
+            "retransmit" => Ok(SchedulingPolicy::RETRANSMIT),
+            _ => Err(crate::Error::InvalidState),
+        }
+    }
+}
+
+impl SchedulingPolicy {
+    /// Returns the class of a block of `priority`, lower classes being sent
+    /// first.
+    #[inline]
+    fn class(self, priority: u8, retransmission: bool) -> usize {
+        // 0 for the highest priority, 2 for the lowest.
+        let level = 3 - priority.clamp(1, 3) as usize;
+        let fresh = !retransmission as usize;
+
+        match self {
+            SchedulingPolicy::OFFSET => 0,
+
+            SchedulingPolicy::PRIORITY => level * 2 + fresh,
+
+            SchedulingPolicy::RETRANSMIT => fresh * 3 + level,
+        }
+    }
+}
+
+/// Orders the blocks of a window, reusing its buffers from one window to
+/// the next.
+#[derive(Debug, Default)]
+pub struct Scheduler {
+    /// The class of each block being ordered.
+    classes: Vec<u8>,
+
+    /// The blocks in their new order.
+    order: Vec<usize>,
+}
+
+impl Scheduler {
+    /// Reorders the block indices of `blocks` following `policy`.
+    ///
+    /// `classify` returns the priority of a block and whether it was sent
+    /// before. Blocks of the same class keep their relative order.
+    pub fn schedule<F>(
+        &mut self, policy: SchedulingPolicy, blocks: &mut [usize], classify: F,
+    ) where
+        F: Fn(usize) -> (u8, bool),
+    {
+        if policy == SchedulingPolicy::OFFSET || blocks.len() < 2 {
+            return;
+        }
+
+        let mut start = [0; CLASSES];
+
+        self.classes.clear();
+        for idx in blocks.iter() {
+            let (priority, retransmission) = classify(*idx);
+            let class = policy.class(priority, retransmission);
+
+            self.classes.push(class as u8);
+            start[class] += 1;
+        }
+
+        // Turn the class sizes into the position of their first block.
+        let mut pos = 0;
+        for s in start.iter_mut() {
+            let len = *s;
+            *s = pos;
+            pos += len;
+        }
+
+        self.order.clear();
+        self.order.resize(blocks.len(), 0);
+
+        for (idx, class) in blocks.iter().zip(self.classes.iter()) {
+            let class = *class as usize;
+
+            self.order[start[class]] = *idx;
+            start[class] += 1;
+        }
+
+        blocks.copy_from_slice(&self.order);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Blocks 0 to 11: priority `3 - idx % 3`, retransmitted if `idx % 2`.
+    fn classify(idx: usize) -> (u8, bool) {
+        (3 - (idx % 3) as u8, idx % 2 == 1)
+    }
+
+    fn schedule(policy: SchedulingPolicy) -> Vec<usize> {
+        let mut blocks: Vec<usize> = (0..12).collect();
+        Scheduler::default().schedule(policy, &mut blocks, classify);
+        blocks
+    }
+
+    #[test]
+    fn offset_order() {
+        let blocks: Vec<usize> = (0..12).collect();
+        assert_eq!(schedule(SchedulingPolicy::OFFSET), blocks);
+    }
+
+    #[test]
+    fn priority_order() {
+        assert_eq!(schedule(SchedulingPolicy::PRIORITY), [
+            3, 9, 0, 6, // priority 3
+            1, 7, 4, 10, // priority 2
+            5, 11, 2, 8, // priority 1
+        ]);
+    }
+
+    #[test]
+    fn retransmit_order() {
+        assert_eq!(schedule(SchedulingPolicy::RETRANSMIT), [
+            3, 9, 1, 7, 5, 11, // retransmissions
+            0, 6, 4, 10, 2, 8, // new data
+        ]);
+    }
+
+    #[test]
+    fn stable_within_class() {
+        let mut s = Scheduler::default();
+
+        // All in one class, in no particular order.
+        let mut blocks = vec![9, 2, 7, 4, 0];
+        s.schedule(SchedulingPolicy::PRIORITY, &mut blocks, |_| (2, false));
+        assert_eq!(blocks, [9, 2, 7, 4, 0]);
+
+        // The buffers are reused for a shorter window.
+        let mut blocks = vec![5, 1, 3];
+        s.schedule(SchedulingPolicy::RETRANSMIT, &mut blocks, |i| {
+            (1, i == 3)
+        });
+        assert_eq!(blocks, [3, 5, 1]);
+    }
+
+    #[test]
+    fn from_str() {
+        assert_eq!("offset".parse(), Ok(SchedulingPolicy::OFFSET));
+        assert_eq!("priority".parse(), Ok(SchedulingPolicy::PRIORITY));
+        assert_eq!("retransmit".parse(), Ok(SchedulingPolicy::RETRANSMIT));
+        assert_eq!(
+            "fifo".parse::<SchedulingPolicy>(),
+            Err(crate::Error::InvalidState)
+        );
+    }
+}
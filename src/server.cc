@@ -24,11 +24,15 @@
 // NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
 // SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#define _GNU_SOURCE
+
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <fcntl.h>
@@ -36,8 +40,12 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
 #include <netdb.h>
 
+#include <linux/net_tstamp.h>
+
 #include <ev.h>
 #include <uthash.h>
 
@@ -47,6 +55,21 @@
 
 #define MAX_DATAGRAM_SIZE 1350
 
+#define MAX_SEND_BATCH 64
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+#ifndef SO_TXTIME
+#define SO_TXTIME 61
+#define SCM_TXTIME SO_TXTIME
+#endif
+
 #define MAX_TOKEN_LEN \
     sizeof("quiche") - 1 + \
     sizeof(struct sockaddr_storage) + \
@@ -82,37 +105,199 @@ static struct connections *conns = NULL;
 
 static void timeout_cb(EV_P_ ev_timer *w, int revents);
 
+// Whether UDP GSO is used, cleared when the kernel rejects it.
+static bool gso_enabled = true;
 
-static void flush_egress(struct ev_loop *loop, struct conn_io *conn_io) {
-    static uint8_t out[MAX_DATAGRAM_SIZE];
+// Whether the kernel paces packets with SO_TXTIME, set when the socket
+// accepts it.
+static bool txtime_enabled = false;
+
+// The number of packets sent, used to report packets/s per core.
+static size_t sent_pkts = 0;
+
+// Appends an SCM_TXTIME control message asking the kernel to send the packet
+// at |at|, and returns the space it uses.
+static size_t add_txtime(struct cmsghdr *cm, const struct timespec *at) {
+    uint64_t txtime = (uint64_t) at->tv_sec * 1000000000ULL + at->tv_nsec;
+
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_TXTIME;
+    cm->cmsg_len = CMSG_LEN(sizeof(txtime));
+    memcpy(CMSG_DATA(cm), &txtime, sizeof(txtime));
+
+    return CMSG_SPACE(sizeof(txtime));
+}
+
+// Sends |len| bytes of back to back packets of |segment_size| bytes with a
+// single sendmsg(), letting the kernel split them.
+static ssize_t send_gso(int sock, uint8_t *buf, size_t len,
+                        uint16_t segment_size, quiche_send_info *info) {
+    struct iovec iov = { buf, len };
+
+    union {
+        char buf[CMSG_SPACE(sizeof(uint16_t)) + CMSG_SPACE(sizeof(uint64_t))];
+        struct cmsghdr align;
+    } ctrl;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &info->to;
+    msg.msg_namelen = info->to_len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type = UDP_SEGMENT;
+    cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    memcpy(CMSG_DATA(cm), &segment_size, sizeof(segment_size));
+
+    size_t controllen = CMSG_SPACE(sizeof(uint16_t));
+
+    if (txtime_enabled) {
+        controllen += add_txtime(CMSG_NXTHDR(&msg, cm), &info->at);
+    }
+
+    msg.msg_controllen = controllen;
+
+    return sendmsg(sock, &msg, 0);
+}
+
+// Sends packets with UDP GSO until there is nothing left to send. Returns
+// false if GSO is not supported, in which case the packets already written
+// are sent one by one and the caller has to take over.
+static bool flush_egress_gso(struct conn_io *conn_io) {
+    static uint8_t out[QUICHE_MAX_GSO_SEGMENTS * MAX_DATAGRAM_SIZE];
 
     quiche_send_info send_info;
 
     while (1) {
-        ssize_t written = quiche_conn_send(conn_io->conn, out, sizeof(out),
-                                           &send_info);
+        // The packet number, and so the header, may grow between buffers.
+        size_t segment_size = quiche_conn_segment_size(conn_io->conn);
+        size_t seg;
+
+        ssize_t written = quiche_conn_send_segments(conn_io->conn, out,
+                                                    sizeof(out), segment_size,
+                                                    &seg, &send_info);
 
         if (written == QUICHE_ERR_DONE) {
             fprintf(stderr, "done writing\n");
-            break;
+            return true;
         }
 
         if (written < 0) {
-            fprintf(stderr, "failed to create packet: %zd\n", written);
-            return;
+            fprintf(stderr, "failed to create packets: %zd\n", written);
+            return true;
         }
 
-        ssize_t sent = sendto(conn_io->sock, out, written, 0,
-                              (struct sockaddr *) &send_info.to,
-                              send_info.to_len);
+        ssize_t sent = send_gso(conn_io->sock, out, written, seg, &send_info);
+
+        if (sent < 0 && (errno == EIO || errno == EINVAL ||
+                         errno == ENOPROTOOPT || errno == EOPNOTSUPP)) {
+            fprintf(stderr, "UDP GSO not supported, disabling it\n");
+            gso_enabled = false;
+
+            for (ssize_t off = 0; off < written; off += seg) {
+                size_t len = written - off < seg ? written - off : seg;
+
+                if (sendto(conn_io->sock, out + off, len, 0,
+                           (struct sockaddr *) &send_info.to,
+                           send_info.to_len) != (ssize_t) len) {
+                    perror("failed to send");
+                    return true;
+                }
+
+                sent_pkts++;
+            }
+
+            return false;
+        }
 
         if (sent != written) {
             perror("failed to send");
-            return;
+            return true;
         }
 
+        sent_pkts += (written + seg - 1) / seg;
+
         fprintf(stderr, "sent %zd bytes\n", sent);
     }
+}
+
+// Prints the number of packets sent per second of CPU time. This depends on
+// the link and the peer; `cargo bench --bench egress` measures the same rate
+// repeatably over loopback.
+static void report_egress(void) {
+    double cpu = (double) clock() / CLOCKS_PER_SEC;
+
+    fprintf(stderr, "sent %zu packets, %.0f packets/s per core (gso=%d)\n",
+            sent_pkts, cpu > 0 ? sent_pkts / cpu : 0.0, gso_enabled);
+}
+
+
+static void flush_egress(struct ev_loop *loop, struct conn_io *conn_io) {
+    if (gso_enabled && flush_egress_gso(conn_io)) {
+        goto done;
+    }
+
+    static uint8_t out[MAX_SEND_BATCH][MAX_DATAGRAM_SIZE];
+    static size_t out_lens[MAX_SEND_BATCH];
+    static quiche_send_info send_info[MAX_SEND_BATCH];
+    static struct iovec iov[MAX_SEND_BATCH];
+    static struct mmsghdr msgs[MAX_SEND_BATCH];
+    static union {
+        char buf[CMSG_SPACE(sizeof(uint64_t))];
+        struct cmsghdr align;
+    } ctrl[MAX_SEND_BATCH];
+
+    while (1) {
+        ssize_t n = quiche_conn_send_batch(conn_io->conn, &out[0][0],
+                                           MAX_DATAGRAM_SIZE, out_lens,
+                                           send_info, MAX_SEND_BATCH);
+
+        if (n == QUICHE_ERR_DONE) {
+            fprintf(stderr, "done writing\n");
+            break;
+        }
+
+        if (n < 0) {
+            fprintf(stderr, "failed to create packets: %zd\n", n);
+            return;
+        }
+
+        for (ssize_t i = 0; i < n; i++) {
+            iov[i].iov_base = out[i];
+            iov[i].iov_len = out_lens[i];
+
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_name = &send_info[i].to;
+            msgs[i].msg_hdr.msg_namelen = send_info[i].to_len;
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+
+            if (txtime_enabled) {
+                msgs[i].msg_hdr.msg_control = ctrl[i].buf;
+                msgs[i].msg_hdr.msg_controllen = sizeof(ctrl[i].buf);
+
+                add_txtime(CMSG_FIRSTHDR(&msgs[i].msg_hdr), &send_info[i].at);
+            }
+        }
+
+        int sent = sendmmsg(conn_io->sock, msgs, n, 0);
+
+        if (sent != n) {
+            perror("failed to send");
+            return;
+        }
+
+        sent_pkts += sent;
+
+        fprintf(stderr, "sent %d packets\n", sent);
+    }
+
+done:
 
     double t = quiche_conn_timeout_as_nanos(conn_io->conn) / 1e9f;
     conn_io->timer.repeat = t;
@@ -253,8 +438,10 @@ static void recv_cb(EV_P_ ev_io *w, int revents) {
             quiche_conn_stats(conn_io->conn, &stats);
             quiche_conn_path_stats(conn_io->conn, 0, &path_stats);
 
-            fprintf(stderr, "connection closed, recv=%zu sent=%zu lost=%zu rtt=%" PRIu64 "ns cwnd=%zu\n",
-                    stats.recv, stats.sent, stats.lost, path_stats.rtt, path_stats.cwnd);
+            fprintf(stderr, "connection closed, recv=%zu sent=%zu lost=%zu retrans=%zu rollbacks=%zu rtt=%" PRIu64 "ns cwnd=%zu rate=%" PRIu64 "B/s\n",
+                    stats.recv, stats.sent, stats.lost, stats.retrans, stats.rollbacks,
+                    path_stats.rtt, path_stats.cwnd, path_stats.delivery_rate);
+            report_egress();
 
             HASH_DELETE(hh, conns->h, conn_io);
 
@@ -280,8 +467,10 @@ static void timeout_cb(EV_P_ ev_timer *w, int revents) {
         quiche_conn_stats(conn_io->conn, &stats);
         quiche_conn_path_stats(conn_io->conn, 0, &path_stats);
 
-        fprintf(stderr, "connection closed, recv=%zu sent=%zu lost=%zu rtt=%" PRIu64 "ns cwnd=%zu\n",
-                stats.recv, stats.sent, stats.lost, path_stats.rtt, path_stats.cwnd);
+        fprintf(stderr, "connection closed, recv=%zu sent=%zu lost=%zu retrans=%zu rollbacks=%zu rtt=%" PRIu64 "ns cwnd=%zu rate=%" PRIu64 "B/s\n",
+                stats.recv, stats.sent, stats.lost, stats.retrans, stats.rollbacks,
+                path_stats.rtt, path_stats.cwnd, path_stats.delivery_rate);
+        report_egress();
 
         HASH_DELETE(hh, conns->h, conn_io);
 
@@ -321,6 +510,14 @@ int main(int argc, char *argv[]) {
         return -1;
     }
 
+    struct sock_txtime txtime = { CLOCK_MONOTONIC, 0 };
+    if (setsockopt(sock, SOL_SOCKET, SO_TXTIME, &txtime,
+                   sizeof(txtime)) == 0) {
+        txtime_enabled = true;
+    } else {
+        perror("SO_TXTIME not supported, packets are not paced");
+    }
+
     if (bind(sock, local->ai_addr, local->ai_addrlen) < 0) {
         perror("failed to connect socket");
         return -1;
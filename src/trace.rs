@@ -0,0 +1,325 @@
+// Connection event tracing.
+//
+// Events are recorded as small fixed-size records into a ring buffer owned
+// by the connection, so recording one is a copy and never takes a lock or
+// allocates. When the ring is full the oldest events are overwritten. The
+// whole module, and every call site going through `qlog_event!`, is only
+// built with the `qlog` feature.
+//
+// The events can be exported as qlog JSON-SEQ (one JSON record per line,
+// prefixed with the RS character), which qvis and similar tools can read.
+
+use std::io;
+
+use std::time::Duration;
+use std::time::Instant;
+
+use crate::packet;
+
+/// The number of events kept per connection.
+pub const TRACE_CAPACITY: usize = 16384;
+
+/// A traced event.
+#[derive(Clone, Copy, Debug)]
+pub enum Event {
+    /// A packet was written by `send_data()`.
+    PacketSent {
+        ty: packet::Type,
+        pkt_num: u64,
+        offset: u64,
+        len: u64,
+        priority: u8,
+    },
+
+    /// A packet was processed by `recv_slice()`.
+    PacketReceived {
+        ty: packet::Type,
+        pkt_num: u64,
+        offset: u64,
+        len: u64,
+        priority: u8,
+    },
+
+    /// An ACK packet was processed.
+    AckProcessed {
+        max_ack: u64,
+        blocks: usize,
+        weights: f32,
+    },
+
+    /// A new congestion window was computed.
+    WindowComputed { cwnd: usize, high_ratio: f64 },
+
+    /// The congestion window was rolled back to a former value.
+    Rollback { cwnd: usize, high_ratio: f64 },
+
+    /// Data was moved into the send buffer for the next window.
+    DataBuffered { len: usize },
+
+    /// The RTT estimate was updated.
+    RttUpdated { latest: Duration, rtt: Duration },
+
+    /// The loss detection timer expired and `blocks` blocks are probed.
+    PtoExpired { pto_count: u32, blocks: usize },
+}
+
+/// A ring buffer of events.
+pub struct Trace {
+    /// Event times are relative to this.
+    start: Instant,
+
+    /// Whether this is the server side of the connection.
+    server: bool,
+
+    events: Vec<(Duration, Event)>,
+
+    /// The index of the oldest event once the ring is full.
+    head: usize,
+
+    /// The number of events overwritten.
+    dropped: u64,
+}
+
+impl Trace {
+    pub fn new(server: bool) -> Trace {
+        Trace {
+            start: Instant::now(),
+            server,
+            events: Vec::with_capacity(TRACE_CAPACITY),
+            head: 0,
+            dropped: 0,
+        }
+    }
+
+    /// Records an event at the current time.
+    #[inline]
+    pub fn record(&mut self, ev: Event) {
+        let time = self.start.elapsed();
+
+        if self.events.len() < TRACE_CAPACITY {
+            self.events.push((time, ev));
+            return;
+        }
+
+        self.events[self.head] = (time, ev);
+        self.head = (self.head + 1) % TRACE_CAPACITY;
+        self.dropped += 1;
+    }
+
+    /// Returns the number of events overwritten because the ring was full.
+    pub fn dropped(&self) -> u64 {
+        self.dropped
+    }
+
+    /// Iterates over the recorded events, oldest first.
+    pub fn events(&self) -> impl Iterator<Item = &(Duration, Event)> {
+        self.events[self.head..]
+            .iter()
+            .chain(self.events[..self.head].iter())
+    }
+
+    /// Writes the recorded events as qlog JSON-SEQ.
+    pub fn write_json_seq<W: io::Write>(&self, w: &mut W) -> io::Result<()> {
+        let vantage_point = if self.server { "server" } else { "client" };
+
+        writeln!(
+            w,
+            "\x1e{{\"qlog_version\":\"0.3\",\"qlog_format\":\"JSON-SEQ\",\
+             \"title\":\"dmludp\",\"trace\":{{\"vantage_point\":\
+             {{\"type\":\"{}\"}},\"common_fields\":{{\"time_format\":\
+             \"relative\",\"reference_time\":0}}}},\"dropped_events\":{}}}",
+            vantage_point, self.dropped()
+        )?;
+
+        for (time, ev) in self.events() {
+            write!(w, "\x1e{{\"time\":{:.3},", time.as_secs_f64() * 1000.0)?;
+
+            match ev {
+                Event::PacketSent {
+                    ty,
+                    pkt_num,
+                    offset,
+                    len,
+                    priority,
+                } => write_packet(
+                    w,
+                    "transport:packet_sent",
+                    *ty,
+                    *pkt_num,
+                    *offset,
+                    *len,
+                    *priority,
+                )?,
+
+                Event::PacketReceived {
+                    ty,
+                    pkt_num,
+                    offset,
+                    len,
+                    priority,
+                } => write_packet(
+                    w,
+                    "transport:packet_received",
+                    *ty,
+                    *pkt_num,
+                    *offset,
+                    *len,
+                    *priority,
+                )?,
+
+                Event::AckProcessed {
+                    max_ack,
+                    blocks,
+                    weights,
+                } => write!(
+                    w,
+                    "\"name\":\"recovery:ack_processed\",\"data\":{{\
+                     \"max_ack\":{},\"blocks\":{},\"weights\":{}}}",
+                    max_ack, blocks, weights
+                )?,
+
+                Event::WindowComputed { cwnd, high_ratio } => write!(
+                    w,
+                    "\"name\":\"recovery:metrics_updated\",\"data\":{{\
+                     \"congestion_window\":{},\"high_priority_ratio\":{}}}",
+                    cwnd,
+                    json_f64(*high_ratio)
+                )?,
+
+                Event::Rollback { cwnd, high_ratio } => write!(
+                    w,
+                    "\"name\":\"recovery:metrics_updated\",\"data\":{{\
+                     \"congestion_window\":{},\"high_priority_ratio\":{},\
+                     \"trigger\":\"rollback\"}}",
+                    cwnd,
+                    json_f64(*high_ratio)
+                )?,
+
+                Event::DataBuffered { len } => write!(
+                    w,
+                    "\"name\":\"transport:data_moved\",\"data\":{{\
+                     \"to\":\"send_buffer\",\"length\":{}}}",
+                    len
+                )?,
+
+                Event::RttUpdated { latest, rtt } => write!(
+                    w,
+                    "\"name\":\"recovery:metrics_updated\",\"data\":{{\
+                     \"latest_rtt\":{:.3},\"smoothed_rtt\":{:.3}}}",
+                    latest.as_secs_f64() * 1000.0,
+                    rtt.as_secs_f64() * 1000.0
+                )?,
+
+                Event::PtoExpired { pto_count, blocks } => write!(
+                    w,
+                    "\"name\":\"recovery:loss_timer_updated\",\"data\":{{\
+                     \"event_type\":\"expired\",\"pto_count\":{},\
+                     \"blocks\":{}}}",
+                    pto_count, blocks
+                )?,
+            }
+
+            writeln!(w, "}}")?;
+        }
+
+        Ok(())
+    }
+}
+
+fn write_packet<W: io::Write>(
+    w: &mut W, name: &str, ty: packet::Type, pkt_num: u64, offset: u64,
+    len: u64, priority: u8,
+) -> io::Result<()> {
+    let packet_type = match ty {
+        packet::Type::Retry => "retry",
+        packet::Type::Handshake => "handshake",
+        packet::Type::Application => "application",
+        packet::Type::ElictAck => "elict_ack",
+        packet::Type::ACK => "ack",
+        packet::Type::Stop => "stop",
+        packet::Type::Fin => "fin",
+        packet::Type::StartAck => "start_ack",
+        packet::Type::Fec => "fec",
+    };
+
+    write!(
+        w,
+        "\"name\":\"{}\",\"data\":{{\"header\":{{\"packet_type\":\"{}\",\
+         \"packet_number\":{},\"offset\":{},\"priority\":{}}},\
+         \"raw\":{{\"payload_length\":{}}}}}",
+        name, packet_type, pkt_num, offset, priority, len
+    )
+}
+
+// JSON has no representation for NaN or infinities.
+fn json_f64(v: f64) -> String {
+    if v.is_finite() {
+        v.to_string()
+    } else {
+        "null".to_string()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn ring_overwrites_oldest() {
+        let mut t = Trace::new(true);
+
+        for len in 0..TRACE_CAPACITY + 3 {
+            t.record(Event::DataBuffered { len });
+        }
+
+        assert_eq!(t.dropped(), 3);
+        assert_eq!(t.events().count(), TRACE_CAPACITY);
+
+        let lens: Vec<usize> = t
+            .events()
+            .map(|(_, ev)| match ev {
+                Event::DataBuffered { len } => *len,
+                _ => unreachable!(),
+            })
+            .collect();
+
+        assert_eq!(lens[0], 3);
+        assert_eq!(lens[TRACE_CAPACITY - 1], TRACE_CAPACITY + 2);
+        assert!(lens.windows(2).all(|w| w[0] + 1 == w[1]));
+    }
+
+    #[test]
+    fn json_seq() {
+        let mut t = Trace::new(false);
+
+        t.record(Event::PacketSent {
+            ty: packet::Type::Fec,
+            pkt_num: 7,
+            offset: 1024,
+            len: 512,
+            priority: 3,
+        });
+        t.record(Event::WindowComputed {
+            cwnd: 10,
+            high_ratio: f64::NAN,
+        });
+
+        let mut out = Vec::new();
+        t.write_json_seq(&mut out).unwrap();
+        let out = String::from_utf8(out).unwrap();
+
+        let lines: Vec<&str> = out.lines().collect();
+        assert_eq!(lines.len(), 3);
+        assert!(lines.iter().all(|l| l.starts_with('\x1e') && l.ends_with('}')));
+
+        assert!(lines[0].contains("\"vantage_point\":{\"type\":\"client\"}"));
+        assert!(lines[0].contains("\"dropped_events\":0"));
+
+        assert!(lines[1].contains("\"name\":\"transport:packet_sent\""));
+        assert!(lines[1].contains("\"packet_type\":\"fec\""));
+        assert!(lines[1].contains("\"packet_number\":7"));
+        assert!(lines[1].contains("\"payload_length\":512"));
+
+        assert!(lines[2].contains("\"high_priority_ratio\":null"));
+    }
+}